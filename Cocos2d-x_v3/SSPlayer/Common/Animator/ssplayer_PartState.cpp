@@ -1,6 +1,7 @@
-﻿#include "../loader/ssloader.h"
+﻿#include "../Loader/ssloader.h"
 //#include "ssplayer_animedecode.h"
 #include "ssplayer_PartState.h"
+#include <cstring>
 
 namespace ss
 {
@@ -4,6 +4,21 @@
 //#include <malloc.h>
 #include <memory.h>
 #include <math.h>
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 1))
+#include <xmmintrin.h>
+#define SS_SIMD_SSE
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SS_SIMD_NEON
+#endif
+
+//2Dの計算と4x4の計算、SIMDとスカラーの計算の結果を一致させるため、積和命令（FMA）への変換を行わない
+//GCCはこのプラグマに対応していないので、-ffp-contract=offを指定してビルドしてください（CMakeLists.txt参照）
+#if defined(_MSC_VER)
+#pragma fp_contract(off)
+#elif defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#endif
 
 namespace ss
 {
@@ -152,5 +167,152 @@ void    Matrix4RotationZ( float* _matrix ,const float radians )
 
 }
 
+/*
+* マトリクスに 移動 x X回転 x Y回転 x Z回転 x スケール を適用する（回転はラジアン）
+* X回転、Y回転が0の場合は2Dのアフィン変換として必要な行だけを計算する
+* 計算順は4x4のマトリクスを乗算した場合と同じため、結果は変わらない（Test/ss6player_test_matrix.cppで確認）
+*/
+void	MultiplyTRSMatrix( float* _matrix , const float x , const float y , const float radiansX , const float radiansY , const float radiansZ , const float scaleX , const float scaleY )
+{
+	if ((radiansX == 0.0f) && (radiansY == 0.0f))
+	{
+		float c = cosf(radiansZ);
+		float s = sinf(radiansZ);
+		for (int k = 0; k < 4; k++)
+		{
+			float m0 = _matrix[0 + k];
+			float m1 = _matrix[4 + k];
+			_matrix[0 + k] = scaleX * (c * m0 + s * m1);
+			_matrix[4 + k] = scaleY * (-s * m0 + c * m1);
+			_matrix[12 + k] = (x * m0 + y * m1) + _matrix[12 + k];
+		}
+		return;
+	}
+
+	float t[16];
+	TranslationMatrix(t, x, y, 0.0f);
+	MultiplyMatrix(t, _matrix, _matrix);
+
+	Matrix4RotationX(t, radiansX);
+	MultiplyMatrix(t, _matrix, _matrix);
+
+	Matrix4RotationY(t, radiansY);
+	MultiplyMatrix(t, _matrix, _matrix);
+
+	Matrix4RotationZ(t, radiansZ);
+	MultiplyMatrix(t, _matrix, _matrix);
+
+	ScaleMatrix(t, scaleX, scaleY, 1.0f);
+	MultiplyMatrix(t, _matrix, _matrix);
+}
+
+//TRSMatrixBatchのレーンに親のマトリクスと移動、Z回転、スケールを設定する
+void	SetTRSMatrixBatch( TRSMatrixBatch& batch , int lane , const float* parent , const float x , const float y , const float radiansZ , const float scaleX , const float scaleY , const float localScaleX , const float localScaleY )
+{
+	for (int e = 0; e < 16; e++)
+	{
+		batch.parent[e * TRSMatrixBatch::LANE + lane] = parent[e];
+	}
+	batch.x[lane] = x;
+	batch.y[lane] = y;
+	batch.c[lane] = cosf(radiansZ);
+	batch.s[lane] = sinf(radiansZ);
+	batch.scaleX[lane] = scaleX;
+	batch.scaleY[lane] = scaleY;
+	batch.localScaleX[lane] = localScaleX;
+	batch.localScaleY[lane] = localScaleY;
+}
+
+/*
+* MultiplyTRSMatrixの2Dの計算を4レーン同時に行い、継承マトリクスとローカルマトリクスをSoAで書き込む
+* SSE、NEONが使用できる場合はSIMDで計算する
+* 計算順はMultiplyTRSMatrixと同じため、結果は一致する（Test/ss6player_test_matrix.cppで確認）
+*/
+void	MultiplyTRSMatrixBatch( const TRSMatrixBatch& batch , float* _matrix , float* _localMatrix )
+{
+	enum { LANE = TRSMatrixBatch::LANE };
+
+#if defined(SS_SIMD_SSE)
+	__m128 vx = _mm_loadu_ps(batch.x);
+	__m128 vy = _mm_loadu_ps(batch.y);
+	__m128 vc = _mm_loadu_ps(batch.c);
+	__m128 vs = _mm_loadu_ps(batch.s);
+	__m128 vns = _mm_xor_ps(vs, _mm_set1_ps(-0.0f));
+	__m128 vsx = _mm_loadu_ps(batch.scaleX);
+	__m128 vsy = _mm_loadu_ps(batch.scaleY);
+	__m128 vlsx = _mm_loadu_ps(batch.localScaleX);
+	__m128 vlsy = _mm_loadu_ps(batch.localScaleY);
+	for (int k = 0; k < 4; k++)
+	{
+		__m128 m0 = _mm_loadu_ps(&batch.parent[(0 + k) * LANE]);
+		__m128 m1 = _mm_loadu_ps(&batch.parent[(4 + k) * LANE]);
+		__m128 m2 = _mm_loadu_ps(&batch.parent[(8 + k) * LANE]);
+		__m128 m3 = _mm_loadu_ps(&batch.parent[(12 + k) * LANE]);
+		__m128 r0 = _mm_add_ps(_mm_mul_ps(vc, m0), _mm_mul_ps(vs, m1));
+		__m128 r1 = _mm_add_ps(_mm_mul_ps(vns, m0), _mm_mul_ps(vc, m1));
+		__m128 r3 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, m0), _mm_mul_ps(vy, m1)), m3);
+		_mm_storeu_ps(&_matrix[(0 + k) * LANE], _mm_mul_ps(vsx, r0));
+		_mm_storeu_ps(&_matrix[(4 + k) * LANE], _mm_mul_ps(vsy, r1));
+		_mm_storeu_ps(&_matrix[(8 + k) * LANE], m2);
+		_mm_storeu_ps(&_matrix[(12 + k) * LANE], r3);
+		_mm_storeu_ps(&_localMatrix[(0 + k) * LANE], _mm_mul_ps(vlsx, r0));
+		_mm_storeu_ps(&_localMatrix[(4 + k) * LANE], _mm_mul_ps(vlsy, r1));
+		_mm_storeu_ps(&_localMatrix[(8 + k) * LANE], m2);
+		_mm_storeu_ps(&_localMatrix[(12 + k) * LANE], r3);
+	}
+#elif defined(SS_SIMD_NEON)
+	float32x4_t vx = vld1q_f32(batch.x);
+	float32x4_t vy = vld1q_f32(batch.y);
+	float32x4_t vc = vld1q_f32(batch.c);
+	float32x4_t vs = vld1q_f32(batch.s);
+	float32x4_t vns = vnegq_f32(vs);
+	float32x4_t vsx = vld1q_f32(batch.scaleX);
+	float32x4_t vsy = vld1q_f32(batch.scaleY);
+	float32x4_t vlsx = vld1q_f32(batch.localScaleX);
+	float32x4_t vlsy = vld1q_f32(batch.localScaleY);
+	for (int k = 0; k < 4; k++)
+	{
+		float32x4_t m0 = vld1q_f32(&batch.parent[(0 + k) * LANE]);
+		float32x4_t m1 = vld1q_f32(&batch.parent[(4 + k) * LANE]);
+		float32x4_t m2 = vld1q_f32(&batch.parent[(8 + k) * LANE]);
+		float32x4_t m3 = vld1q_f32(&batch.parent[(12 + k) * LANE]);
+		//結果を合わせるため積和命令（FMA）は使用しない
+		float32x4_t r0 = vaddq_f32(vmulq_f32(vc, m0), vmulq_f32(vs, m1));
+		float32x4_t r1 = vaddq_f32(vmulq_f32(vns, m0), vmulq_f32(vc, m1));
+		float32x4_t r3 = vaddq_f32(vaddq_f32(vmulq_f32(vx, m0), vmulq_f32(vy, m1)), m3);
+		vst1q_f32(&_matrix[(0 + k) * LANE], vmulq_f32(vsx, r0));
+		vst1q_f32(&_matrix[(4 + k) * LANE], vmulq_f32(vsy, r1));
+		vst1q_f32(&_matrix[(8 + k) * LANE], m2);
+		vst1q_f32(&_matrix[(12 + k) * LANE], r3);
+		vst1q_f32(&_localMatrix[(0 + k) * LANE], vmulq_f32(vlsx, r0));
+		vst1q_f32(&_localMatrix[(4 + k) * LANE], vmulq_f32(vlsy, r1));
+		vst1q_f32(&_localMatrix[(8 + k) * LANE], m2);
+		vst1q_f32(&_localMatrix[(12 + k) * LANE], r3);
+	}
+#else
+	for (int k = 0; k < 4; k++)
+	{
+		for (int lane = 0; lane < LANE; lane++)
+		{
+			float m0 = batch.parent[(0 + k) * LANE + lane];
+			float m1 = batch.parent[(4 + k) * LANE + lane];
+			float m2 = batch.parent[(8 + k) * LANE + lane];
+			float m3 = batch.parent[(12 + k) * LANE + lane];
+			float r0 = batch.c[lane] * m0 + batch.s[lane] * m1;
+			float r1 = -batch.s[lane] * m0 + batch.c[lane] * m1;
+			float r3 = (batch.x[lane] * m0 + batch.y[lane] * m1) + m3;
+			_matrix[(0 + k) * LANE + lane] = batch.scaleX[lane] * r0;
+			_matrix[(4 + k) * LANE + lane] = batch.scaleY[lane] * r1;
+			_matrix[(8 + k) * LANE + lane] = m2;
+			_matrix[(12 + k) * LANE + lane] = r3;
+			_localMatrix[(0 + k) * LANE + lane] = batch.localScaleX[lane] * r0;
+			_localMatrix[(4 + k) * LANE + lane] = batch.localScaleY[lane] * r1;
+			_localMatrix[(8 + k) * LANE + lane] = m2;
+			_localMatrix[(12 + k) * LANE + lane] = r3;
+		}
+	}
+#endif
+}
+
 
 };
@@ -15,6 +15,28 @@ void    Matrix4RotationX( float* _matrix ,const float radians );
 void    Matrix4RotationY( float* _matrix ,const float radians );
 void    Matrix4RotationZ( float* _matrix ,const float radians );
 void	MatrixCopy(float* src, float* dst);
+void	MultiplyTRSMatrix( float* _matrix , const float x , const float y , const float radiansX , const float radiansY , const float radiansZ , const float scaleX , const float scaleY );
+
+/*
+* MultiplyTRSMatrixの2Dの計算（X回転、Y回転が0）を4つまとめて行うための入力
+* マトリクスは[要素][レーン]の順に並べたSoA（16要素 x 4レーン）で保持する
+*/
+struct TRSMatrixBatch
+{
+	enum { LANE = 4 };
+
+	float	parent[16 * LANE];
+	float	x[LANE];
+	float	y[LANE];
+	float	c[LANE];			//cos(Z回転)
+	float	s[LANE];			//sin(Z回転)
+	float	scaleX[LANE];
+	float	scaleY[LANE];
+	float	localScaleX[LANE];	//ローカルスケールを乗算したスケール
+	float	localScaleY[LANE];
+};
+void	SetTRSMatrixBatch( TRSMatrixBatch& batch , int lane , const float* parent , const float x , const float y , const float radiansZ , const float scaleX , const float scaleY , const float localScaleX , const float localScaleY );
+void	MultiplyTRSMatrixBatch( const TRSMatrixBatch& batch , float* _matrix , float* _localMatrix );
 
 inline	void	TranslationMatrixM(  float* _matrix , const float x , const float y , const float z )
 {
@@ -64,6 +86,14 @@ inline	void	RotationXYZMatrixM(  float* _matrix , const float x , const float y
 		MultiplyMatrix( _m , _matrix , _matrix );
 	}
 }
+//座標(x, y, z)を行列で変換したxyを求める
+//TranslationMatrixで作成した行列にMultiplyMatrixで掛けた結果の[12][13]と同じ値になる
+inline	void	TransformVertex( const float* _matrix , const float x , const float y , const float z , float* out_x , float* out_y )
+{
+	*out_x = x * _matrix[0] + y * _matrix[4] + z * _matrix[8] + _matrix[12];
+	*out_y = x * _matrix[1] + y * _matrix[5] + z * _matrix[9] + _matrix[13];
+}
+
 inline	void	MatrixCopy(float* src, float* dst)
 {
 	int i;
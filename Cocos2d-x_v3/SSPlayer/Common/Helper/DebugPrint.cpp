@@ -1,5 +1,6 @@
 ﻿#include "DebugPrint.h"
 #include <stdio.h>  
+#include <stdarg.h>
 #include <string>
 #include <iostream>
 
@@ -0,0 +1,101 @@
+﻿/**
+*  ss6player_headless.cpp
+*
+*  ヘッドレスビルド（ss6player_core）の使用例です。
+*  ssbpを読み込み、描画を行わずにアニメーションを更新してパーツの状態を表示します。
+*
+*  ss6player_headless <ssbpファイル> <アニメーション名（ssae名/モーション名）> [更新するフレーム数]
+*/
+#include "SS6Player.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+//PNGのヘッダから画像のサイズを取得する
+//描画を行わないので、テクスチャはサイズのみを読み込む
+static bool readPngSize(const char* fileName, int& w, int& h)
+{
+	FILE* fp = fopen(fileName, "rb");
+	if (fp == NULL)
+	{
+		return false;
+	}
+	unsigned char header[24];
+	size_t size = fread(header, 1, sizeof(header), fp);
+	fclose(fp);
+
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a };
+	if ((size != sizeof(header)) || (memcmp(header, signature, sizeof(signature)) != 0))
+	{
+		return false;
+	}
+	//IHDRチャンクの幅と高さ（ビッグエンディアン）
+	w = (header[16] << 24) | (header[17] << 16) | (header[18] << 8) | header[19];
+	h = (header[20] << 24) | (header[21] << 16) | (header[22] << 8) | header[23];
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3)
+	{
+		printf("usage: %s <ssbp> <ssae/motion> [frames]\n", argv[0]);
+		return 1;
+	}
+	std::string ssbpFilepath = argv[1];
+	std::string animeName = argv[2];
+	int frames = (argc > 3) ? atoi(argv[3]) : 60;
+
+	ss::SSPlatformInit();
+
+	//テクスチャの読み込みをアプリケーション側で行う
+	ss::SSPlatformBackend backend;
+	long textureCount = 0;
+	backend.textureLoad = [&](const char* fileName, const char* zipFileName, int /*wrapmode*/, int /*filtermode*/, long& userHandle, int& w, int& h)
+	{
+		if ((strcmp(zipFileName, "") != 0) || (readPngSize(fileName, w, h) == false))
+		{
+			printf("texture load failed > %s\n", fileName);
+			return false;
+		}
+		userHandle = ++textureCount;
+		return true;
+	};
+	ss::SSSetPlatformBackend(backend);
+
+	ss::ResourceManager* resman = ss::ResourceManager::create();
+	std::string dataKey = resman->addData(ssbpFilepath);
+	if (dataKey == "")
+	{
+		printf("ssbp load failed > %s\n", ssbpFilepath.c_str());
+		return 1;
+	}
+
+	ss::Player* player = ss::Player::create(resman);
+	player->setData(dataKey);
+	player->play(animeName);
+
+	//1/60秒ずつ更新する
+	for (int i = 0; i < frames; i++)
+	{
+		player->update(1.0f / 60.0f);
+	}
+
+	int result = 0;
+	ss::ResluteState state;
+	if (player->getPartState(state, 0))
+	{
+		printf("%s %s: textures=%ld parts=%d frame=%d root=(%f, %f)\n", dataKey.c_str(), animeName.c_str(), textureCount, player->getPartsCount(), player->getFrameNo(), state.x, state.y);
+	}
+	else
+	{
+		printf("animation not found > %s\n", animeName.c_str());
+		result = 1;
+	}
+
+	delete player;
+	delete resman;
+	ss::SSPlatformRelese();
+	return result;
+}
@@ -4,12 +4,18 @@
 #include "SS6Player.h"
 #include "SS6PlayerData.h"
 #include "SS6PlayerTypes.h"
-#include "common/Animator/ssplayer_matrix.h"
+#include "Common/Animator/ssplayer_matrix.h"
+#include <thread>
+#include <cstddef>
+#include <list>
+#include <algorithm>
+#include <cmath>
 
 
 namespace ss
 {
 
+#ifndef SS_HEADLESS
 /**
 * SSPlayerControl
 Cocos2d-xからSSPlayerを使用するためのラッパークラス
@@ -32,8 +38,10 @@ std::map<int, int> SSPlayerControl::_SUB_uniform_map;
 SSPlayerControl::SSPlayerControl()
 {
 	_ssp = nullptr;
-	_position = cocos2d::Vec2(0,0);	//プレイヤーのポジション
 	_enableRenderingBlendFunc = false;
+	_enableTrianglesCommand = false;
+	_trianglesFrame = 0;
+	_trianglesSlotCount = 0;
 }
 SSPlayerControl::~SSPlayerControl()
 {
@@ -42,6 +50,11 @@ SSPlayerControl::~SSPlayerControl()
 		delete (_ssp);
 		_ssp = nullptr;
 	}
+	for (size_t i = 0; i < _trianglesSlots.size(); i++)
+	{
+		delete _trianglesSlots[i];
+	}
+	_trianglesSlots.clear();
 }
 
 SSPlayerControl* SSPlayerControl::create(ResourceManager* resman)
@@ -107,8 +120,65 @@ void SSPlayerControl::onDraw(cocos2d::Renderer *renderer, const cocos2d::Mat4 &t
 	_ssp->draw();
 }
 
+//パーツの頂点をTrianglesCommandでレンダラーに渡す
+//TrianglesCommandで描画できないパーツがある場合はfalseを返す
+bool SSPlayerControl::drawTrianglesCommand(cocos2d::Renderer *renderer, uint32_t flags)
+{
+	cocos2d::Mat4 mat = getNodeToWorldTransform();
+	_ssp->setParentMatrix(mat.m, true);
+
+	//前回の描画で登録したコマンドはレンダラーが描画するまで変更できないので、フレーム内の描画毎に別のスロットを使用する
+	unsigned int frame = cocos2d::Director::getInstance()->getTotalFrames();
+	if (_trianglesFrame != frame)
+	{
+		_trianglesFrame = frame;
+		_trianglesSlotCount = 0;
+	}
+	if (_trianglesSlotCount == _trianglesSlots.size())
+	{
+		_trianglesSlots.push_back(new TrianglesSlot());
+	}
+	TrianglesSlot* slot = _trianglesSlots[_trianglesSlotCount];
+
+	//頂点はワールド座標に変換済みなので、モデルビューは単位行列で登録する
+	slot->triangles.clear();
+	SSBeginTrianglesCapture(&slot->triangles);
+	_ssp->draw();
+	if (SSEndTrianglesCapture() == false)
+	{
+		return false;	//コマンドを登録していないので、スロットは次の描画で使用する
+	}
+	_trianglesSlotCount++;
+
+	SSTrianglesBuffer& buffer = slot->triangles;
+	slot->commands.resize(buffer.batches.size());
+	for (size_t i = 0; i < buffer.batches.size(); i++)
+	{
+		const SSTrianglesBatch& batch = buffer.batches[i];
+		cocos2d::TrianglesCommand::Triangles triangles;
+		triangles.verts = &buffer.vertices[batch.vertexStart];
+		triangles.vertCount = batch.vertexCount;
+		triangles.indices = &buffer.indices[batch.indexStart];
+		triangles.indexCount = batch.indexCount;
+
+		cocos2d::GLProgramState* programState = cocos2d::GLProgramState::getOrCreateWithGLProgram(batch.program);
+		slot->commands[i].init(_globalZOrder, batch.texture, programState, batch.blend, triangles, cocos2d::Mat4::IDENTITY, flags);
+		renderer->addCommand(&slot->commands[i]);
+	}
+	return true;
+}
+
 void SSPlayerControl::draw(cocos2d::Renderer *renderer, const cocos2d::Mat4 &transform, uint32_t flags)
 {
+	if ((_enableTrianglesCommand == true) && (_enableRenderingBlendFunc == false))
+	{
+		if (drawTrianglesCommand(renderer, flags))
+		{
+			return;
+		}
+		//TrianglesCommandで描画できないフレームは従来の描画を行う
+	}
+
 	if (_enableRenderingBlendFunc == false)
 	{
 		//通常描画
@@ -132,15 +202,20 @@ void SSPlayerControl::setPosition(const cocos2d::Vec2& position)
 }
 void SSPlayerControl::setPosition(float x, float y)
 {
+	//Sprite::setPositionでノードの座標が書き換わるので、変更前の座標を保存しておく
+	cocos2d::Vec2 prevPosition = getPosition();
 	Sprite::setPosition(x, y);
 
-	if ((_position.x != x) || (_position.y != y))
+	if ((prevPosition.x != x) || (prevPosition.y != y))
 	{
 		//座標が更新された場合のみ行う
-		update(0);	//プレイヤー内部の座標を更新するために経過時間0で更新を行う
+		//パーツのステータスはプレイヤーの位置に依存しないため、アニメーションの更新は行わずマトリクスのみ更新する
+		if (_ssp)
+		{
+			cocos2d::Mat4 mat = getNodeToWorldTransform();
+			_ssp->updateParentMatrix(mat.m);
+		}
 	}
-	_position.x = x;
-	_position.y = y;
 }
 
 //sprite のオーバーライドここまで
@@ -402,6 +477,7 @@ void SSPlayerControl::initCustomShaderProgram( )
 		SSPlayerControl::_partColorSUBShaderProgram = p;
 	}
 }
+#endif	// SS_HEADLESS
 
 
 
@@ -569,11 +645,154 @@ public:
 		return static_cast<ss_offset>(readS32());
 	}
 
+	//現在の読み込み位置
+	const ss_u16* getPointer() const { return _dataPtr; }
+	//指定したss_u16の個数だけ読み飛ばす
+	void skip(int num) { _dataPtr += num; }
+
 private:
 	const ss_u16*	_dataPtr;
 };
 
 
+/**
+ * NameIndex
+ * 名前から番号を引くハッシュテーブル（オープンアドレス法）
+ * 名前の文字列はコピーせずに参照するので、テーブルより長く生存する文字列を登録してください。
+ * 構築後の検索ではメモリの確保を行いません。
+ */
+class NameIndex
+{
+public:
+	NameIndex()
+		: _mask(0), _num(0)
+	{}
+
+	//FNV-1a
+	static unsigned int hash(const char* str, size_t len, unsigned int h = 2166136261u)
+	{
+		for (size_t i = 0; i < len; i++)
+		{
+			h ^= static_cast<unsigned char>(str[i]);
+			h *= 16777619u;
+		}
+		return h;
+	}
+
+	//登録数を指定してテーブルを確保する
+	void reserve(int num)
+	{
+		unsigned int size = 8;
+		while (size < static_cast<unsigned int>(num) * 2)
+		{
+			size <<= 1;
+		}
+		Entry empty = { 0, -1, NULL, 0 };
+		_table.assign(size, empty);
+		_mask = size - 1;
+		_num = 0;
+	}
+
+	//登録（同じ名前は先に登録したものが優先されます）
+	void add(const char* name, int value)
+	{
+		add(name, strlen(name), value);
+	}
+	void add(const char* name, size_t len, int value)
+	{
+		if ((_num + 1) * 2 > static_cast<int>(_table.size()))
+		{
+			//テーブルが足りない場合は作り直す
+			std::vector<Entry> old;
+			old.swap(_table);
+			reserve((_num + 1) * 2);
+			for (size_t i = 0; i < old.size(); i++)
+			{
+				if (old[i].value >= 0) insert(old[i]);
+			}
+		}
+		if (find(name, len) >= 0)
+		{
+			return;
+		}
+		Entry entry = { hash(name, len), value, name, len };
+		insert(entry);
+	}
+
+	//検索（見つからない場合は-1）
+	int find(const char* name, size_t len) const
+	{
+		return find(hash(name, len), name, len, NULL, 0);
+	}
+	int find(const char* name) const
+	{
+		return find(name, strlen(name));
+	}
+	int find(const std::string& name) const
+	{
+		return find(name.c_str(), name.size());
+	}
+
+	//"prefix/name" の形式で登録された名前を、連結した文字列を作らずに検索する
+	int find(const char* prefix, size_t prefixLen, const char* name, size_t len) const
+	{
+		unsigned int h = hash(prefix, prefixLen);
+		h = hash("/", 1, h);
+		h = hash(name, len, h);
+		return find(h, prefix, prefixLen, name, len);
+	}
+
+	int size() const { return _num; }
+
+private:
+	struct Entry
+	{
+		unsigned int	hash;
+		int				value;	//-1は空き
+		const char*		name;
+		size_t			len;
+	};
+
+	void insert(const Entry& entry)
+	{
+		unsigned int pos = entry.hash & _mask;
+		while (_table[pos].value >= 0)
+		{
+			pos = (pos + 1) & _mask;
+		}
+		_table[pos] = entry;
+		_num++;
+	}
+
+	int find(unsigned int h, const char* name, size_t len, const char* second, size_t secondLen) const
+	{
+		if (_table.empty())
+		{
+			return -1;
+		}
+		size_t total = (second == NULL) ? len : len + 1 + secondLen;
+		unsigned int pos = h & _mask;
+		while (_table[pos].value >= 0)
+		{
+			const Entry& e = _table[pos];
+			if ((e.hash == h) && (e.len == total) && (memcmp(e.name, name, len) == 0))
+			{
+				if ((second == NULL) || ((e.name[len] == '/') && (memcmp(e.name + len + 1, second, secondLen) == 0)))
+				{
+					return e.value;
+				}
+			}
+			pos = (pos + 1) & _mask;
+		}
+		return -1;
+	}
+
+	std::vector<Entry>	_table;
+	unsigned int		_mask;
+	int					_num;
+};
+
+
 /**
  * CellRef
  */
@@ -593,11 +812,13 @@ class CellCache
 {
 public:
 	CellCache()
+		: _revision(0)
 	{
 	}
 	~CellCache()
 	{
 		releseReference();
+		releseDecodedImage();
 	}
 
 	static CellCache* create(const ProjectData* data, const std::string& imageBaseDir, const std::string& zipFilepath)
@@ -605,11 +826,70 @@ public:
 		CellCache* obj = new CellCache();
 		if (obj)
 		{
-			obj->init(data, imageBaseDir, zipFilepath);
+			obj->init(data, imageBaseDir, zipFilepath, false);
+		}
+		return obj;
+	}
+
+	/**
+	* テクスチャの読み込みを後から行うキャッシュを作成する
+	* 画像のパスの解決を行うのでメインスレッドから呼び出してください。
+	* 画像ファイルの読み込みとデコードはreadDeferredTextureでメインスレッド以外から行えます。
+	* 使用する前にメインスレッドでloadDeferredTextureを呼び出してください。
+	*/
+	static CellCache* createDeferred(const ProjectData* data, const std::string& imageBaseDir, const std::string& zipFilepath)
+	{
+		CellCache* obj = new CellCache();
+		if (obj)
+		{
+			obj->init(data, imageBaseDir, zipFilepath, true);
 		}
 		return obj;
 	}
 
+	//画像ファイルを読み込んでデコードする（ワーカースレッド）
+	void readDeferredTexture(void)
+	{
+		for (int i = 0; i < (int)_texfullpath.size(); i++)
+		{
+			_decoded.at(i) = SSTextureRead(_texfullpath.at(i).c_str(), _zipFullpath.c_str());
+		}
+	}
+
+	//読み込んだ画像ファイルからテクスチャを作成し、セルの参照テクスチャを更新する
+	void loadDeferredTexture(const ProjectData* data)
+	{
+		for (int i = 0; i < (int)_decoded.size(); i++)
+		{
+			TextuerData& texdata = _textures.at(i);
+			if (_decoded.at(i) == NULL)
+			{
+				//ワーカースレッドで読み込めなかった画像はここで読み込む
+				texdata.handle = SSTextureLoad(_texname.at(i).c_str(), _texmode.at(i).first, _texmode.at(i).second, _zipFilepath.c_str());
+			}
+			else
+			{
+				texdata.handle = SSTextureLoadRead(_texname.at(i).c_str(), _decoded.at(i), _texmode.at(i).first, _texmode.at(i).second);
+				_decoded.at(i) = NULL;	//データはSSTextureLoadReadで解放される
+			}
+			int w;
+			int h;
+			SSGetTextureSize(texdata.handle, w, h);
+			texdata.size_w = w;
+			texdata.size_h = h;
+		}
+		_decoded.clear();
+
+		ToPointer ptr(data);
+		for (int i = 0; i < (int)_refs.size(); i++)
+		{
+			CellRef* ref = _refs.at(i);
+			const CellMap* cellMap = static_cast<const CellMap*>(ptr(ref->cell->cellMap));
+			ref->texture = _textures.at(cellMap->index);
+		}
+		_revision++;
+	}
+
 	CellRef* getReference(int index)
 	{
 		if (index < 0 || index >= (int)_refs.size())
@@ -643,6 +923,7 @@ public:
 				rc = true;
 			}
 		}
+		_revision++;
 
 		return(rc);
 	}
@@ -668,11 +949,15 @@ public:
 				}
 			}
 		}
+		_revision++;
 		return(rc);
 	}
 
+	//参照テクスチャを変更した回数（プレイヤーの更新判定に使用する）
+	int getRevision() const { return _revision; }
+
 protected:
-	void init(const ProjectData* data, const std::string& imageBaseDir, const std::string& zipFilepath)
+	void init(const ProjectData* data, const std::string& imageBaseDir, const std::string& zipFilepath, bool deferred)
 	{
 
 		SS_ASSERT2(data != NULL, "Invalid data");
@@ -680,6 +965,16 @@ protected:
 		_textures.clear();
 		_refs.clear();
 		_texname.clear();
+		_texmode.clear();
+		_decoded.clear();
+		_texfullpath.clear();
+		_zipFilepath = zipFilepath;
+		_zipFullpath = "";
+		if ((deferred) && (zipFilepath != ""))
+		{
+			//FileUtilsはスレッドセーフではないのでZIPファイルのパスはメインスレッドで解決しておく
+			_zipFullpath = SSGetFullPath(zipFilepath.c_str());
+		}
 
 		ToPointer ptr(data);
 		const Cell* cells = static_cast<const Cell*>(ptr(data->cells));
@@ -692,7 +987,7 @@ protected:
 			if (cellMap->index >= (int)_textures.size())
 			{
 				const char* imagePath = static_cast<const char*>(ptr(cellMap->imagePath));
-				addTexture(imagePath, imageBaseDir, (SsTexWrapMode::_enum)cellMap->wrapmode, (SsTexFilterMode::_enum)cellMap->filtermode, zipFilepath);
+				addTexture(imagePath, imageBaseDir, (SsTexWrapMode::_enum)cellMap->wrapmode, (SsTexFilterMode::_enum)cellMap->filtermode, zipFilepath, deferred);
 			}
 
 			//セル情報だけ入れておく
@@ -721,8 +1016,17 @@ protected:
 		}
 		_refs.clear();
 	}
+	//転送されなかった画像データの削除
+	void releseDecodedImage(void)
+	{
+		for (int i = 0; i < (int)_decoded.size(); i++)
+		{
+			SSTextureReadRelese(_decoded.at(i));
+		}
+		_decoded.clear();
+	}
 
-	void addTexture(const std::string& imagePath, const std::string& imageBaseDir, SsTexWrapMode::_enum  wrapmode, SsTexFilterMode::_enum filtermode, const std::string& zipFilepath)
+	void addTexture(const std::string& imagePath, const std::string& imageBaseDir, SsTexWrapMode::_enum  wrapmode, SsTexFilterMode::_enum filtermode, const std::string& zipFilepath, bool deferred)
 	{
 		std::string path = "";
 		
@@ -743,19 +1047,33 @@ protected:
 			path.append(imagePath);
 		}
 
-		//テクスチャの読み込み
-		long tex = SSTextureLoad(path.c_str(), wrapmode, filtermode, zipFilepath.c_str());
-		SSLOG("load: %s", path.c_str());
 		TextuerData texdata;
-		texdata.handle = tex;
-		int w;
-		int h;
-		SSGetTextureSize(texdata.handle, w, h);
-		texdata.size_w = w;
-		texdata.size_h = h;
+		if (deferred)
+		{
+			//画像ファイルはreadDeferredTextureで読み込み、テクスチャはloadDeferredTextureで作成する
+			//ワーカースレッドではFileUtilsを使用できないので、ここでフルパスを解決しておく
+			_texfullpath.push_back((zipFilepath != "") ? path : SSGetFullPath(path.c_str()));
+			_decoded.push_back(NULL);
+			texdata.handle = -1;
+			texdata.size_w = 0;
+			texdata.size_h = 0;
+		}
+		else
+		{
+			//テクスチャの読み込み
+			long tex = SSTextureLoad(path.c_str(), wrapmode, filtermode, zipFilepath.c_str());
+			SSLOG("load: %s", path.c_str());
+			texdata.handle = tex;
+			int w;
+			int h;
+			SSGetTextureSize(texdata.handle, w, h);
+			texdata.size_w = w;
+			texdata.size_h = h;
+		}
 
 		_textures.push_back(texdata);
 		_texname.push_back(path);
+		_texmode.push_back(std::make_pair((int)wrapmode, (int)filtermode));
 
 	}
 
@@ -763,6 +1081,12 @@ protected:
 	std::vector<std::string>			_texname;
 	std::vector<TextuerData>			_textures;
 	std::vector<CellRef*>				_refs;
+	std::vector<std::pair<int, int> >	_texmode;	//ラップモード、フィルタモード
+	std::vector<void*>					_decoded;	//転送待ちの画像データ
+	std::vector<std::string>			_texfullpath;	//ワーカースレッドで読み込む画像のフルパス（ZIPの場合はエントリ名）
+	std::string							_zipFilepath;	//画像を読み込むZIPファイル
+	std::string							_zipFullpath;	//ZIPファイルのフルパス
+	int									_revision;	//参照テクスチャの変更回数
 };
 
 
@@ -800,6 +1124,27 @@ public:
 		return ref;
 	}
 
+	/**
+	* セルの参照テクスチャを取り直す
+	* テクスチャを後から作成した場合に呼び出してください。
+	*/
+	void updateCellTexture(CellCache* cellCache)
+	{
+		std::map<std::string, SsEffectModel*>::iterator it = _dic.begin();
+		for (; it != _dic.end(); ++it)
+		{
+			SsEffectModel* effectmodel = it->second;
+			for (int nodeindex = 0; nodeindex < (int)effectmodel->nodeList.size(); nodeindex++)
+			{
+				SsEffectBehavior& behavior = effectmodel->nodeList.at(nodeindex)->behavior;
+				if (behavior.CellIndex >= 0)
+				{
+					behavior.refCell.texture = cellCache->getReference(behavior.CellIndex)->texture;
+				}
+			}
+		}
+	}
+
 	void dump()
 	{
 		std::map<std::string, SsEffectModel*>::iterator it = _dic.begin();
@@ -1247,317 +1592,1673 @@ protected:
 
 
 /**
- * AnimeRef
+ * PartFrameData
+ * フレームデータからデコードしたパーツ1つ分のアトリビュート
+ * 値はデータのまま（座標系の反転等は行わない）で保持する
  */
-struct AnimeRef
-{
-	std::string				packName;
-	std::string				animeName;
-	const AnimationData*	animationData;
-	const AnimePackData*	animePackData;
+struct PartFrameData
+{
+	int		partIndex;
+	int		flags;
+	int		flags2;
+	int		cellIndex;
+	float	x;
+	float	y;
+	float	z;
+	float	pivotX;
+	float	pivotY;
+	float	rotationX;
+	float	rotationY;
+	float	rotationZ;
+	float	scaleX;
+	float	scaleY;
+	float	localscaleX;
+	float	localscaleY;
+	int		opacity;
+	int		localopacity;
+	float	size_X;
+	float	size_Y;
+	float	uv_move_X;
+	float	uv_move_Y;
+	float	uv_rotation;
+	float	uv_scale_X;
+	float	uv_scale_Y;
+	float	boundingRadius;
+	float	masklimen;
+	float	priority;
+	//インスタンスアトリビュート
+	int		instanceValue_curKeyframe;
+	int		instanceValue_startFrame;
+	int		instanceValue_endFrame;
+	int		instanceValue_loopNum;
+	float	instanceValue_speed;
+	int		instanceValue_loopflag;
+	//エフェクトアトリビュート
+	int		effectValue_curKeyframe;
+	int		effectValue_startTime;
+	float	effectValue_speed;
+	int		effectValue_loopflag;
+	//頂点変形（PART_FLAG_VERTEX_TRANSFORM）
+	int		vertexFlags;
+	float	vertexOffset[8];		//LT,RT,LB,RBの順にx,y
+	//パーツカラー（PART_FLAG_PARTS_COLOR）
+	int		partsColorTypeAndFlags;
+	float	partsColorRate[4];		//LT,RT,LB,RBの順、単色の場合は[0]
+	SSColor4B partsColor[4];
+	//メッシュ（PART_FLAG_MESHDATA）
+	const ss_u16*	meshData;		//頂点座標（x,y,z）の先頭
 };
 
-
 /**
- * AnimeCache
+ * PartFrameDecoder
+ * フレームデータからパーツ1つ分のアトリビュートをデコードする
+ * flagsの値毎に存在するアトリビュートの読み込み位置を求めたデコードプランを使用し、
+ * 連続する32bitのアトリビュートはまとめてコピーする
+ * ssbpのフォーマット（DATA_VERSION 11）はそのまま使用する
+ *
+ * プランはAnimeCacheの作成時（preparePlans）に全フレームから作成しておき、デコード中は参照のみ行う
+ * 作成後のデコーダは変更されないので、decodeは複数のスレッド、複数のプレイヤーから同時に呼び出せる
  */
-class AnimeCache
+class PartFrameDecoder
 {
 public:
-	AnimeCache()
-	{
-	}
-	~AnimeCache()
-	{
-		releseReference();
-	}
-	static AnimeCache* create(const ProjectData* data)
+	PartFrameDecoder() {}
+
+	//パーツ毎の初期値とメッシュの頂点数を設定する
+	void init(const AnimationInitialData* initialDataList, int numParts, const std::vector<int>& meshVertexSize)
 	{
-		AnimeCache* obj = new AnimeCache();
-		if (obj)
+		_meshVertexSize = meshVertexSize;
+		_plans.clear();
+		_partPlans.assign(numParts, std::vector<const DecodePlan*>());
+		_defaults.resize(numParts);
+		for (int partIndex = 0; partIndex < numParts; partIndex++)
 		{
-			obj->init(data);
+			const AnimationInitialData* init = &initialDataList[partIndex];
+			PartFrameData& d = _defaults[partIndex];
+			memset(&d, 0, sizeof(d));
+			d.partIndex = partIndex;
+			d.cellIndex = init->cellIndex;
+			d.x = init->positionX;
+			d.y = init->positionY;
+			d.z = init->positionZ;
+			d.pivotX = init->pivotX;
+			d.pivotY = init->pivotY;
+			d.rotationX = init->rotationX;
+			d.rotationY = init->rotationY;
+			d.rotationZ = init->rotationZ;
+			d.scaleX = init->scaleX;
+			d.scaleY = init->scaleY;
+			d.localscaleX = init->localscaleX;
+			d.localscaleY = init->localscaleY;
+			d.opacity = init->opacity;
+			d.localopacity = init->localopacity;
+			d.size_X = init->size_X;
+			d.size_Y = init->size_Y;
+			d.uv_move_X = init->uv_move_X;
+			d.uv_move_Y = init->uv_move_Y;
+			d.uv_rotation = init->uv_rotation;
+			d.uv_scale_X = init->uv_scale_X;
+			d.uv_scale_Y = init->uv_scale_Y;
+			d.boundingRadius = init->boundingRadius;
+			d.masklimen = init->masklimen;
+			d.priority = init->priority;
+			d.instanceValue_curKeyframe = init->instanceValue_curKeyframe;
+			d.instanceValue_startFrame = init->instanceValue_startFrame;
+			d.instanceValue_endFrame = init->instanceValue_endFrame;
+			d.instanceValue_loopNum = init->instanceValue_loopNum;
+			d.instanceValue_speed = init->instanceValue_speed;
+			d.instanceValue_loopflag = init->instanceValue_loopflag;
+			d.effectValue_curKeyframe = init->effectValue_curKeyframe;
+			d.effectValue_startTime = init->effectValue_startTime;
+			d.effectValue_speed = init->effectValue_speed;
+			d.effectValue_loopflag = init->effectValue_loopflag;
 		}
-		return obj;
 	}
 
 	/**
-	 * packNameとanimeNameを指定してAnimeRefを得る
+	 * 1フレーム分のデータに含まれるflagsの値のデコードプランを作成する
+	 * initの後に全フレームに対して呼び出すこと（AnimeCacheの作成時に行う）
 	 */
-	AnimeRef* getReference(const std::string& packName, const std::string& animeName)
+	void preparePlans(DataArrayReader& reader, int numParts)
 	{
-		std::string key = toPackAnimeKey(packName, animeName);
-		AnimeRef* ref = _dic.at(key);
-		return ref;
+		PartFrameData work;
+		for (int index = 0; index < numParts; index++)
+		{
+			//パーツ番号とflagsを先読みする
+			DataArrayReader header(reader.getPointer());
+			int partIndex = header.readS16();
+			int flags = header.readU32();
+			if (findPlan(partIndex, flags) == NULL)
+			{
+				std::map<int, DecodePlan>::iterator it = _plans.find(flags);
+				if (it == _plans.end())
+				{
+					it = _plans.insert(std::map<int, DecodePlan>::value_type(flags, createPlan(flags))).first;
+				}
+				_partPlans[partIndex].push_back(&it->second);
+			}
+
+			//可変長のデータを読み飛ばすため、作成したプランで1パーツ分をデコードする
+			decode(reader, work);
+		}
 	}
 
 	/**
-	 * animeNameのみ指定してAnimeRefを得る
+	 * readerの位置からパーツ1つ分をデコードしてoutに設定する
+	 * 存在しないアトリビュートは初期値を設定する
+	 * デコーダの状態は変更しないので、複数のスレッドから同時に呼び出せる
 	 */
-	AnimeRef* getReference(const std::string& animeName)
-	{
-		AnimeRef* ref = _dic.at(animeName);
-		return ref;
-	}
-	
-	void dump()
+	void decode(DataArrayReader& reader, PartFrameData& out) const
 	{
-		std::map<std::string, AnimeRef*>::iterator it = _dic.begin();
-		while (it != _dic.end())
+		int partIndex = reader.readS16();
+		int flags = reader.readU32();
+		int flags2 = reader.readU32();
+
+		//初期値をコピーしてから、データに存在するアトリビュートを上書きする
+		out = _defaults[partIndex];
+		out.flags = flags;
+		out.flags2 = flags2;
+
+		const DecodePlan* plan = findPlan(partIndex, flags);
+		SS_ASSERT2(plan != NULL, "Decode plan is not prepared");
+		const ss_u16* src = reader.getPointer();
+		char* dst = reinterpret_cast<char*>(&out);
+		for (size_t i = 0; i < plan->ops.size(); i++)
 		{
-			SSLOG("%s", (*it).second);
-			++it;
+			const DecodeOp& op = plan->ops[i];
+			switch (op.kind)
+			{
+			case DECODE_32:
+				copy32(dst + op.dst, &src[op.src], op.count);
+				break;
+			case DECODE_S16_INT:
+				*reinterpret_cast<int*>(dst + op.dst) = static_cast<ss_s16>(src[op.src]);
+				break;
+			case DECODE_U16_INT:
+				*reinterpret_cast<int*>(dst + op.dst) = src[op.src];
+				break;
+			case DECODE_U16_FLOAT:
+				*reinterpret_cast<float*>(dst + op.dst) = src[op.src];
+				break;
+			}
 		}
-	}
-
-protected:
-	void init(const ProjectData* data)
-	{
-		SS_ASSERT2(data != NULL, "Invalid data");
-		
-		ToPointer ptr(data);
-		const AnimePackData* animePacks = static_cast<const AnimePackData*>(ptr(data->animePacks));
+		reader.skip(plan->size);
 
-		for (int packIndex = 0; packIndex < data->numAnimePacks; packIndex++)
+		// 頂点変形のオフセット値
+		if (flags & PART_FLAG_VERTEX_TRANSFORM)
 		{
-			const AnimePackData* pack = &animePacks[packIndex];
-			const AnimationData* animations = static_cast<const AnimationData*>(ptr(pack->animations));
-			const char* packName = static_cast<const char*>(ptr(pack->name));
-			
-			for (int animeIndex = 0; animeIndex < pack->numAnimations; animeIndex++)
+			int vt_flags = reader.readU16();
+			out.vertexFlags = vt_flags;
+			for (int i = 0; i < 4; i++)
 			{
-				const AnimationData* anime = &animations[animeIndex];
-				const char* animeName = static_cast<const char*>(ptr(anime->name));
-				
-				AnimeRef* ref = new AnimeRef();
-				ref->packName = packName;
-				ref->animeName = animeName;
-				ref->animationData = anime;
-				ref->animePackData = pack;
+				//VERTEX_FLAG_LT,RT,LB,RBの順に格納されている
+				if (vt_flags & (1 << i))
+				{
+					out.vertexOffset[i * 2 + 0] = reader.readFloat();
+					out.vertexOffset[i * 2 + 1] = reader.readFloat();
+				}
+			}
+		}
 
-				// packName + animeNameでの登録
-				std::string key = toPackAnimeKey(packName, animeName);
-				SSLOG("anime key: %s", key.c_str());
-				_dic.insert(std::map<std::string, AnimeRef*>::value_type(key, ref));
+		// パーツカラー
+		if (flags & PART_FLAG_PARTS_COLOR)
+		{
+			int typeAndFlags = reader.readU16();
+			int cb_flags = (typeAndFlags >> 8) & 0xff;
+			out.partsColorTypeAndFlags = typeAndFlags;
 
-				// animeNameのみでの登録
-//				_dic.insert(std::map<std::string, AnimeRef*>::value_type(animeName, ref));
-				
+			if (cb_flags & VERTEX_FLAG_ONE)
+			{
+				out.partsColorRate[0] = reader.readFloat();
+				reader.readColor(out.partsColor[0]);
+			}
+			else
+			{
+				for (int i = 0; i < 4; i++)
+				{
+					if (cb_flags & (1 << i))
+					{
+						out.partsColorRate[i] = reader.readFloat();
+						reader.readColor(out.partsColor[i]);
+					}
+				}
 			}
 		}
-	}
 
-	static std::string toPackAnimeKey(const std::string& packName, const std::string& animeName)
-	{
-		return Format("%s/%s", packName.c_str(), animeName.c_str());
+		//メッシュ情報
+		if (flags2 & PART_FLAG_MESHDATA)
+		{
+			out.meshData = reader.getPointer();
+			reader.skip(_meshVertexSize[partIndex] * 3 * 2);	//x,y,zのfloat
+		}
 	}
 
-	//キャッシュの削除
-	void releseReference(void)
+	/**
+	 * readerの位置からパーツ1つ分のモーションブレンドで使用するアトリビュート（BLEND_FLAGS）のみをデコードする
+	 * outにはpartIndex、flags、flags2とBLEND_FLAGSのアトリビュートのみを設定し、それ以外は変更しない
+	 * 頂点変形、パーツカラー、メッシュのデータは読み飛ばす
+	 */
+	void decodeBlend(DataArrayReader& reader, PartFrameData& out) const
 	{
-		std::map<std::string, AnimeRef*>::iterator it = _dic.begin();
-		while (it != _dic.end())
+		int partIndex = reader.readS16();
+		int flags = reader.readU32();
+		int flags2 = reader.readU32();
+
+		const PartFrameData& d = _defaults[partIndex];
+		out.partIndex = partIndex;
+		out.flags = flags;
+		out.flags2 = flags2;
+		out.x = d.x;
+		out.y = d.y;
+		out.rotationX = d.rotationX;
+		out.rotationY = d.rotationY;
+		out.rotationZ = d.rotationZ;
+		out.scaleX = d.scaleX;
+		out.scaleY = d.scaleY;
+
+		const DecodePlan* plan = findPlan(partIndex, flags);
+		SS_ASSERT2(plan != NULL, "Decode plan is not prepared");
+		const ss_u16* src = reader.getPointer();
+		char* dst = reinterpret_cast<char*>(&out);
+		for (size_t i = 0; i < plan->blendOps.size(); i++)
 		{
-			AnimeRef* ref = it->second;
-			if (ref)
-			{
-				delete ref;
-				it->second = 0;
-			}
-			it++;
+			const DecodeOp& op = plan->blendOps[i];
+			copy32(dst + op.dst, &src[op.src], op.count);	//BLEND_FLAGSのアトリビュートは全てfloat
 		}
-		_dic.clear();
-	}
+		reader.skip(plan->size);
 
-protected:
-
-public:
-	std::map<std::string, AnimeRef*>	_dic;
-};
+		// 頂点変形のオフセット値
+		if (flags & PART_FLAG_VERTEX_TRANSFORM)
+		{
+			int vt_flags = reader.readU16();
+			reader.skip(countBits(vt_flags & 0xf) * 4);		//x,yのfloat
+		}
 
+		// パーツカラー
+		if (flags & PART_FLAG_PARTS_COLOR)
+		{
+			int typeAndFlags = reader.readU16();
+			int cb_flags = (typeAndFlags >> 8) & 0xff;
+			int num = (cb_flags & VERTEX_FLAG_ONE) ? 1 : countBits(cb_flags & 0xf);
+			reader.skip(num * 4);							//レートのfloat、カラーのu32
+		}
 
+		//メッシュ情報
+		if (flags2 & PART_FLAG_MESHDATA)
+		{
+			reader.skip(_meshVertexSize[partIndex] * 3 * 2);	//x,y,zのfloat
+		}
+	}
 
+	//モーションブレンドで補間するアトリビュート
+	enum
+	{
+		BLEND_FLAGS = PART_FLAG_POSITION_X | PART_FLAG_POSITION_Y
+					| PART_FLAG_ROTATIONX | PART_FLAG_ROTATIONY | PART_FLAG_ROTATIONZ
+					| PART_FLAG_SCALE_X | PART_FLAG_SCALE_Y
+	};
 
+private:
+	enum
+	{
+		DECODE_32,			//float、int（32bit）
+		DECODE_S16_INT,		//ss_s16をintへ
+		DECODE_U16_INT,		//ss_u16をintへ
+		DECODE_U16_FLOAT	//ss_u16をfloatへ
+	};
+
+	//デコードの手順 1つ分
+	struct DecodeOp
+	{
+		int		kind;
+		int		src;		//読み込み位置（ss_u16単位）
+		int		dst;		//PartFrameData内の書き込み位置（バイト）
+		int		count;		//DECODE_32の場合、まとめてコピーする個数
+	};
+
+	//flagsの値に対応するデコードプラン
+	struct DecodePlan
+	{
+		int						flags;
+		int						size;		//読み込むデータのサイズ（ss_u16単位）
+		std::vector<DecodeOp>	ops;
+		std::vector<DecodeOp>	blendOps;	//BLEND_FLAGSのアトリビュートのみの手順
+	};
+
+	//アトリビュートの格納順
+	struct DecodeField
+	{
+		int		flag;
+		int		kind;
+		int		dst;
+	};
 
-/**
- * ResourceSet
- */
-struct ResourceSet
-{
-	const ProjectData* data;
-	bool isDataAutoRelease;
-	EffectCache* effectCache;
-	CellCache* cellCache;
-	AnimeCache* animeCache;
+	static DecodePlan createPlan(int flags)
+	{
+		DecodePlan plan;
+		plan.flags = flags;
+		plan.size = createOps(flags, ~0, plan.ops);
+		createOps(flags, BLEND_FLAGS, plan.blendOps);
+		return plan;
+	}
 
-	virtual ~ResourceSet()
+	//flagsのデータをデコードする手順を作成し、読み込むデータのサイズを返す
+	//usedFlagsに含まれないアトリビュートは読み飛ばす
+	static int createOps(int flags, int usedFlags, std::vector<DecodeOp>& ops)
 	{
-		if (isDataAutoRelease)
+		static const DecodeField fields[] = {
+			{ PART_FLAG_CELL_INDEX,			DECODE_S16_INT,		offsetof(PartFrameData, cellIndex) },
+			{ PART_FLAG_POSITION_X,			DECODE_32,			offsetof(PartFrameData, x) },
+			{ PART_FLAG_POSITION_Y,			DECODE_32,			offsetof(PartFrameData, y) },
+			{ PART_FLAG_POSITION_Z,			DECODE_32,			offsetof(PartFrameData, z) },
+			{ PART_FLAG_PIVOT_X,			DECODE_32,			offsetof(PartFrameData, pivotX) },
+			{ PART_FLAG_PIVOT_Y,			DECODE_32,			offsetof(PartFrameData, pivotY) },
+			{ PART_FLAG_ROTATIONX,			DECODE_32,			offsetof(PartFrameData, rotationX) },
+			{ PART_FLAG_ROTATIONY,			DECODE_32,			offsetof(PartFrameData, rotationY) },
+			{ PART_FLAG_ROTATIONZ,			DECODE_32,			offsetof(PartFrameData, rotationZ) },
+			{ PART_FLAG_SCALE_X,			DECODE_32,			offsetof(PartFrameData, scaleX) },
+			{ PART_FLAG_SCALE_Y,			DECODE_32,			offsetof(PartFrameData, scaleY) },
+			{ PART_FLAG_LOCALSCALE_X,		DECODE_32,			offsetof(PartFrameData, localscaleX) },
+			{ PART_FLAG_LOCALSCALE_Y,		DECODE_32,			offsetof(PartFrameData, localscaleY) },
+			{ PART_FLAG_OPACITY,			DECODE_U16_INT,		offsetof(PartFrameData, opacity) },
+			{ PART_FLAG_LOCALOPACITY,		DECODE_U16_INT,		offsetof(PartFrameData, localopacity) },
+			{ PART_FLAG_SIZE_X,				DECODE_32,			offsetof(PartFrameData, size_X) },
+			{ PART_FLAG_SIZE_Y,				DECODE_32,			offsetof(PartFrameData, size_Y) },
+			{ PART_FLAG_U_MOVE,				DECODE_32,			offsetof(PartFrameData, uv_move_X) },
+			{ PART_FLAG_V_MOVE,				DECODE_32,			offsetof(PartFrameData, uv_move_Y) },
+			{ PART_FLAG_UV_ROTATION,		DECODE_32,			offsetof(PartFrameData, uv_rotation) },
+			{ PART_FLAG_U_SCALE,			DECODE_32,			offsetof(PartFrameData, uv_scale_X) },
+			{ PART_FLAG_V_SCALE,			DECODE_32,			offsetof(PartFrameData, uv_scale_Y) },
+			{ PART_FLAG_BOUNDINGRADIUS,		DECODE_32,			offsetof(PartFrameData, boundingRadius) },
+			{ PART_FLAG_MASK,				DECODE_U16_FLOAT,	offsetof(PartFrameData, masklimen) },
+			{ PART_FLAG_PRIORITY,			DECODE_U16_FLOAT,	offsetof(PartFrameData, priority) },
+			{ PART_FLAG_INSTANCE_KEYFRAME,	DECODE_32,			offsetof(PartFrameData, instanceValue_curKeyframe) },
+			{ PART_FLAG_INSTANCE_KEYFRAME,	DECODE_32,			offsetof(PartFrameData, instanceValue_startFrame) },
+			{ PART_FLAG_INSTANCE_KEYFRAME,	DECODE_32,			offsetof(PartFrameData, instanceValue_endFrame) },
+			{ PART_FLAG_INSTANCE_KEYFRAME,	DECODE_32,			offsetof(PartFrameData, instanceValue_loopNum) },
+			{ PART_FLAG_INSTANCE_KEYFRAME,	DECODE_32,			offsetof(PartFrameData, instanceValue_speed) },
+			{ PART_FLAG_INSTANCE_KEYFRAME,	DECODE_32,			offsetof(PartFrameData, instanceValue_loopflag) },
+			{ PART_FLAG_EFFECT_KEYFRAME,	DECODE_32,			offsetof(PartFrameData, effectValue_curKeyframe) },
+			{ PART_FLAG_EFFECT_KEYFRAME,	DECODE_32,			offsetof(PartFrameData, effectValue_startTime) },
+			{ PART_FLAG_EFFECT_KEYFRAME,	DECODE_32,			offsetof(PartFrameData, effectValue_speed) },
+			{ PART_FLAG_EFFECT_KEYFRAME,	DECODE_32,			offsetof(PartFrameData, effectValue_loopflag) },
+		};
+
+		int size = 0;
+		for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
 		{
-			delete data;
-			data = NULL;
+			const DecodeField& field = fields[i];
+			if ((flags & field.flag) == 0)
+			{
+				continue;
+			}
+			int fieldSize = (field.kind == DECODE_32) ? 2 : 1;
+			if ((usedFlags & field.flag) == 0)
+			{
+				size += fieldSize;
+				continue;
+			}
+
+			if (field.kind == DECODE_32)
+			{
+				//直前のコピーと読み込み位置、書き込み位置が連続している場合はまとめる
+				if (!ops.empty())
+				{
+					DecodeOp& last = ops.back();
+					if ((last.kind == DECODE_32)
+					 && (last.src + last.count * 2 == size)
+					 && (last.dst + last.count * 4 == field.dst))
+					{
+						last.count++;
+						size += fieldSize;
+						continue;
+					}
+				}
+			}
+			DecodeOp op = { field.kind, size, field.dst, 1 };
+			ops.push_back(op);
+			size += fieldSize;
 		}
-		if (animeCache)
+		return size;
+	}
+
+	static int countBits(int value)
+	{
+		int count = 0;
+		for (; value; value &= value - 1)
 		{
-			delete animeCache;
-			animeCache = NULL;
+			count++;
 		}
-		if (cellCache)
+		return count;
+	}
+
+	//パーツが使用するプランからflagsの値が一致するものを探す
+	//パーツ毎のflagsの種類は少ないので線形に探す
+	const DecodePlan* findPlan(int partIndex, int flags) const
+	{
+		const std::vector<const DecodePlan*>& plans = _partPlans[partIndex];
+		for (size_t i = 0; i < plans.size(); i++)
 		{
-			delete cellCache;
-			cellCache = NULL;
+			if (plans[i]->flags == flags)
+			{
+				return plans[i];
+			}
 		}
-		if (effectCache)
+		return NULL;
+	}
+
+	//32bitの値をcount個コピーする
+	//データは16bit境界に下位、上位の順で格納されている
+	static void copy32(char* dst, const ss_u16* src, int count)
+	{
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+		ss_u32* dst32 = reinterpret_cast<ss_u32*>(dst);
+		for (int i = 0; i < count; i++)
 		{
-			delete effectCache;
-			effectCache = NULL;
+			dst32[i] = (static_cast<ss_u32>(src[i * 2 + 1]) << 16) | src[i * 2];
 		}
+#else
+		//リトルエンディアンではそのままの並びになるため、まとめてコピーする
+		//（アラインされていないロード、SIMDのコピーに展開される）
+		memcpy(dst, src, count * 4);
+#endif
 	}
+
+	std::vector<PartFrameData>						_defaults;		//パーツ毎の初期値
+	std::vector<int>								_meshVertexSize;//パーツ毎のメッシュの頂点数（メッシュパーツ以外は0）
+	std::map<int, DecodePlan>						_plans;			//flagsの値毎のデコードプラン
+	std::vector<std::vector<const DecodePlan*> >	_partPlans;		//パーツ毎に使用するプラン（_plansの要素を指す）
 };
 
 
 /**
- * ResourceManager
+ * PartHierarchy
+ * パーツを親子関係の深さ順に並べたテーブル（パック単位）
+ * 同じ深さのパーツは互いに依存しないため、まとめてマトリクスを計算できる
+ * プレイヤーはパーツのマトリクスを4パーツ毎のブロックに分けたSoAで保持する
+ * ブロックには同じ深さのパーツのみを割り当てる（深さの変わり目は空きのレーンで埋める）
  */
+struct PartHierarchy
+{
+	enum { LANE = TRSMatrixBatch::LANE };
 
-static ResourceManager* defaultInstance = NULL;
-const std::string ResourceManager::s_null;
+	std::vector<int>	order;		//深さ順のパーツ番号（同じ深さはパーツ番号順）
+	std::vector<int>	levelStart;	//深さ毎のorderの開始位置（末尾にorderのサイズを格納）
+	std::vector<int>	slot;		//パーツ番号からマトリクスのスロット番号（ブロック番号 * LANE + レーン）
+	std::vector<int>	slotPart;	//スロット番号からパーツ番号（-1は空きのレーン）
 
-ResourceManager* ResourceManager::getInstance()
-{
-	if (!defaultInstance)
+	void init(const PartData* parts, int numParts)
 	{
-		defaultInstance = ResourceManager::create();
+		std::vector<int> depth(numParts, 0);
+		int maxDepth = 0;
+		for (int partIndex = 1; partIndex < numParts; partIndex++)
+		{
+			//親をたどって深さを求める
+			int d = 0;
+			int index = partIndex;
+			while ((index > 0) && (d < numParts))
+			{
+				index = parts[index].parentIndex;
+				d++;
+			}
+			depth[partIndex] = d;
+			if (d > maxDepth) maxDepth = d;
+		}
+
+		order.clear();
+		order.reserve(numParts);
+		levelStart.clear();
+		for (int d = 0; d <= maxDepth; d++)
+		{
+			levelStart.push_back((int)order.size());
+			for (int partIndex = 0; partIndex < numParts; partIndex++)
+			{
+				if (depth[partIndex] == d)
+				{
+					order.push_back(partIndex);
+				}
+			}
+		}
+		levelStart.push_back((int)order.size());
+
+		//深さ毎にブロックの先頭から割り当てる
+		slot.assign(numParts, -1);
+		slotPart.clear();
+		for (int level = 0; level < getLevelNum(); level++)
+		{
+			for (int i = levelStart[level]; i < levelStart[level + 1]; i++)
+			{
+				slot[order[i]] = (int)slotPart.size();
+				slotPart.push_back(order[i]);
+			}
+			while (slotPart.size() % LANE)
+			{
+				slotPart.push_back(-1);
+			}
+		}
 	}
-	return defaultInstance;
-}
 
-ResourceManager::ResourceManager(void)
+	int getLevelNum() const { return (int)levelStart.size() - 1; }
+	int getBlockNum() const { return (int)slotPart.size() / LANE; }
+};
+
+//パーツのマトリクスのSoAでの位置
+//ブロック毎に継承マトリクス、ローカルマトリクスの順で、それぞれ[要素][レーン]の順に並べる
+enum
 {
-}
+	PART_MATRIX_LANE = TRSMatrixBatch::LANE,
+	PART_MATRIX_LOCAL = 16 * PART_MATRIX_LANE,				//ブロック内のローカルマトリクスの位置
+	PART_MATRIX_BLOCK_SIZE = 16 * PART_MATRIX_LANE * 2,		//ブロック1つ分のfloatの数
+};
 
-ResourceManager::~ResourceManager()
+//SoAからパーツのマトリクスを取り出す（mat、localmatはNULLの場合は取得しない）
+static void getPartMatrix(const std::vector<float>& soa, const PartHierarchy* hierarchy, int partIndex, float* mat, float* localmat)
 {
-	removeAllData();
+	int slot = hierarchy->slot[partIndex];
+	const float* block = &soa[(slot / PART_MATRIX_LANE) * PART_MATRIX_BLOCK_SIZE];
+	int lane = slot % PART_MATRIX_LANE;
+	for (int e = 0; e < 16; e++)
+	{
+		if (mat) mat[e] = block[e * PART_MATRIX_LANE + lane];
+		if (localmat) localmat[e] = block[PART_MATRIX_LOCAL + e * PART_MATRIX_LANE + lane];
+	}
 }
 
-ResourceManager* ResourceManager::create()
+//SoAへパーツのマトリクスを設定する
+static void setPartMatrix(std::vector<float>& soa, const PartHierarchy* hierarchy, int partIndex, const float* mat, const float* localmat)
 {
-	ResourceManager* obj = new ResourceManager();
-	return obj;
+	int slot = hierarchy->slot[partIndex];
+	float* block = &soa[(slot / PART_MATRIX_LANE) * PART_MATRIX_BLOCK_SIZE];
+	int lane = slot % PART_MATRIX_LANE;
+	for (int e = 0; e < 16; e++)
+	{
+		block[e * PART_MATRIX_LANE + lane] = mat[e];
+		block[PART_MATRIX_LOCAL + e * PART_MATRIX_LANE + lane] = localmat[e];
+	}
 }
 
-ResourceSet* ResourceManager::getData(const std::string& dataKey)
+
+class AnimeBakeData;
+
+/**
+ * AnimeRef
+ */
+struct AnimeRef
 {
-	ResourceSet* rs = _dataDic.at(dataKey);
-	return rs;
-}
+	std::string				packName;
+	std::string				animeName;
+	std::string				key;			//packName/animeName
+	AnimeHandle				handle;			//AnimeCache内の番号
+	const AnimationData*	animationData;
+	const AnimePackData*	animePackData;
+	const NameIndex*		partNameIndex;	//パーツ名からパーツ番号を引くテーブル（パック単位）
+	const PartHierarchy*	partHierarchy;	//親子関係の深さ順のテーブル（パック単位）
+	std::vector<LabelData>	labels;			//ラベル一覧（フレーム順）
+	NameIndex				labelIndex;		//ラベル名からlabelsの番号を引くテーブル
+	PartFrameDecoder		decoder;		//フレームデータのデコーダ
+	AnimeBakeData*			bake;			//デコード済みのフレームテーブル（ベイクしていない場合はNULL）
+	bool					hasInstancePart;//インスタンスパーツを含むか
+};
 
-std::vector<std::string> ResourceManager::getAnimeName(const std::string& dataKey)
+
+/**
+ * AnimeBakeData
+ * アニメーションの全フレームをデコードしたテーブル
+ * アトリビュート毎に[フレーム][パーツ]の順で並べた配列で保持し、再生時のデコードを省略する
+ * メモリと引き換えにCPU負荷を下げるため、多くのプレイヤーで再生するアニメーションに使用する
+ */
+class AnimeBakeData
 {
-	std::vector<std::string> animename;
-	ResourceSet* rs = _dataDic.at(dataKey);
-	//アニメーション名を取得してリストを返す
-	std::map<std::string, ss::AnimeRef*>::iterator itpairstri = rs->animeCache->_dic.begin();
-	while (1)
+public:
+	static AnimeBakeData* create(const ProjectData* data, const AnimeRef* animeRef)
 	{
-		// イテレータは pair<const string, int> 型なので、
-		std::string strKey = itpairstri->first;     // イテレータからキーが得られる。
+		AnimeBakeData* obj = new AnimeBakeData();
+		if (obj)
+		{
+			obj->init(data, animeRef);
+		}
+		return obj;
+	}
 
-		if (strKey.find("/") == std::string::npos)	//ssae名が含まれていない場合はスキップ
+	//ベイクしたフレームか
+	bool hasFrame(int frameNo) const
+	{
+		return (frameNo >= 0) && (frameNo < _numFrames);
+	}
+
+	//フレームとパーツ（フレームデータ内の順番）を指定してアトリビュートを取得する
+	void get(int frameNo, int index, PartFrameData& out) const
+	{
+		int i = frameNo * _numParts + index;
+
+		out.partIndex = _partIndex[i];
+		out.flags = _int[BAKE_FLAGS][i];
+		out.flags2 = _int[BAKE_FLAGS2][i];
+		out.cellIndex = _int[BAKE_CELL_INDEX][i];
+		out.x = _float[BAKE_X][i];
+		out.y = _float[BAKE_Y][i];
+		out.z = _float[BAKE_Z][i];
+		out.pivotX = _float[BAKE_PIVOT_X][i];
+		out.pivotY = _float[BAKE_PIVOT_Y][i];
+		out.rotationX = _float[BAKE_ROTATION_X][i];
+		out.rotationY = _float[BAKE_ROTATION_Y][i];
+		out.rotationZ = _float[BAKE_ROTATION_Z][i];
+		out.scaleX = _float[BAKE_SCALE_X][i];
+		out.scaleY = _float[BAKE_SCALE_Y][i];
+		out.localscaleX = _float[BAKE_LOCALSCALE_X][i];
+		out.localscaleY = _float[BAKE_LOCALSCALE_Y][i];
+		out.opacity = _int[BAKE_OPACITY][i];
+		out.localopacity = _int[BAKE_LOCALOPACITY][i];
+		out.size_X = _float[BAKE_SIZE_X][i];
+		out.size_Y = _float[BAKE_SIZE_Y][i];
+		out.uv_move_X = _float[BAKE_UV_MOVE_X][i];
+		out.uv_move_Y = _float[BAKE_UV_MOVE_Y][i];
+		out.uv_rotation = _float[BAKE_UV_ROTATION][i];
+		out.uv_scale_X = _float[BAKE_UV_SCALE_X][i];
+		out.uv_scale_Y = _float[BAKE_UV_SCALE_Y][i];
+		out.boundingRadius = _float[BAKE_BOUNDINGRADIUS][i];
+		out.masklimen = _float[BAKE_MASKLIMEN][i];
+		out.priority = _float[BAKE_PRIORITY][i];
+		out.instanceValue_curKeyframe = _int[BAKE_INSTANCE_CURKEYFRAME][i];
+		out.instanceValue_startFrame = _int[BAKE_INSTANCE_STARTFRAME][i];
+		out.instanceValue_endFrame = _int[BAKE_INSTANCE_ENDFRAME][i];
+		out.instanceValue_loopNum = _int[BAKE_INSTANCE_LOOPNUM][i];
+		out.instanceValue_speed = _float[BAKE_INSTANCE_SPEED][i];
+		out.instanceValue_loopflag = _int[BAKE_INSTANCE_LOOPFLAG][i];
+		out.effectValue_curKeyframe = _int[BAKE_EFFECT_CURKEYFRAME][i];
+		out.effectValue_startTime = _int[BAKE_EFFECT_STARTTIME][i];
+		out.effectValue_speed = _float[BAKE_EFFECT_SPEED][i];
+		out.effectValue_loopflag = _int[BAKE_EFFECT_LOOPFLAG][i];
+
+		//頂点変形、パーツカラーはフラグがある場合のみ参照する
+		out.vertexFlags = 0;
+		if (out.flags & PART_FLAG_VERTEX_TRANSFORM)
 		{
-			continue;
+			out.vertexFlags = _int[BAKE_VERTEX_FLAGS][i];
+			for (int v = 0; v < 8; v++)
+			{
+				out.vertexOffset[v] = _float[BAKE_VERTEX_OFFSET + v][i];
+			}
 		}
-		animename.push_back(strKey);
-		itpairstri++;
-		if (itpairstri == rs->animeCache->_dic.end())
+		out.partsColorTypeAndFlags = 0;
+		if (out.flags & PART_FLAG_PARTS_COLOR)
 		{
-			break;
+			out.partsColorTypeAndFlags = _int[BAKE_PARTS_COLOR_TYPE][i];
+			for (int v = 0; v < 4; v++)
+			{
+				out.partsColorRate[v] = _float[BAKE_PARTS_COLOR_RATE + v][i];
+				out.partsColor[v] = _color[v][i];
+			}
 		}
+		out.meshData = _meshData[i];
 	}
-	return animename;
-}
 
-std::string ResourceManager::addData(const std::string& dataKey, const ProjectData* data, const std::string& imageBaseDir, const std::string& zipFilepath, bool imageZipLoad)
-{
-	SS_ASSERT2(data != NULL, "Invalid data");
-	SS_ASSERT2(data->dataId == DATA_ID, "Not data id matched");
-	SS_ASSERT2(data->version == DATA_VERSION, "Version number of data does not match");
-	
-	// imageBaseDirの指定がないときコンバート時に指定されたパスを使用する
-	std::string baseDir = imageBaseDir;
-	if (imageBaseDir == s_null && data->imageBaseDir)
+	//テーブルが使用しているメモリのサイズ
+	size_t getMemorySize() const
 	{
-		ToPointer ptr(data);
-		const char* dir = static_cast<const char*>(ptr(data->imageBaseDir));
-		baseDir = dir;
+		size_t count = (size_t)_numFrames * _numParts;
+		return count * (sizeof(ss_s16) + sizeof(int) * BAKE_INT_MAX + sizeof(float) * BAKE_FLOAT_MAX + sizeof(SSColor4B) * 4 + sizeof(const ss_u16*));
 	}
 
-	//アニメはエフェクトを参照し、エフェクトはセルを参照するのでこの順番で生成する必要がある
-	CellCache* cellCache = NULL;
-	if (imageZipLoad == false)
+protected:
+	//floatのアトリビュート
+	enum
 	{
-		//画像はZIPファイルの中身を使用するZIPファイル名は空白にする
-		cellCache = CellCache::create(data, baseDir, "");
+		BAKE_X,
+		BAKE_Y,
+		BAKE_Z,
+		BAKE_PIVOT_X,
+		BAKE_PIVOT_Y,
+		BAKE_ROTATION_X,
+		BAKE_ROTATION_Y,
+		BAKE_ROTATION_Z,
+		BAKE_SCALE_X,
+		BAKE_SCALE_Y,
+		BAKE_LOCALSCALE_X,
+		BAKE_LOCALSCALE_Y,
+		BAKE_SIZE_X,
+		BAKE_SIZE_Y,
+		BAKE_UV_MOVE_X,
+		BAKE_UV_MOVE_Y,
+		BAKE_UV_ROTATION,
+		BAKE_UV_SCALE_X,
+		BAKE_UV_SCALE_Y,
+		BAKE_BOUNDINGRADIUS,
+		BAKE_MASKLIMEN,
+		BAKE_PRIORITY,
+		BAKE_INSTANCE_SPEED,
+		BAKE_EFFECT_SPEED,
+		BAKE_VERTEX_OFFSET,
+		BAKE_PARTS_COLOR_RATE = BAKE_VERTEX_OFFSET + 8,
+		BAKE_FLOAT_MAX = BAKE_PARTS_COLOR_RATE + 4
+	};
+	//intのアトリビュート
+	enum
+	{
+		BAKE_FLAGS,
+		BAKE_FLAGS2,
+		BAKE_CELL_INDEX,
+		BAKE_OPACITY,
+		BAKE_LOCALOPACITY,
+		BAKE_INSTANCE_CURKEYFRAME,
+		BAKE_INSTANCE_STARTFRAME,
+		BAKE_INSTANCE_ENDFRAME,
+		BAKE_INSTANCE_LOOPNUM,
+		BAKE_INSTANCE_LOOPFLAG,
+		BAKE_EFFECT_CURKEYFRAME,
+		BAKE_EFFECT_STARTTIME,
+		BAKE_EFFECT_LOOPFLAG,
+		BAKE_VERTEX_FLAGS,
+		BAKE_PARTS_COLOR_TYPE,
+		BAKE_INT_MAX
+	};
+
+	AnimeBakeData()
+		: _numFrames(0), _numParts(0)
+	{}
+
+	void init(const ProjectData* data, const AnimeRef* animeRef)
+	{
+		ToPointer ptr(data);
+		const AnimationData* animeData = animeRef->animationData;
+		const ss_offset* frameDataIndex = static_cast<const ss_offset*>(ptr(animeData->frameData));
+		_numFrames = animeData->totalFrames;
+		_numParts = animeRef->animePackData->numParts;
+		size_t count = (size_t)_numFrames * _numParts;
+
+		_partIndex.resize(count);
+		for (int i = 0; i < BAKE_FLOAT_MAX; i++) _float[i].resize(count);
+		for (int i = 0; i < BAKE_INT_MAX; i++) _int[i].resize(count);
+		for (int i = 0; i < 4; i++) _color[i].resize(count);
+		_meshData.resize(count);
+
+		PartFrameData pf;
+		for (int frameNo = 0; frameNo < _numFrames; frameNo++)
+		{
+			const ss_u16* frameDataArray = static_cast<const ss_u16*>(ptr(frameDataIndex[frameNo]));
+			DataArrayReader reader(frameDataArray);
+
+			for (int index = 0; index < _numParts; index++)
+			{
+				memset(&pf, 0, sizeof(pf));
+				animeRef->decoder.decode(reader, pf);
+				set(frameNo * _numParts + index, pf);
+			}
+		}
 	}
-	else
+
+	void set(size_t i, const PartFrameData& pf)
 	{
-		cellCache = CellCache::create(data, baseDir, zipFilepath);
+		_partIndex[i] = (ss_s16)pf.partIndex;
+		_int[BAKE_FLAGS][i] = pf.flags;
+		_int[BAKE_FLAGS2][i] = pf.flags2;
+		_int[BAKE_CELL_INDEX][i] = pf.cellIndex;
+		_float[BAKE_X][i] = pf.x;
+		_float[BAKE_Y][i] = pf.y;
+		_float[BAKE_Z][i] = pf.z;
+		_float[BAKE_PIVOT_X][i] = pf.pivotX;
+		_float[BAKE_PIVOT_Y][i] = pf.pivotY;
+		_float[BAKE_ROTATION_X][i] = pf.rotationX;
+		_float[BAKE_ROTATION_Y][i] = pf.rotationY;
+		_float[BAKE_ROTATION_Z][i] = pf.rotationZ;
+		_float[BAKE_SCALE_X][i] = pf.scaleX;
+		_float[BAKE_SCALE_Y][i] = pf.scaleY;
+		_float[BAKE_LOCALSCALE_X][i] = pf.localscaleX;
+		_float[BAKE_LOCALSCALE_Y][i] = pf.localscaleY;
+		_int[BAKE_OPACITY][i] = pf.opacity;
+		_int[BAKE_LOCALOPACITY][i] = pf.localopacity;
+		_float[BAKE_SIZE_X][i] = pf.size_X;
+		_float[BAKE_SIZE_Y][i] = pf.size_Y;
+		_float[BAKE_UV_MOVE_X][i] = pf.uv_move_X;
+		_float[BAKE_UV_MOVE_Y][i] = pf.uv_move_Y;
+		_float[BAKE_UV_ROTATION][i] = pf.uv_rotation;
+		_float[BAKE_UV_SCALE_X][i] = pf.uv_scale_X;
+		_float[BAKE_UV_SCALE_Y][i] = pf.uv_scale_Y;
+		_float[BAKE_BOUNDINGRADIUS][i] = pf.boundingRadius;
+		_float[BAKE_MASKLIMEN][i] = pf.masklimen;
+		_float[BAKE_PRIORITY][i] = pf.priority;
+		_int[BAKE_INSTANCE_CURKEYFRAME][i] = pf.instanceValue_curKeyframe;
+		_int[BAKE_INSTANCE_STARTFRAME][i] = pf.instanceValue_startFrame;
+		_int[BAKE_INSTANCE_ENDFRAME][i] = pf.instanceValue_endFrame;
+		_int[BAKE_INSTANCE_LOOPNUM][i] = pf.instanceValue_loopNum;
+		_float[BAKE_INSTANCE_SPEED][i] = pf.instanceValue_speed;
+		_int[BAKE_INSTANCE_LOOPFLAG][i] = pf.instanceValue_loopflag;
+		_int[BAKE_EFFECT_CURKEYFRAME][i] = pf.effectValue_curKeyframe;
+		_int[BAKE_EFFECT_STARTTIME][i] = pf.effectValue_startTime;
+		_float[BAKE_EFFECT_SPEED][i] = pf.effectValue_speed;
+		_int[BAKE_EFFECT_LOOPFLAG][i] = pf.effectValue_loopflag;
+		_int[BAKE_VERTEX_FLAGS][i] = pf.vertexFlags;
+		for (int v = 0; v < 8; v++)
+		{
+			_float[BAKE_VERTEX_OFFSET + v][i] = pf.vertexOffset[v];
+		}
+		_int[BAKE_PARTS_COLOR_TYPE][i] = pf.partsColorTypeAndFlags;
+		for (int v = 0; v < 4; v++)
+		{
+			_float[BAKE_PARTS_COLOR_RATE + v][i] = pf.partsColorRate[v];
+			_color[v][i] = pf.partsColor[v];
+		}
+		_meshData[i] = pf.meshData;
 	}
 
-	EffectCache* effectCache = EffectCache::create(data, baseDir, cellCache);	//
+	int								_numFrames;
+	int								_numParts;
+	std::vector<ss_s16>				_partIndex;				//フレームデータ内の順番に対応するパーツ番号
+	std::vector<float>				_float[BAKE_FLOAT_MAX];
+	std::vector<int>				_int[BAKE_INT_MAX];
+	std::vector<SSColor4B>			_color[4];				//パーツカラー LT,RT,LB,RB
+	std::vector<const ss_u16*>		_meshData;				//メッシュの頂点座標はssbpデータを参照する
+};
 
-	AnimeCache* animeCache = AnimeCache::create(data);
 
-	ResourceSet* rs = new ResourceSet();
-	rs->data = data;
-	rs->isDataAutoRelease = false;
-	rs->cellCache = cellCache;
-	rs->animeCache = animeCache;
-	rs->effectCache = effectCache;
-	_dataDic.insert(std::map<std::string, ResourceSet*>::value_type(dataKey, rs));
+/**
+ * PoseCache
+ * 同じアニメーションの同じフレームを再生しているプレイヤー間で、
+ * 親子関係計算済みのパーツのステータスとマトリクスを共有するキャッシュ
+ * 最大数を超えた場合は最後に使用されてから最も時間が経過したものから破棄する
+ */
+struct PoseKey
+{
+	const AnimeRef*	animeRef;
+	int				frameNo;
+	int				direction;
+	int				color;		//プレイヤーのカラー（RGB）
 
-	return dataKey;
-}
+	bool operator<(const PoseKey& rhs) const
+	{
+		if (animeRef != rhs.animeRef) return animeRef < rhs.animeRef;
+		if (frameNo != rhs.frameNo) return frameNo < rhs.frameNo;
+		if (direction != rhs.direction) return direction < rhs.direction;
+		return color < rhs.color;
+	}
+};
 
-std::string ResourceManager::addDataWithKey(const std::string& dataKey, const std::string& ssbpFilepath, const std::string& imageBaseDir, const std::string& zipFilepath, bool imageZipLoad)
+struct PosePart
 {
+	State				state;
+	float				mat[16];		//継承マトリクス
+	float				localmat[16];	//ローカルマトリクス
+	std::vector<float>	meshVertices;	//メッシュの座標バッファ
+};
 
-	std::string fullpath = ssbpFilepath;
+struct Pose
+{
+	PoseKey					key;
+	std::vector<int>		partIndex;	//描画順のパーツ番号
+	std::vector<PosePart>	parts;		//パーツ番号順
+	std::list<Pose*>::iterator	lru;
+};
 
-	unsigned long nSize = 0;
-	void* loadData = SSFileOpen(fullpath.c_str(), "rb", &nSize, zipFilepath.c_str());
-	if (loadData == NULL)
+class PoseCache
+{
+public:
+	static PoseCache* getInstance()
 	{
-		std::string msg = "Can't load project data > " + fullpath;
-		SS_ASSERT2(loadData != NULL, msg.c_str());
+		static PoseCache instance;
+		return &instance;
 	}
-	
-	const ProjectData* data = static_cast<const ProjectData*>(loadData);
-	SS_ASSERT2(data->dataId == DATA_ID, "Not data id matched");
-	SS_ASSERT2(data->version == DATA_VERSION, "Version number of data does not match");
-	
-	std::string baseDir = imageBaseDir;
-	if (imageBaseDir == s_null)
+
+	void setMaxSize(int size)
 	{
-		// imageBaseDirの指定がないとき
-		ToPointer ptr(data);
-		std::string dir = static_cast<const char*>(ptr(data->imageBaseDir));
-		if (dir != "")
+		_maxSize = size > 0 ? size : 0;
+		while ((int)_lru.size() > _maxSize)
 		{
-			// コンバート時に指定されたパスを使用する
-			baseDir = dir;
+			release(_lru.back());
 		}
-		else
+	}
+	bool isEnable() const { return _maxSize > 0; }
+
+	//キャッシュを検索する（見つかった場合は最近使用したものとして扱う）
+	const Pose* find(const PoseKey& key)
+	{
+		std::map<PoseKey, Pose*>::iterator it = _poses.find(key);
+		if (it == _poses.end())
 		{
-			// プロジェクトファイルと同じディレクトリを指定する
-			std::string directory;
+			return NULL;
+		}
+		Pose* pose = it->second;
+		_lru.splice(_lru.begin(), _lru, pose->lru);
+		return pose;
+	}
+
+	//新しいポーズを登録する
+	Pose* add(const PoseKey& key)
+	{
+		if (_maxSize <= 0)
+		{
+			return NULL;
+		}
+		while ((int)_lru.size() >= _maxSize)
+		{
+			release(_lru.back());
+		}
+		Pose* pose = new Pose();
+		pose->key = key;
+		_lru.push_front(pose);
+		pose->lru = _lru.begin();
+		_poses.insert(std::map<PoseKey, Pose*>::value_type(key, pose));
+		return pose;
+	}
+
+	//アニメーションに対応するポーズを破棄する
+	void remove(const AnimeRef* animeRef)
+	{
+		std::list<Pose*>::iterator it = _lru.begin();
+		while (it != _lru.end())
+		{
+			Pose* pose = *it;
+			it++;
+			if (pose->key.animeRef == animeRef)
+			{
+				release(pose);
+			}
+		}
+	}
+
+	void clear()
+	{
+		while (!_lru.empty())
+		{
+			release(_lru.back());
+		}
+	}
+
+private:
+	PoseCache()
+		: _maxSize(0)
+	{}
+	~PoseCache()
+	{
+		clear();
+	}
+
+	void release(Pose* pose)
+	{
+		_poses.erase(pose->key);
+		_lru.erase(pose->lru);
+		delete pose;
+	}
+
+	int							_maxSize;
+	std::map<PoseKey, Pose*>	_poses;
+	std::list<Pose*>			_lru;		//先頭が最近使用したもの
+};
+
+
+/**
+ * PartsPool
+ * インスタンスパーツのプレイヤーとパーツ配列を参照アニメーション毎に保持し、
+ * アニメーションを切り替える度に生成、破棄を行わないように再利用する
+ */
+class PartsPool
+{
+public:
+	static PartsPool* getInstance()
+	{
+		static PartsPool instance;
+		return &instance;
+	}
+
+	void setMaxSize(int size)
+	{
+		_maxSize = size > 0 ? size : 0;
+		std::map<const AnimeRef*, Entry>::iterator it = _entries.begin();
+		for (; it != _entries.end(); it++)
+		{
+			shrink(it->second, _maxSize);
+		}
+	}
+
+	//アニメーションを再生していたプレイヤーを取り出す
+	Player* getPlayer(const AnimeRef* animeRef)
+	{
+		std::map<const AnimeRef*, Entry>::iterator it = _entries.find(animeRef);
+		if ((it == _entries.end()) || (it->second.players.empty()))
+		{
+			return NULL;
+		}
+		Player* player = it->second.players.back();
+		it->second.players.pop_back();
+		return player;
+	}
+
+	//プレイヤーを戻す（保持できない場合はfalseを返すので呼び出し側で破棄する）
+	bool putPlayer(const AnimeRef* animeRef, Player* player)
+	{
+		if ((_maxSize <= 0) || (animeRef == NULL))
+		{
+			return false;
+		}
+		Entry& entry = _entries[animeRef];
+		if ((int)entry.players.size() >= _maxSize)
+		{
+			return false;
+		}
+		entry.players.push_back(player);
+		return true;
+	}
+
+	//アニメーション用に作成したパーツ配列を取り出す
+	bool getParts(const AnimeRef* animeRef, std::vector<CustomSprite*>& parts)
+	{
+		std::map<const AnimeRef*, Entry>::iterator it = _entries.find(animeRef);
+		if ((it == _entries.end()) || (it->second.parts.empty()))
+		{
+			return false;
+		}
+		parts.swap(it->second.parts.back());
+		it->second.parts.pop_back();
+		return true;
+	}
+
+	//パーツ配列を戻す（保持できた場合はpartsが空になる）
+	bool putParts(const AnimeRef* animeRef, std::vector<CustomSprite*>& parts)
+	{
+		if ((_maxSize <= 0) || (animeRef == NULL))
+		{
+			return false;
+		}
+		Entry& entry = _entries[animeRef];
+		if ((int)entry.parts.size() >= _maxSize)
+		{
+			return false;
+		}
+		entry.parts.push_back(std::vector<CustomSprite*>());
+		entry.parts.back().swap(parts);
+		return true;
+	}
+
+	//アニメーションに対応するプレイヤーとパーツ配列を破棄する
+	void remove(const AnimeRef* animeRef)
+	{
+		std::map<const AnimeRef*, Entry>::iterator it = _entries.find(animeRef);
+		if (it != _entries.end())
+		{
+			shrink(it->second, 0);
+			_entries.erase(it);
+		}
+	}
+
+	void clear()
+	{
+		std::map<const AnimeRef*, Entry>::iterator it = _entries.begin();
+		for (; it != _entries.end(); it++)
+		{
+			shrink(it->second, 0);
+		}
+		_entries.clear();
+	}
+
+private:
+	struct Entry
+	{
+		std::vector<Player*>						players;
+		std::vector<std::vector<CustomSprite*> >	parts;
+	};
+
+	PartsPool()
+		: _maxSize(8)
+	{}
+	~PartsPool()
+	{
+		clear();
+	}
+
+	//保持数を超えた分を破棄する
+	static void shrink(Entry& entry, int size)
+	{
+		while ((int)entry.players.size() > size)
+		{
+			delete entry.players.back();
+			entry.players.pop_back();
+		}
+		while ((int)entry.parts.size() > size)
+		{
+			std::vector<CustomSprite*>& parts = entry.parts.back();
+			for (int i = 0; i < (int)parts.size(); i++)
+			{
+				delete parts[i];
+			}
+			entry.parts.pop_back();
+		}
+	}
+
+	int									_maxSize;	//参照アニメーション毎に保持する最大数
+	std::map<const AnimeRef*, Entry>	_entries;
+};
+
+
+/**
+ * AnimeCache
+ */
+class AnimeCache
+{
+public:
+	AnimeCache()
+	{
+	}
+	~AnimeCache()
+	{
+		releseReference();
+	}
+	static AnimeCache* create(const ProjectData* data)
+	{
+		AnimeCache* obj = new AnimeCache();
+		if (obj)
+		{
+			obj->init(data);
+		}
+		return obj;
+	}
+
+	/**
+	 * packNameとanimeNameを指定してAnimeRefを得る
+	 */
+	AnimeRef* getReference(const std::string& packName, const std::string& animeName)
+	{
+		return getReference(indexOf(packName.c_str(), packName.size(), animeName.c_str(), animeName.size()));
+	}
+
+	/**
+	 * animeNameのみ指定してAnimeRefを得る
+	 */
+	AnimeRef* getReference(const std::string& animeName)
+	{
+		return getReference(indexOf(animeName.c_str(), animeName.size()));
+	}
+
+	/**
+	 * ハンドルを指定してAnimeRefを得る
+	 */
+	AnimeRef* getReference(AnimeHandle handle)
+	{
+		if (handle < 0 || handle >= (int)_refs.size())
+		{
+			return NULL;
+		}
+		return _refs[handle];
+	}
+
+	/**
+	 * アニメーション名（"ssae名/モーション名"）からハンドルを得る（見つからない場合は-1）
+	 */
+	AnimeHandle indexOf(const char* animeName, size_t len) const
+	{
+		return _index.find(animeName, len);
+	}
+	AnimeHandle indexOf(const char* packName, size_t packLen, const char* animeName, size_t animeLen) const
+	{
+		return _index.find(packName, packLen, animeName, animeLen);
+	}
+	
+	void dump()
+	{
+		std::map<std::string, AnimeRef*>::iterator it = _dic.begin();
+		while (it != _dic.end())
+		{
+			SSLOG("%s", (*it).second);
+			++it;
+		}
+	}
+
+protected:
+	void init(const ProjectData* data)
+	{
+		SS_ASSERT2(data != NULL, "Invalid data");
+		
+		ToPointer ptr(data);
+		const AnimePackData* animePacks = static_cast<const AnimePackData*>(ptr(data->animePacks));
+
+		int numAnime = 0;
+		for (int packIndex = 0; packIndex < data->numAnimePacks; packIndex++)
+		{
+			numAnime += animePacks[packIndex].numAnimations;
+		}
+		_refs.reserve(numAnime);
+		_partNameIndex.resize(data->numAnimePacks);
+		_partHierarchy.resize(data->numAnimePacks);
+
+		for (int packIndex = 0; packIndex < data->numAnimePacks; packIndex++)
+		{
+			const AnimePackData* pack = &animePacks[packIndex];
+			const AnimationData* animations = static_cast<const AnimationData*>(ptr(pack->animations));
+			const char* packName = static_cast<const char*>(ptr(pack->name));
+
+			//パーツ名のテーブルを作成する
+			//名前はssbpデータ内の文字列を参照する
+			const PartData* parts = static_cast<const PartData*>(ptr(pack->parts));
+			NameIndex& partNameIndex = _partNameIndex[packIndex];
+			partNameIndex.reserve(pack->numParts);
+			bool hasInstancePart = false;
+			for (int partIndex = 0; partIndex < pack->numParts; partIndex++)
+			{
+				partNameIndex.add(static_cast<const char*>(ptr(parts[partIndex].name)), partIndex);
+				if (parts[partIndex].type == PARTTYPE_INSTANCE)
+				{
+					hasInstancePart = true;
+				}
+			}
+			PartHierarchy& partHierarchy = _partHierarchy[packIndex];
+			partHierarchy.init(parts, pack->numParts);
+			
+			for (int animeIndex = 0; animeIndex < pack->numAnimations; animeIndex++)
+			{
+				const AnimationData* anime = &animations[animeIndex];
+				const char* animeName = static_cast<const char*>(ptr(anime->name));
+				
+				AnimeRef* ref = new AnimeRef();
+				ref->packName = packName;
+				ref->animeName = animeName;
+				ref->animationData = anime;
+				ref->animePackData = pack;
+				ref->partNameIndex = &partNameIndex;
+				ref->partHierarchy = &partHierarchy;
+				ref->bake = NULL;
+				ref->hasInstancePart = hasInstancePart;
+				initLabel(ref, ptr);
+				initDecoder(ref, ptr);
+
+				// packName + animeNameでの登録
+				std::string key = toPackAnimeKey(packName, animeName);
+				SSLOG("anime key: %s", key.c_str());
+				ref->key = key;
+				ref->handle = (AnimeHandle)_refs.size();
+				_refs.push_back(ref);
+				_dic.insert(std::map<std::string, AnimeRef*>::value_type(key, ref));
+
+				// animeNameのみでの登録
+//				_dic.insert(std::map<std::string, AnimeRef*>::value_type(animeName, ref));
+				
+			}
+		}
+
+		//検索用のハッシュテーブルを作成する
+		//名前はAnimeRefが保持している文字列を参照する
+		_index.reserve((int)_refs.size());
+		for (int i = 0; i < (int)_refs.size(); i++)
+		{
+			_index.add(_refs[i]->key.c_str(), _refs[i]->key.size(), i);
+		}
+	}
+
+	//ラベル情報をデコードしてテーブルを作成する
+	static bool compareLabelFrame(const LabelData& a, const LabelData& b)
+	{
+		return a.frameNo < b.frameNo;
+	}
+	static void initLabel(AnimeRef* ref, const ToPointer& ptr)
+	{
+		const AnimationData* animeData = ref->animationData;
+		if (!animeData->labelData) return;
+		const ss_offset* labelDataIndex = static_cast<const ss_offset*>(ptr(animeData->labelData));
+
+		ref->labels.reserve(animeData->labelNum);
+		for (int idx = 0; idx < animeData->labelNum; idx++)
+		{
+			if (!labelDataIndex[idx]) break;
+			const ss_u16* labelDataArray = static_cast<const ss_u16*>(ptr(labelDataIndex[idx]));
+
+			DataArrayReader reader(labelDataArray);
+
+			LabelData ldata;
+			ss_offset offset = reader.readOffset();
+			const char* str = static_cast<const char*>(ptr(offset));
+			int labelFrame = reader.readU16();
+			ldata.str = str;
+			ldata.strSize = (int)ldata.str.size();
+			ldata.frameNo = labelFrame;
+			ref->labels.push_back(ldata);
+		}
+		//同じフレームのラベルはデータの順番を保つ
+		std::stable_sort(ref->labels.begin(), ref->labels.end(), compareLabelFrame);
+
+		//名前はlabelsが保持している文字列を参照する
+		//同じ名前のラベルはデータの先頭にあるものではなくフレームの若いものが優先される
+		ref->labelIndex.reserve((int)ref->labels.size());
+		for (int i = 0; i < (int)ref->labels.size(); i++)
+		{
+			ref->labelIndex.add(ref->labels[i].str.c_str(), ref->labels[i].str.size(), i);
+		}
+	}
+
+	//デコーダにパーツの初期値とメッシュパーツの頂点数を設定する
+	static void initDecoder(AnimeRef* ref, const ToPointer& ptr)
+	{
+		const AnimePackData* pack = ref->animePackData;
+		const PartData* parts = static_cast<const PartData*>(ptr(pack->parts));
+		std::vector<int> meshVertexSize(pack->numParts, 0);
+		for (int partIndex = 0; partIndex < pack->numParts; partIndex++)
+		{
+			if (parts[partIndex].type == PARTTYPE_MESH)
+			{
+				const ss_offset* meshsDataUV = static_cast<const ss_offset*>(ptr(ref->animationData->meshsDataUV));
+				const ss_u16* meashsDataUVArray = static_cast<const ss_u16*>(ptr(meshsDataUV[partIndex]));
+				DataArrayReader reader(meashsDataUVArray);
+				reader.readU32();	//isBind
+				meshVertexSize[partIndex] = reader.readU32();
+			}
+		}
+
+		const AnimationInitialData* initialDataList = static_cast<const AnimationInitialData*>(ptr(ref->animationData->defaultData));
+		ref->decoder.init(initialDataList, pack->numParts, meshVertexSize);
+
+		//デコード中にデコーダを変更しないよう、全フレームのプランをここで作成する
+		const ss_offset* frameDataIndex = static_cast<const ss_offset*>(ptr(ref->animationData->frameData));
+		for (int frameNo = 0; frameNo < ref->animationData->totalFrames; frameNo++)
+		{
+			const ss_u16* frameDataArray = static_cast<const ss_u16*>(ptr(frameDataIndex[frameNo]));
+			DataArrayReader reader(frameDataArray);
+			ref->decoder.preparePlans(reader, pack->numParts);
+		}
+	}
+
+	static std::string toPackAnimeKey(const std::string& packName, const std::string& animeName)
+	{
+		//非同期読み込みではワーカースレッドから呼ばれるので、静的バッファを使うFormatは使用しない
+		std::string key;
+		key.reserve(packName.size() + 1 + animeName.size());
+		key.append(packName).append(1, '/').append(animeName);
+		return key;
+	}
+
+	//キャッシュの削除
+	void releseReference(void)
+	{
+		std::map<std::string, AnimeRef*>::iterator it = _dic.begin();
+		while (it != _dic.end())
+		{
+			AnimeRef* ref = it->second;
+			if (ref)
+			{
+				PoseCache::getInstance()->remove(ref);
+				PartsPool::getInstance()->remove(ref);
+				SS_SAFE_DELETE(ref->bake);
+				delete ref;
+				it->second = 0;
+			}
+			it++;
+		}
+		_dic.clear();
+		_refs.clear();
+		_index = NameIndex();
+		_partNameIndex.clear();
+		_partHierarchy.clear();
+	}
+
+protected:
+	std::vector<AnimeRef*>				_refs;		//ハンドル順のAnimeRef
+	NameIndex							_index;		//アニメーション名からハンドルを引くテーブル
+	std::vector<NameIndex>				_partNameIndex;	//パック毎のパーツ名テーブル
+	std::vector<PartHierarchy>			_partHierarchy;	//パック毎の親子関係の深さ順のテーブル
+
+public:
+	std::map<std::string, AnimeRef*>	_dic;
+};
+
+
+
+
+
+/**
+ * ResourceSet
+ */
+struct ResourceSet
+{
+	const ProjectData* data;
+	bool isDataAutoRelease;
+	bool isDataMapped;			//dataがSSFileMapでマップされたものか
+	unsigned long dataSize;		//マップしたデータのサイズ
+	EffectCache* effectCache;
+	CellCache* cellCache;
+	AnimeCache* animeCache;
+
+	virtual ~ResourceSet()
+	{
+		if (isDataAutoRelease)
+		{
+			if (isDataMapped)
+			{
+				//マップしたファイルを解放する
+				SSFileUnmap((unsigned char*)data, dataSize);
+			}
+			else
+			{
+				//SSFileOpenはmallocで確保したバッファを返す
+				free((void*)data);
+			}
+			data = NULL;
+		}
+		if (animeCache)
+		{
+			delete animeCache;
+			animeCache = NULL;
+		}
+		if (cellCache)
+		{
+			delete cellCache;
+			cellCache = NULL;
+		}
+		if (effectCache)
+		{
+			delete effectCache;
+			effectCache = NULL;
+		}
+	}
+};
+
+
+/**
+ * ResourceManager
+ */
+
+static ResourceManager* defaultInstance = NULL;
+const std::string ResourceManager::s_null;
+
+ResourceManager* ResourceManager::getInstance()
+{
+	if (!defaultInstance)
+	{
+		defaultInstance = ResourceManager::create();
+	}
+	return defaultInstance;
+}
+
+ResourceManager::ResourceManager(void)
+	: _asyncAlive(new bool(true))
+	, _fileMapEnable(false)
+{
+}
+
+ResourceManager::~ResourceManager()
+{
+	//読み込み中のワーカースレッドの終了を待つ
+	//メインスレッドで実行される完了処理は読み込んだデータを破棄するだけになる
+	*_asyncAlive = false;
+	while (!_loadThreads.empty())
+	{
+		_loadThreads.front().join();
+		_loadThreads.pop_front();
+	}
+	removeAllData();
+}
+
+ResourceManager* ResourceManager::create()
+{
+	ResourceManager* obj = new ResourceManager();
+	return obj;
+}
+
+ResourceSet* ResourceManager::getData(const std::string& dataKey)
+{
+	ResourceSet* rs = _dataDic.at(dataKey);
+	return rs;
+}
+
+std::vector<std::string> ResourceManager::getAnimeName(const std::string& dataKey)
+{
+	std::vector<std::string> animename;
+	ResourceSet* rs = _dataDic.at(dataKey);
+	//アニメーション名を取得してリストを返す
+	std::map<std::string, ss::AnimeRef*>::iterator itpairstri = rs->animeCache->_dic.begin();
+	while (1)
+	{
+		// イテレータは pair<const string, int> 型なので、
+		std::string strKey = itpairstri->first;     // イテレータからキーが得られる。
+
+		if (strKey.find("/") == std::string::npos)	//ssae名が含まれていない場合はスキップ
+		{
+			continue;
+		}
+		animename.push_back(strKey);
+		itpairstri++;
+		if (itpairstri == rs->animeCache->_dic.end())
+		{
+			break;
+		}
+	}
+	return animename;
+}
+
+//画像を読み込むZIPファイル名を決める
+static std::string getImageZipFilepath(const std::string& zipFilepath, bool imageZipLoad)
+{
+	if (imageZipLoad == false)
+	{
+		//画像はZIPファイルの中身を使用するZIPファイル名は空白にする
+		return "";
+	}
+	return zipFilepath;
+}
+
+ResourceSet* ResourceManager::createResourceSet(const ProjectData* data, const std::string& baseDir, CellCache* cellCache)
+{
+	//アニメはエフェクトを参照し、エフェクトはセルを参照するのでこの順番で生成する必要がある
+	EffectCache* effectCache = EffectCache::create(data, baseDir, cellCache);	//
+
+	AnimeCache* animeCache = AnimeCache::create(data);
+
+	ResourceSet* rs = new ResourceSet();
+	rs->data = data;
+	rs->isDataAutoRelease = false;
+	rs->isDataMapped = false;
+	rs->dataSize = 0;
+	rs->cellCache = cellCache;
+	rs->animeCache = animeCache;
+	rs->effectCache = effectCache;
+
+	return rs;
+}
+
+std::string ResourceManager::addData(const std::string& dataKey, const ProjectData* data, const std::string& imageBaseDir, const std::string& zipFilepath, bool imageZipLoad)
+{
+	SS_ASSERT2(data != NULL, "Invalid data");
+	SS_ASSERT2(data->dataId == DATA_ID, "Not data id matched");
+	SS_ASSERT2(data->version == DATA_VERSION, "Version number of data does not match");
+	
+	// imageBaseDirの指定がないときコンバート時に指定されたパスを使用する
+	std::string baseDir = imageBaseDir;
+	if (imageBaseDir == s_null && data->imageBaseDir)
+	{
+		ToPointer ptr(data);
+		const char* dir = static_cast<const char*>(ptr(data->imageBaseDir));
+		baseDir = dir;
+	}
+
+	//登録されているか非同期で読み込み中の名前は登録できない
+	if (isDataKeyUsed(dataKey))
+	{
+		SSLOGERROR("dataKey is already used > %s", dataKey.c_str());
+		return "";
+	}
+
+	CellCache* cellCache = CellCache::create(data, baseDir, getImageZipFilepath(zipFilepath, imageZipLoad));
+	ResourceSet* rs = createResourceSet(data, baseDir, cellCache);
+	_dataDic.insert(std::map<std::string, ResourceSet*>::value_type(dataKey, rs));
+
+	return dataKey;
+}
+
+//登録済みか非同期で読み込み中のdataKeyか
+bool ResourceManager::isDataKeyUsed(const std::string& dataKey) const
+{
+	return (_dataDic.find(dataKey) != _dataDic.end()) || (_asyncLoadingKeys.find(dataKey) != _asyncLoadingKeys.end());
+}
+
+//SSFileOpenかSSFileMapで読み込んだssbpを解放する
+static void releaseProjectData(void* loadData, unsigned long dataSize, bool isMapped)
+{
+	if (isMapped)
+	{
+		SSFileUnmap((unsigned char*)loadData, dataSize);
+	}
+	else
+	{
+		free(loadData);
+	}
+}
+
+//画像を読み込むルートパスを決める
+static std::string getImageBaseDir(const ProjectData* data, const std::string& imageBaseDir, const std::string& ssbpFilepath)
+{
+	std::string baseDir = imageBaseDir;
+	if (imageBaseDir == ResourceManager::s_null)
+	{
+		// imageBaseDirの指定がないとき
+		ToPointer ptr(data);
+		std::string dir = static_cast<const char*>(ptr(data->imageBaseDir));
+		if (dir != "")
+		{
+			// コンバート時に指定されたパスを使用する
+			baseDir = dir;
+		}
+		else
+		{
+			// プロジェクトファイルと同じディレクトリを指定する
+			std::string directory;
 			std::string filename;
 			splitPath(directory, filename, ssbpFilepath);
 			baseDir = directory;
 		}
 		//SSLOG("imageBaseDir: %s", baseDir.c_str());
 	}
+	return baseDir;
+}
+
+std::string ResourceManager::addDataWithKey(const std::string& dataKey, const std::string& ssbpFilepath, const std::string& imageBaseDir, const std::string& zipFilepath, bool imageZipLoad)
+{
+	//登録されているか非同期で読み込み中の名前は登録できない
+	if (isDataKeyUsed(dataKey))
+	{
+		SSLOGERROR("dataKey is already used > %s", dataKey.c_str());
+		return "";
+	}
+
+	std::string fullpath = ssbpFilepath;
+
+	unsigned long nSize = 0;
+	void* loadData = NULL;
+	bool isMapped = false;
+	if ((_fileMapEnable == true) && (zipFilepath == ""))
+	{
+		//ファイルをマップしてそのまま参照する
+		loadData = SSFileMap(fullpath.c_str(), &nSize);
+		isMapped = (loadData != NULL);
+	}
+	if (loadData == NULL)
+	{
+		loadData = SSFileOpen(fullpath.c_str(), "rb", &nSize, zipFilepath.c_str());
+	}
+	if (loadData == NULL)
+	{
+		std::string msg = "Can't load project data > " + fullpath;
+		SS_ASSERT2(loadData != NULL, msg.c_str());
+	}
+	
+	const ProjectData* data = static_cast<const ProjectData*>(loadData);
+	SS_ASSERT2(data->dataId == DATA_ID, "Not data id matched");
+	SS_ASSERT2(data->version == DATA_VERSION, "Version number of data does not match");
+	
+	std::string baseDir = getImageBaseDir(data, imageBaseDir, ssbpFilepath);
 
 	addData(dataKey, data, baseDir, zipFilepath, imageZipLoad);
 	
@@ -1565,6 +3266,8 @@ std::string ResourceManager::addDataWithKey(const std::string& dataKey, const st
 	ResourceSet* rs = getData(dataKey);
 	SS_ASSERT2(rs != NULL, "");
 	rs->isDataAutoRelease = true;
+	rs->isDataMapped = isMapped;
+	rs->dataSize = nSize;
 	
 	return dataKey;
 }
@@ -1596,6 +3299,165 @@ std::string ResourceManager::addData(const std::string& ssbpFilepath, const std:
 	return addDataWithKey(dataKey, ssbpFilepath, imageBaseDir, zipFilepath, imageZipLoad);
 }
 
+std::string ResourceManager::addDataAsync(const std::string& ssbpFilepath, const AddDataCallback& callback, const std::string& imageBaseDir, const std::string& zipFilepath, bool imageZipLoad)
+{
+	// ファイル名を取り出す
+	std::string directory;
+	std::string filename;
+	splitPath(directory, filename, ssbpFilepath);
+
+	// 拡張子を取る
+	std::string dataKey = filename;
+	size_t pos = filename.find_last_of(".");
+	if (pos != std::string::npos)
+	{
+		dataKey = filename.substr(0, pos);
+	}
+
+	return addDataWithKeyAsync(dataKey, ssbpFilepath, callback, imageBaseDir, zipFilepath, imageZipLoad);
+}
+
+std::string ResourceManager::addDataWithKeyAsync(const std::string& dataKey, const std::string& ssbpFilepath, const AddDataCallback& callback, const std::string& imageBaseDir, const std::string& zipFilepath, bool imageZipLoad)
+{
+	//登録されているか読み込み中の名前は処理を行わない
+	if (isDataKeyUsed(dataKey))
+	{
+		std::string str = "";
+		return str;
+	}
+	_asyncLoadingKeys.insert(dataKey);
+
+	//FileUtilsはスレッドセーフではないので、ssbpとZIPファイルのフルパスはここで解決しておく
+	std::string ssbpFullpath = (zipFilepath != "") ? ssbpFilepath : SSGetFullPath(ssbpFilepath.c_str());
+	std::string zipFullpath = (zipFilepath != "") ? SSGetFullPath(zipFilepath.c_str()) : "";
+	bool fileMap = (_fileMapEnable == true) && (zipFilepath == "");
+
+	std::shared_ptr<bool> alive = _asyncAlive;
+	_loadThreads.push_back(std::thread([=]()
+	{
+		//ワーカースレッド：ssbpの読み込み
+		unsigned long nSize = 0;
+		void* loadData = NULL;
+		bool isMapped = false;
+		if (fileMap)
+		{
+			//ファイルをマップしてそのまま参照する
+			loadData = SSFileMapFullPath(ssbpFullpath.c_str(), &nSize);
+			isMapped = (loadData != NULL);
+		}
+		if (loadData == NULL)
+		{
+			loadData = SSFileReadFullPath(ssbpFullpath.c_str(), &nSize, zipFullpath.c_str());
+		}
+
+		//メインスレッド：画像のパスの解決
+		std::thread::id workerId = std::this_thread::get_id();
+		SSRunOnMainThread([=]()
+		{
+			if (*alive == false)
+			{
+				//読み込み中にマネージャが破棄された
+				if (loadData)
+				{
+					releaseProjectData(loadData, nSize, isMapped);
+				}
+				return;
+			}
+			joinLoadThread(workerId);
+			readTextureAsync(dataKey, ssbpFilepath, loadData, nSize, isMapped, callback, imageBaseDir, zipFilepath, imageZipLoad);
+		});
+	}));
+
+	return dataKey;
+}
+
+//非同期読み込みの後半
+//画像のパスをメインスレッドで解決し、画像の読み込みとデコード、キャッシュの作成をワーカースレッドで行う
+void ResourceManager::readTextureAsync(const std::string& dataKey, const std::string& ssbpFilepath, void* loadData, unsigned long dataSize, bool isMapped, const AddDataCallback& callback, const std::string& imageBaseDir, const std::string& zipFilepath, bool imageZipLoad)
+{
+	if (loadData == NULL)
+	{
+		//ワーカースレッドから読めないファイル（APK内のリソース等）はここで読み込む
+		isMapped = false;
+		loadData = SSFileOpen(ssbpFilepath.c_str(), "rb", &dataSize, zipFilepath.c_str());
+	}
+
+	const ProjectData* data = static_cast<const ProjectData*>(loadData);
+	if ((data == NULL) || (data->dataId != DATA_ID) || (data->version != DATA_VERSION))
+	{
+		SSLOGERROR("Invalid data > %s", ssbpFilepath.c_str());
+		if (loadData)
+		{
+			releaseProjectData(loadData, dataSize, isMapped);
+		}
+		_asyncLoadingKeys.erase(dataKey);
+		if (callback)
+		{
+			callback(dataKey, false);
+		}
+		return;
+	}
+
+	std::string baseDir = getImageBaseDir(data, imageBaseDir, ssbpFilepath);
+	CellCache* cellCache = CellCache::createDeferred(data, baseDir, getImageZipFilepath(zipFilepath, imageZipLoad));
+
+	std::shared_ptr<bool> alive = _asyncAlive;
+	_loadThreads.push_back(std::thread([=]()
+	{
+		//ワーカースレッド：画像ファイルの読み込みとデコード、キャッシュの作成
+		cellCache->readDeferredTexture();
+		ResourceSet* rs = createResourceSet(data, baseDir, cellCache);
+		rs->isDataAutoRelease = true;
+		rs->isDataMapped = isMapped;
+		rs->dataSize = dataSize;
+
+		//メインスレッド：テクスチャの転送と登録
+		std::thread::id workerId = std::this_thread::get_id();
+		SSRunOnMainThread([=]()
+		{
+			if (*alive == false)
+			{
+				//読み込み中にマネージャが破棄された
+				delete rs;
+				return;
+			}
+			joinLoadThread(workerId);
+			_asyncLoadingKeys.erase(dataKey);
+			rs->cellCache->loadDeferredTexture(rs->data);
+			rs->effectCache->updateCellTexture(rs->cellCache);
+			bool success = _dataDic.insert(std::map<std::string, ResourceSet*>::value_type(dataKey, rs)).second;
+			if (success == false)
+			{
+				//登録できなかったリソースは破棄する
+				delete rs;
+			}
+			if (callback)
+			{
+				callback(dataKey, success);
+			}
+		});
+	}));
+}
+
+//完了したワーカースレッドを回収する
+void ResourceManager::joinLoadThread(std::thread::id id)
+{
+	for (std::list<std::thread>::iterator it = _loadThreads.begin(); it != _loadThreads.end(); it++)
+	{
+		if (it->get_id() == id)
+		{
+			it->join();
+			_loadThreads.erase(it);
+			break;
+		}
+	}
+}
+
+bool ResourceManager::isDataLoading(const std::string& dataKey)
+{
+	return (_asyncLoadingKeys.find(dataKey) != _asyncLoadingKeys.end());
+}
+
 void ResourceManager::removeData(const std::string& dataKey)
 {
 	ResourceSet* rs = getData(dataKey);
@@ -1624,6 +3486,8 @@ bool ResourceManager::changeTexture(char* ssbpName, char* ssceName, long texture
 
 	ResourceSet* rs = getData(ssbpName);
 	rc = rs->cellCache->setCellRefTexture(rs->data, ssceName, texture);
+	//キャッシュしたステータスのテクスチャを更新させる
+	PoseCache::getInstance()->clear();
 
 	return(rc);
 }
@@ -1634,6 +3498,7 @@ bool ResourceManager::releseTexture(char* ssbpName)
 
 	ResourceSet* rs = getData(ssbpName);
 	bool rc = rs->cellCache->releseTexture(rs->data);
+	PoseCache::getInstance()->clear();
 
 	return(rc);
 }
@@ -1655,38 +3520,126 @@ int ResourceManager::getStartFrame(std::string ssbpName, std::string animeName)
 	return(rc);
 }
 
-//アニメーションの終了フレーム数を取得する
-int ResourceManager::getEndFrame(std::string ssbpName, std::string animeName)
+//アニメーションの終了フレーム数を取得する
+int ResourceManager::getEndFrame(std::string ssbpName, std::string animeName)
+{
+	int rc = -1;
+
+	ResourceSet* rs = getData(ssbpName);
+	AnimeRef* animeRef = rs->animeCache->getReference(animeName);
+	if (animeRef == NULL)
+	{
+		std::string msg = Format("Not found animation > anime=%s", animeName.c_str());
+		SS_ASSERT2(animeRef != NULL, msg.c_str());
+	}
+	rc = animeRef->animationData->endFrames;
+
+	return(rc);
+}
+
+//アニメーションの総フレーム数を取得する
+int ResourceManager::getTotalFrame(std::string ssbpName, std::string animeName)
+{
+	int rc = -1;
+
+	ResourceSet* rs = getData(ssbpName);
+	AnimeRef* animeRef = rs->animeCache->getReference(animeName);
+	if (animeRef == NULL)
+	{
+		std::string msg = Format("Not found animation > anime=%s", animeName.c_str());
+		SS_ASSERT2(animeRef != NULL, msg.c_str());
+	}
+	rc = animeRef->animationData->totalFrames;
+
+	return(rc);
+}
+
+//アニメーションの全フレームをデコードしてテーブルを作成する
+bool ResourceManager::bakeAnime(const std::string& dataKey, const std::string& animeName)
+{
+	if (isDataKeyExists(dataKey) == false)
+	{
+		return false;
+	}
+	ResourceSet* rs = getData(dataKey);
+
+	std::map<std::string, AnimeRef*>::iterator it = rs->animeCache->_dic.begin();
+	for (; it != rs->animeCache->_dic.end(); ++it)
+	{
+		AnimeRef* animeRef = it->second;
+		if ((animeName.empty() == false) && (animeRef->key != animeName))
+		{
+			continue;
+		}
+		if (animeRef->bake == NULL)
+		{
+			animeRef->bake = AnimeBakeData::create(rs->data, animeRef);
+		}
+		if (animeName.empty() == false)
+		{
+			return true;
+		}
+	}
+
+	if (animeName.empty() == false)
+	{
+		SSLOG("Not found animation > anime=%s", animeName.c_str());
+		return false;
+	}
+	return true;
+}
+
+//bakeAnimeで作成したテーブルを破棄する
+void ResourceManager::releaseBakeAnime(const std::string& dataKey, const std::string& animeName)
 {
-	int rc = -1;
-
-	ResourceSet* rs = getData(ssbpName);
-	AnimeRef* animeRef = rs->animeCache->getReference(animeName);
-	if (animeRef == NULL)
+	if (isDataKeyExists(dataKey) == false)
 	{
-		std::string msg = Format("Not found animation > anime=%s", animeName.c_str());
-		SS_ASSERT2(animeRef != NULL, msg.c_str());
+		return;
 	}
-	rc = animeRef->animationData->endFrames;
+	ResourceSet* rs = getData(dataKey);
 
-	return(rc);
+	std::map<std::string, AnimeRef*>::iterator it = rs->animeCache->_dic.begin();
+	for (; it != rs->animeCache->_dic.end(); ++it)
+	{
+		AnimeRef* animeRef = it->second;
+		if ((animeName.empty() == false) && (animeRef->key != animeName))
+		{
+			continue;
+		}
+		SS_SAFE_DELETE(animeRef->bake);
+	}
 }
 
-//アニメーションの総フレーム数を取得する
-int ResourceManager::getTotalFrame(std::string ssbpName, std::string animeName)
+//bakeAnimeで作成したテーブルが使用しているメモリのサイズを取得する
+size_t ResourceManager::getBakeAnimeMemorySize(const std::string& dataKey)
 {
-	int rc = -1;
+	size_t size = 0;
+	if (isDataKeyExists(dataKey) == false)
+	{
+		return size;
+	}
+	ResourceSet* rs = getData(dataKey);
 
-	ResourceSet* rs = getData(ssbpName);
-	AnimeRef* animeRef = rs->animeCache->getReference(animeName);
-	if (animeRef == NULL)
+	std::map<std::string, AnimeRef*>::iterator it = rs->animeCache->_dic.begin();
+	for (; it != rs->animeCache->_dic.end(); ++it)
 	{
-		std::string msg = Format("Not found animation > anime=%s", animeName.c_str());
-		SS_ASSERT2(animeRef != NULL, msg.c_str());
+		if (it->second->bake)
+		{
+			size += it->second->bake->getMemorySize();
+		}
 	}
-	rc = animeRef->animationData->totalFrames;
+	return size;
+}
 
-	return(rc);
+//ssbpファイルの読み込みにファイルマップを使用するかを設定する
+void ResourceManager::setFileMapEnable(bool flag)
+{
+	_fileMapEnable = flag;
+}
+
+bool ResourceManager::isFileMapEnable() const
+{
+	return _fileMapEnable;
 }
 
 //ssbpファイルが登録されているかを調べる
@@ -1720,13 +3673,13 @@ Player::Player(void)
 	, _isPlaying(false)
 	, _isPausing(false)
 	, _prevDrawFrameNo(-1)
+	, _isDirty(true)
+	, _isTimeDependent(false)
+	, _cellRevision(0)
 	, _col_r(255)
 	, _col_g(255)
 	, _col_b(255)
 	, _instanceOverWrite(false)
-	, _motionBlendPlayer(nullptr)
-	, _blendTime(0.0f)
-	, _blendTimeMax(0.0f)
 	, _startFrameOverWrite(-1)	//開始フレームの上書き設定
 	, _endFrameOverWrite(-1)		//終了フレームの上書き設定
 	, _seedOffset(0)
@@ -1744,6 +3697,7 @@ Player::Player(void)
 		_partVisible[i] = true;
 		_partIndex[i] = -1;
 		_cellChange[i] = -1;
+		_blendPartWeight[i] = 1.0f;
 	}
 	_state.init();
 
@@ -1753,12 +3707,6 @@ Player::Player(void)
 
 Player::~Player()
 {
-	if (_motionBlendPlayer)
-	{
-		delete (_motionBlendPlayer);
-		_motionBlendPlayer = NULL;
-	}
-
 	releaseParts();
 	releaseData();
 	releaseResourceManager();
@@ -1931,6 +3879,7 @@ void Player::setData(const std::string& dataKey)
 	{
 //		releaseData();
 		_currentRs = rs;
+		_blendSources.clear();	//遷移元のアニメーションは変更前のデータを参照している
 	}
 }
 
@@ -1952,14 +3901,35 @@ void Player::releaseAnime()
 
 void Player::play(const std::string& ssaeName, const std::string& motionName, int loop, int startFrameNo)
 {
-	std::string animeName = Format("%s/%s", ssaeName.c_str(), motionName.c_str());
-	play(animeName, loop, startFrameNo);
+	SS_ASSERT2(_currentRs != NULL, "Not select data");
+
+	//文字列を連結せずに検索する
+	AnimeHandle handle = _currentRs->animeCache->indexOf(ssaeName.c_str(), ssaeName.size(), motionName.c_str(), motionName.size());
+	if (handle < 0)
+	{
+		std::string msg = Format("Not found animation > anime=%s/%s", ssaeName.c_str(), motionName.c_str());
+		SS_ASSERT2(handle >= 0, msg.c_str());
+	}
+	play(handle, loop, startFrameNo);
 }
 
 void Player::play(const std::string& animeName, int loop, int startFrameNo)
 {
 	SS_ASSERT2(_currentRs != NULL, "Not select data");
 
+	AnimeHandle handle = _currentRs->animeCache->indexOf(animeName.c_str(), animeName.size());
+	if (handle < 0)
+	{
+		std::string msg = Format("Not found animation > anime=%s", animeName.c_str());
+		SS_ASSERT2(handle >= 0, msg.c_str());
+	}
+	play(handle, loop, startFrameNo);
+}
+
+void Player::play(AnimeHandle handle, int loop, int startFrameNo)
+{
+	SS_ASSERT2(_currentRs != NULL, "Not select data");
+
 	//アニメデータを変更した場合は変更したステータスをもどす
 	int i;
 	for (i = 0; i < PART_VISIBLE_MAX; i++)
@@ -1969,25 +3939,48 @@ void Player::play(const std::string& animeName, int loop, int startFrameNo)
 		_cellChange[i] = -1;
 	}
 
-	AnimeRef* animeRef = _currentRs->animeCache->getReference(animeName);
-	if (animeRef == NULL)
-	{
-		std::string msg = Format("Not found animation > anime=%s", animeName.c_str());
-		SS_ASSERT2(animeRef != NULL, msg.c_str());
-	}
-	_currentAnimename = animeName;
+	AnimeRef* animeRef = _currentRs->animeCache->getReference(handle);
+	SS_ASSERT2(animeRef != NULL, "Invalid animation handle");
+	_currentAnimename = animeRef->key;
 
 	play(animeRef, loop, startFrameNo);
 }
 
+AnimeHandle Player::getAnimeHandle(const std::string& animeName)
+{
+	SS_ASSERT2(_currentRs != NULL, "Not select data");
+
+	return _currentRs->animeCache->indexOf(animeName.c_str(), animeName.size());
+}
+
+AnimeHandle Player::getAnimeHandle(const std::string& ssaeName, const std::string& motionName)
+{
+	SS_ASSERT2(_currentRs != NULL, "Not select data");
+
+	return _currentRs->animeCache->indexOf(ssaeName.c_str(), ssaeName.size(), motionName.c_str(), motionName.size());
+}
+
 void Player::play(AnimeRef* animeRef, int loop, int startFrameNo)
 {
 	if (_currentAnimeRef != animeRef)
 	{
+		//再生していたアニメーションのパーツはプールへ戻して再利用する
+		if ((_currentAnimeRef) && (_parts.size() > 0))
+		{
+			releaseInstancePlayers();
+			PartsPool::getInstance()->putParts(_currentAnimeRef, _parts);
+		}
 		_currentAnimeRef = animeRef;
 		
 		allocParts(animeRef->animePackData->numParts, false);
 		setPartsParentage();
+
+		//パーツのマトリクスはプレイヤーが保持するので、全パーツを計算し直す
+		_partMatrix.assign(animeRef->partHierarchy->getBlockNum() * PART_MATRIX_BLOCK_SIZE, 0.0f);
+		for (int i = 0; i < (int)_parts.size(); i++)
+		{
+			_parts.at(i)->_isStateChanged = true;
+		}
 	}
 	_playingFrame = static_cast<float>(startFrameNo);
 	_step = 1.0f;
@@ -1996,6 +3989,7 @@ void Player::play(AnimeRef* animeRef, int loop, int startFrameNo)
 	_isPlaying = true;
 	_isPausing = false;
 	_prevDrawFrameNo = -1;
+	_isDirty = true;
 	_isPlayFirstUserdataChack = true;
 	_animefps = _currentAnimeRef->animationData->fps;
 	setStartFrame(-1);
@@ -2009,33 +4003,48 @@ void Player::play(AnimeRef* animeRef, int loop, int startFrameNo)
 //モーションブレンドしつつ再生
 void Player::motionBlendPlay(const std::string& animeName, int loop, int startFrameNo, float blendTime)
 {
-	if (_currentAnimename != "")
+	SS_ASSERT2(_currentRs != NULL, "Not select data");
+
+	AnimeHandle handle = _currentRs->animeCache->indexOf(animeName.c_str(), animeName.size());
+	if (handle < 0)
 	{
-		//現在のアニメーションをブレンド用プレイヤーで再生
-		if (_motionBlendPlayer == NULL)
-		{
-			_motionBlendPlayer = ss::Player::create(_resman);
-		}
-		int loopnum = _loop;
+		std::string msg = Format("Not found animation > anime=%s", animeName.c_str());
+		SS_ASSERT2(handle >= 0, msg.c_str());
+	}
+	motionBlendPlay(handle, loop, startFrameNo, blendTime);
+}
+
+void Player::motionBlendPlay(AnimeHandle handle, int loop, int startFrameNo, float blendTime)
+{
+	if ((_currentAnimename != "") && (_currentAnimeRef))
+	{
+		//現在のアニメーションを遷移元として登録する
+		//遷移元はプレイヤーを作成せずにフレームのみを進める
+		int numParts = _currentAnimeRef->animePackData->numParts;
+		MotionBlendSource source;
+		source.animeRef = _currentAnimeRef;
+		source.frame = (float)getFrameNo();
+		source.step = _step;
+		source.loop = _loop;
 		if (_loop > 0)
 		{
-			loopnum = _loop - _loopCount;
+			source.loop = _loop - _loopCount;
 		}
-		_motionBlendPlayer->setData(_currentdataKey);        // ssbpファイル名（拡張子不要）
-		_motionBlendPlayer->play(_currentAnimename, loopnum, getFrameNo());
-		_motionBlendPlayer->setStep(_step);
+		source.loopCount = 0;
+		source.isPlaying = true;
 		if (_loop > 0)
 		{
 			if (_loop == _loopCount)	//アニメは最後まで終了している
 			{
-				_motionBlendPlayer->animePause();
+				source.isPlaying = false;
 			}
 		}
-		_blendTime = 0;
-		_blendTimeMax = blendTime;
-
+		source.blendTime = 0;
+		source.blendTimeMax = blendTime;
+		source.weights.assign(_blendPartWeight, _blendPartWeight + numParts);
+		_blendSources.push_back(source);
 	}
-	play(animeName, loop, startFrameNo);
+	play(handle, loop, startFrameNo);
 
 }
 
@@ -2067,15 +4076,15 @@ const std::string& Player::getPlayAnimeName() const
 }
 
 
-void Player::update(float dt)
+bool Player::update(float dt)
 {
-	updateFrame(dt);
+	return updateFrame(dt);
 }
 
-void Player::updateFrame(float dt)
+bool Player::updateFrame(float dt)
 {
-	if (!_currentAnimeRef) return;
-	if (!_currentRs->data) return;
+	if (!_currentAnimeRef) return false;
+	if (!_currentRs->data) return false;
 
 	int startFrame = _currentAnimeRef->animationData->startFrames;
 	int endFrame = _currentAnimeRef->animationData->endFrames;
@@ -2143,6 +4152,7 @@ void Player::updateFrame(float dt)
 					
 					incFrameNo = startFrame;
 					_seedOffset++;	//シードオフセットを加算
+					_isDirty = true;
 				}
 				currentFrameNo = incFrameNo;
 
@@ -2173,6 +4183,7 @@ void Player::updateFrame(float dt)
 				
 					decFrameNo = numFrames;
 					_seedOffset++;	//シードオフセットを加算
+					_isDirty = true;
 				}
 				currentFrameNo = decFrameNo;
 				
@@ -2192,20 +4203,12 @@ void Player::updateFrame(float dt)
 		checkUserData(getFrameNo());
 	}
 	//モーションブレンド用アップデート
-	if (_motionBlendPlayer)
+	if (_blendSources.empty() == false)
 	{
-		_motionBlendPlayer->update(dt);
-		_blendTime = _blendTime + dt;
-		if (_blendTime >= _blendTimeMax)
-		{
-			_blendTime = _blendTimeMax;
-			//プレイヤーを削除する
-			delete (_motionBlendPlayer);
-			_motionBlendPlayer = NULL;
-		}
+		updateMotionBlend(dt);
 	}
 
-	setFrame(getFrameNo(), dt);
+	bool updated = setFrame(getFrameNo(), dt);
 	
 	if (playEnd)
 	{
@@ -2217,6 +4220,7 @@ void Player::updateFrame(float dt)
 			_playEndCallback(this);
 		}
 	}
+	return updated;
 }
 
 
@@ -2233,6 +4237,13 @@ void Player::allocParts(int numParts, bool useCustomShaderProgram)
 	}
 
 	_parts.clear();	//すべてのパーツを消す
+
+	//同じアニメーション用に作成したパーツ配列がプールにある場合は再利用する
+	//パーツの状態はsetPartsParentageで初期化する
+	if (PartsPool::getInstance()->getParts(_currentAnimeRef, _parts))
+	{
+		return;
+	}
 	{
 		// パーツ数だけCustomSpriteを作成する
 //		// create CustomSprite objects.
@@ -2252,23 +4263,10 @@ void Player::releaseParts()
 {
 	// パーツの子CustomSpriteを全て削除
 	// remove children CCSprite objects.
-	if (_currentRs)
+	// プールに保持したプレイヤーはデータの解放時に破棄されるため、ここではデータを参照しない
+	for (auto&& i : _parts)
 	{
-		if (_currentAnimeRef)
-		{
-
-			ToPointer ptr(_currentRs->data);
-			const AnimePackData* packData = _currentAnimeRef->animePackData;
-			const PartData* parts = static_cast<const PartData*>(ptr(packData->parts));
-			if (_parts.size() > 0)
-			{
-				for (int partIndex = 0; partIndex < packData->numParts; partIndex++)
-				{
-					CustomSprite* sprite = static_cast<CustomSprite*>(_parts.at(partIndex));
-					SS_SAFE_DELETE(sprite->_ssplayer);
-				}
-			}
-		}
+		SS_SAFE_DELETE(i->_ssplayer);
 	}
 
 	for (auto&& i : _parts)
@@ -2294,6 +4292,14 @@ void Player::setPartsParentage()
 		
 		sprite->_partData = *partData;
 
+		//プールから再利用したパーツは再生前の状態に戻す
+		sprite->_parentPlayer = this;
+		sprite->_playercontrol = _playercontrol;
+		sprite->_liveFrame = 0.0f;
+		sprite->effectAttrInitialized = false;
+		sprite->effectTimeTotal = 0;
+		sprite->initState();
+
 		if (partIndex > 0)
 		{
 			CustomSprite* parent = static_cast<CustomSprite*>(_parts.at(partData->parentIndex));
@@ -2313,10 +4319,26 @@ void Player::setPartsParentage()
 		if (refanimeName != "")
 		{
 			//インスタンスパーツが設定されている
-			sprite->_ssplayer = ss::Player::create(_resman);
+			//同じアニメーションを再生していたプレイヤーがプールにある場合は再利用する
+			AnimeHandle refHandle = _currentRs->animeCache->indexOf(refanimeName.c_str(), refanimeName.size());
+			Player* player = NULL;
+			if (refHandle >= 0)
+			{
+				player = PartsPool::getInstance()->getPlayer(_currentRs->animeCache->getReference(refHandle));
+			}
+			bool reuse = (player != NULL);
+			if (reuse == false)
+			{
+				player = ss::Player::create(_resman);
+			}
+			sprite->_ssplayer = player;
 			sprite->_ssplayer->_playercontrol = this->_playercontrol;
 			sprite->_ssplayer->setMaskFuncFlag(false);
 			sprite->_ssplayer->setMaskParentSetting(partData->maskInfluence);
+			if (reuse)
+			{
+				sprite->_ssplayer->recycle();
+			}
 
 			sprite->_ssplayer->setData(_currentdataKey);
 			sprite->_ssplayer->play(refanimeName);				 // アニメーション名を指定(ssae名/アニメーション名も可能、詳しくは後述)
@@ -2324,14 +4346,16 @@ void Player::setPartsParentage()
 		}
 
 		//エフェクトパーツの生成
+		std::string refeffectName = static_cast<const char*>(ptr(partData->effectfilename));
 		if (sprite->refEffect)
 		{
-			delete sprite->refEffect;
-			sprite->refEffect = 0;
+			//プールから再利用したパーツは作成済みのエフェクトを初期化する
+			sprite->refEffect->setSeed(getRandomSeed());
+			sprite->refEffect->reload();
+			sprite->refEffect->stop();
+			sprite->refEffect->setLoop(false);
 		}
-
-		std::string refeffectName = static_cast<const char*>(ptr(partData->effectfilename));
-		if (refeffectName != "")
+		else if (refeffectName != "")
 		{
 			SsEffectModel* effectmodel = _currentRs->effectCache->getReference(refeffectName);
 			if (effectmodel)
@@ -2350,7 +4374,8 @@ void Player::setPartsParentage()
 			}
 		}
 
-		if (partData->type == PARTTYPE_MESH)
+		//プールから再利用したパーツはメッシュ情報を作成済み
+		if ((partData->type == PARTTYPE_MESH) && (sprite->_mesh_uvs == nullptr))
 		{
 			//メッシュパーツ情報の取得
 			ToPointer ptr(_currentRs->data);
@@ -2416,6 +4441,60 @@ void Player::setPartsParentage()
 	}
 }
 
+//インスタンスパーツのプレイヤーをプールへ戻す
+void Player::releaseInstancePlayers()
+{
+	for (auto&& sprite : _parts)
+	{
+		Player* player = sprite->_ssplayer;
+		if (player)
+		{
+			//入れ子のインスタンスパーツはそれぞれのアニメーションでプールする
+			player->releaseInstancePlayers();
+			if (PartsPool::getInstance()->putPlayer(player->_currentAnimeRef, player) == false)
+			{
+				delete player;
+			}
+			sprite->_ssplayer = NULL;
+		}
+	}
+}
+
+//プールから取り出したプレイヤーを生成直後の状態に戻す
+void Player::recycle()
+{
+	_blendSources.clear();
+	_frameSkipEnabled = true;
+	_col_r = 255;
+	_col_g = 255;
+	_col_b = 255;
+	_instanceOverWrite = false;
+	_instanseParam.clear();
+	_seedOffset = 0;
+	_maskEnable = true;
+	_parentMatUse = false;
+	IdentityMatrix(_parentMat);
+	_state.init();
+	_userDataCallback = nullptr;
+	_playEndCallback = nullptr;
+	_prevDrawFrameNo = -1;
+	_isDirty = true;
+	_isTimeDependent = false;
+
+	//パーツとインスタンスパーツのプレイヤーを再設定する
+	setPartsParentage();
+}
+
+void Player::setPartsPoolSize(int size)
+{
+	PartsPool::getInstance()->setMaxSize(size);
+}
+
+void Player::clearPartsPool()
+{
+	PartsPool::getInstance()->clear();
+}
+
 //再生しているアニメーションに含まれるパーツ数を取得
 int Player::getPartsCount(void)
 {
@@ -2440,16 +4519,11 @@ const char* Player::getPartName(int partId) const
 //パーツ名からindexを取得
 int Player::indexOfPart(const char* partName) const
 {
-	const AnimePackData* packData = _currentAnimeRef->animePackData;
-	for (int i = 0; i < packData->numParts; i++)
+	if (_currentAnimeRef == NULL)
 	{
-		const char* name = getPartName(i);
-		if (strcmp(partName, name) == 0)
-		{
-			return i;
-		}
+		return -1;
 	}
-	return -1;
+	return _currentAnimeRef->partNameIndex->find(partName);
 }
 
 /*
@@ -2460,9 +4534,14 @@ int Player::indexOfPart(const char* partName) const
  描画を行う前にupdateを呼び出し、パーツステータスを表示に状態に戻してからdrawしてください。
 */
 bool Player::getPartState(ResluteState& result, const char* name, int frameNo)
+{
+	return getPartState(result, indexOfPart(name), frameNo);
+}
+
+bool Player::getPartState(ResluteState& result, int partIndex, int frameNo)
 {
 	bool rc = false;
-	if (_currentAnimeRef)
+	if ((_currentAnimeRef) && (partIndex >= 0) && (partIndex < _currentAnimeRef->animePackData->numParts))
 	{
 		{
 			//カレントフレームのパーツステータスを取得する
@@ -2484,13 +4563,8 @@ bool Player::getPartState(ResluteState& result, const char* name, int frameNo)
 			const AnimePackData* packData = _currentAnimeRef->animePackData;
 			const PartData* parts = static_cast<const PartData*>(ptr(packData->parts));
 
-			for (int index = 0; index < packData->numParts; index++)
 			{
-				int partIndex = _partIndex[index];
-
 				const PartData* partData = &parts[partIndex];
-				const char* partName = static_cast<const char*>(ptr(partData->name));
-				if (strcmp(partName, name) == 0)
 				{
 					//必要に応じて取得するパラメータを追加してください。
 					//当たり判定などのパーツに付属するフラグを取得する場合は　partData　のメンバを参照してください。
@@ -2572,286 +4646,751 @@ bool Player::getPartState(ResluteState& result, const char* name, int frameNo)
 					}
 
 					rc = true;
-					break;
 				}
 			}
-			//パーツステータスを表示するフレームの内容で更新
-			if (frameNo != getFrameNo())
+			//パーツステータスを表示するフレームの内容で更新
+			if (frameNo != getFrameNo())
+			{
+				//取得する再生フレームのデータが違う場合プレイヤーの状態をもとに戻す
+				//パーツステータスの更新
+				setFrame(getFrameNo());
+			}
+		}
+	}
+	return rc;
+}
+
+
+//ラベル名からラベルの設定されているフレームを取得
+//ラベルが存在しない場合は戻り値が-1となります。
+//ラベル名が全角でついていると取得に失敗します。
+int Player::getLabelToFrame(char* findLabelName)
+{
+	//文字列を作らずにテーブルを検索する
+	return getLabelToFrame(findLabelName, strlen(findLabelName));
+}
+
+int Player::getLabelToFrame(const std::string& findLabelName)
+{
+	return getLabelToFrame(findLabelName.c_str(), findLabelName.size());
+}
+
+int Player::getLabelToFrame(const char* findLabelName, size_t len)
+{
+	if (_currentAnimeRef == NULL)
+	{
+		return -1;
+	}
+	//ラベルはデータ読み込み時にテーブル化されている
+	int idx = _currentAnimeRef->labelIndex.find(findLabelName, len);
+	if (idx < 0)
+	{
+		return -1;
+	}
+	return (_currentAnimeRef->labels[idx].frameNo);
+}
+
+//再生しているアニメーションのラベル一覧をフレーム順で取得
+const std::vector<LabelData>& Player::getLabelList() const
+{
+	static const std::vector<LabelData> s_emptyLabel;
+	if (_currentAnimeRef == NULL)
+	{
+		return s_emptyLabel;
+	}
+	return _currentAnimeRef->labels;
+}
+
+//指定フレーム以前で一番近いラベルを取得
+const LabelData* Player::getLabelAtOrBefore(int frameNo) const
+{
+	if (_currentAnimeRef == NULL)
+	{
+		return NULL;
+	}
+	const std::vector<LabelData>& labels = _currentAnimeRef->labels;
+
+	//frameNoより後ろにある最初のラベルを二分探索し、その一つ前を返す
+	int lo = 0;
+	int hi = (int)labels.size();
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (labels[mid].frameNo <= frameNo)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	if (lo == 0)
+	{
+		return NULL;
+	}
+	return &labels[lo - 1];
+}
+
+//特定パーツの表示、非表示を設定します
+//パーツ番号はスプライトスタジオのフレームコントロールに配置されたパーツが
+//プライオリティでソートされた後、上に配置された順にソートされて決定されます。
+void Player::setPartVisible(std::string partsname, bool flg)
+{
+	setPartVisible(indexOfPart(partsname.c_str()), flg);
+}
+
+void Player::setPartVisible(int partIndex, bool flg)
+{
+	if ((_currentAnimeRef) && (partIndex >= 0) && (partIndex < _currentAnimeRef->animePackData->numParts))
+	{
+		if (_partVisible[partIndex] != flg)
+		{
+			_partVisible[partIndex] = flg;
+			_isDirty = true;
+		}
+	}
+}
+
+//モーションブレンドを行う際のパーツ毎のブレンドの重みを設定します
+void Player::setMotionBlendPartWeight(std::string partsname, float weight)
+{
+	setMotionBlendPartWeight(indexOfPart(partsname.c_str()), weight);
+}
+
+void Player::setMotionBlendPartWeight(int partIndex, float weight)
+{
+	if ((partIndex >= 0) && (partIndex < PART_VISIBLE_MAX))
+	{
+		if (weight < 0.0f)
+		{
+			weight = 0.0f;
+		}
+		if (weight > 1.0f)
+		{
+			weight = 1.0f;
+		}
+		_blendPartWeight[partIndex] = weight;
+	}
+}
+
+void Player::clearMotionBlendPartWeight(void)
+{
+	for (int i = 0; i < PART_VISIBLE_MAX; i++)
+	{
+		_blendPartWeight[i] = 1.0f;
+	}
+}
+
+//パーツに割り当たるセルを変更します
+void Player::setPartCell(std::string partsname, std::string sscename, std::string cellname)
+{
+	setPartCell(indexOfPart(partsname.c_str()), sscename, cellname);
+}
+
+void Player::setPartCell(int partIndex, const std::string& sscename, const std::string& cellname)
+{
+	if ((_currentAnimeRef) && (partIndex >= 0) && (partIndex < _currentAnimeRef->animePackData->numParts))
+	{
+		ToPointer ptr(_currentRs->data);
+
+		int changeCellIndex = -1;
+		if ((sscename != "") && (cellname != ""))
+		{
+			//セルマップIDを取得する
+			const Cell* cells = static_cast<const Cell*>(ptr(_currentRs->data->cells));
+
+			//名前からインデックスの取得
+			for (int i = 0; i < _currentRs->data->numCells; i++)
+			{
+				const Cell* cell = &cells[i];
+				const char* name1 = static_cast<const char*>(ptr(cell->name));
+				const CellMap* cellMap = static_cast<const CellMap*>(ptr(cell->cellMap));
+				const char* name2 = static_cast<const char*>(ptr(cellMap->name));
+				if (strcmp(cellname.c_str(), name1) == 0)
+				{
+					if (strcmp(sscename.c_str(), name2) == 0)
+					{
+						changeCellIndex = i;
+						break;
+					}
+				}
+			}
+		}
+
+		//セル番号を設定
+		if (_cellChange[partIndex] != changeCellIndex)
+		{
+			_cellChange[partIndex] = changeCellIndex;	//上書き解除
+			_isDirty = true;
+		}
+	}
+}
+
+// インスタンスパーツが再生するアニメを変更します。
+bool Player::changeInstanceAnime(std::string partsname, std::string animename, bool overWrite, Instance keyParam)
+{
+	//名前からパーツを取得
+	return changeInstanceAnime(indexOfPart(partsname.c_str()), animename, overWrite, keyParam);
+}
+
+bool Player::changeInstanceAnime(int partIndex, const std::string& animename, bool overWrite, Instance keyParam)
+{
+	bool rc = false;
+	if ((_currentAnimeRef) && (partIndex >= 0) && (partIndex < _currentAnimeRef->animePackData->numParts))
+	{
+		CustomSprite* sprite = static_cast<CustomSprite*>(_parts.at(partIndex));
+		if (sprite->_ssplayer)
+		{
+			//パーツがインスタンスパーツの場合は再生するアニメを設定する
+			//アニメが入れ子にならないようにチェックする
+			if (_currentAnimename != animename)
 			{
-				//取得する再生フレームのデータが違う場合プレイヤーの状態をもとに戻す
-				//パーツステータスの更新
-				setFrame(getFrameNo());
+				sprite->_ssplayer->play(animename);
+				sprite->_ssplayer->setInstanceParam(overWrite, keyParam);	//インスタンスパラメータの設定
+				sprite->_ssplayer->animeResume();		//アニメ切り替え時にがたつく問題の対応
+				sprite->_liveFrame = 0;					//独立動作の場合再生位置をリセット
+				_isDirty = true;						//インスタンスパラメータが変わるので再計算する
+				rc = true;
 			}
 		}
 	}
-	return rc;
+
+	return (rc);
+}
+//インスタンスパラメータを設定します
+void Player::setInstanceParam(bool overWrite, Instance keyParam)
+{
+	_instanceOverWrite = overWrite;		//インスタンス情報を上書きするか？
+	_instanseParam = keyParam;			//インスタンスパラメータ
+	_isDirty = true;
+}
+//インスタンスパラメータを取得します
+void Player::getInstanceParam(bool *overWrite, Instance *keyParam)
+{
+	*overWrite = _instanceOverWrite;		//インスタンス情報を上書きするか？
+	*keyParam = _instanseParam;			//インスタンスパラメータ
 }
 
+//アニメーションの色成分を変更します
+void Player::setColor(int r, int g, int b)
+{
+	if ((_col_r != r) || (_col_g != g) || (_col_b != b))
+	{
+		_col_r = r;
+		_col_g = g;
+		_col_b = b;
+		_isDirty = true;
+	}
+}
 
-//ラベル名からラベルの設定されているフレームを取得
-//ラベルが存在しない場合は戻り値が-1となります。
-//ラベル名が全角でついていると取得に失敗します。
-int Player::getLabelToFrame(char* findLabelName)
+//アニメーションのループ範囲を設定します
+void Player::setStartFrame(int frame)
 {
-	int rc = -1;
+	_startFrameOverWrite = frame;	//開始フレームの上書き設定
+	//現在フレームより後の場合は先頭フレームに設定する
+	if (getFrameNo() < frame)
+	{
+		setFrameNo(frame);
+	}
+}
+void Player::setEndFrame(int frame)
+{
+	_endFrameOverWrite = frame;		//終了フレームの上書き設定
+}
+//アニメーションのループ範囲をラベル名で設定します
+void Player::setStartFrameToLabelName(char *findLabelName)
+{
+	int frame = getLabelToFrame(findLabelName);
+	setStartFrame(frame);
+}
+void Player::setEndFrameToLabelName(char *findLabelName)
+{
+	int frame = getLabelToFrame(findLabelName);
+	if (frame != -1)
+	{
+		frame += 1;
+	}
+	setEndFrame(frame);
+}
 
-	ToPointer ptr(_currentRs->data);
-	const AnimationData* animeData = _currentAnimeRef->animationData;
+//スプライト情報の取得
+CustomSprite* Player::getSpriteData(int partIndex)
+{
+	CustomSprite* sprite = NULL;
+	if ((int)_parts.size() < partIndex)
+	{
+	}
+	else
+	{
+		sprite = static_cast<CustomSprite*>(_parts.at(partIndex));
+	}
+	return(sprite);
+}
 
-	if (!animeData->labelData) return -1;
-	const ss_offset* labelDataIndex = static_cast<const ss_offset*>(ptr(animeData->labelData));
+/*
+* 表示を行うパーツ数を取得します
+*/
+int Player::getDrawSpriteCount(void)
+{
+	return (_draw_count);
+}
 
+void Player::setParentMatrix(float* mat, bool use )
+{
+	memcpy(_parentMat, mat, sizeof(float) * 16);	//
+	_parentMatUse = use;					//プレイヤーが持つ継承されたマトリクスがあるか？
 
-	int idx = 0;
-	for (idx = 0; idx < animeData->labelNum; idx++ )
+	if (_parentMatUse == true)
 	{
-		if (!labelDataIndex[idx]) return -1;
-		const ss_u16* labelDataArray = static_cast<const ss_u16*>(ptr(labelDataIndex[idx]));
+		//プレイヤーが持つ継承されたマトリクスがある場合はこの時点でステータスを更新しておく
+		memcpy(_state.mat, _parentMat, sizeof(float) * 16);
+	}
+
+}
 
-		DataArrayReader reader(labelDataArray);
+//アニメーションの更新を行わずにプレイヤーのマトリクスのみを更新する
+void Player::updateParentMatrix(float* mat)
+{
+	setParentMatrix(mat, true);
+	updateInstanceParentMatrix();
+}
 
-		LabelData ldata;
-		ss_offset offset = reader.readOffset();
-		const char* str = static_cast<const char*>(ptr(offset));
-		int labelFrame = reader.readU16();
-		ldata.str = str;
-		ldata.frameNo = labelFrame;
+//インスタンスパーツのプレイヤーへマトリクスを反映する
+void Player::updateInstanceParentMatrix()
+{
+	if (!_currentAnimeRef) return;
 
-		if (ldata.str.compare(findLabelName) == 0 )
+	for (int partIndex = 1; partIndex < _currentAnimeRef->animePackData->numParts; partIndex++)
+	{
+		CustomSprite* sprite = static_cast<CustomSprite*>(_parts.at(partIndex));
+		if (sprite->_ssplayer)
 		{
-			//同じ名前のラベルが見つかった
-			return (ldata.frameNo);
+			float t[16];
+			IdentityMatrix(t);
+			MultiplyMatrix(sprite->_state.mat, _state.mat, t);
+			sprite->_ssplayer->updateParentMatrix(t);
 		}
 	}
+}
 
-	return (rc);
+/*
+* マトリクスに 移動 x X回転 x Y回転 x Z回転 x スケール を適用する（回転はアトリビュートの値）
+* 計算はMultiplyTRSMatrixで行う
+*/
+static void multiplyTRSMatrix(float* mat, float x, float y, float rotationX, float rotationY, float rotationZ, float scaleX, float scaleY)
+{
+	MultiplyTRSMatrix(mat, x, y, SSRadianToDegree(rotationX), SSRadianToDegree(rotationY), SSRadianToDegree(rotationZ), scaleX, scaleY);
 }
 
-//特定パーツの表示、非表示を設定します
-//パーツ番号はスプライトスタジオのフレームコントロールに配置されたパーツが
-//プライオリティでソートされた後、上に配置された順にソートされて決定されます。
-void Player::setPartVisible(std::string partsname, bool flg)
+//ローカルスケール対応
+static void getLocalScale(const State& state, float& lsx, float& lsy)
 {
-	if (_currentAnimeRef)
+	lsx = 1.0f;
+	lsy = 1.0f;
+	if ((state.flags & PART_FLAG_LOCALSCALE_X) || (state.flags & PART_FLAG_LOCALSCALE_Y))
 	{
-		ToPointer ptr(_currentRs->data);
+		lsx = state.localscaleX;
+		lsy = state.localscaleY;
+	}
+}
 
-		const AnimePackData* packData = _currentAnimeRef->animePackData;
-		const PartData* parts = static_cast<const PartData*>(ptr(packData->parts));
+//パーツのマトリクス（継承マトリクス、ローカルマトリクス）を親子関係の深さ順に計算する
+//マトリクスはPartHierarchyのブロック順のSoA（_partMatrix）に保持し、同じ深さの4パーツをまとめて計算する
+//X、Y回転を使用しているパーツはブロックの計算の後に4x4のマトリクスで計算し直す
+void Player::updatePartMatrix()
+{
+	ToPointer ptr(_currentRs->data);
+	const PartData* parts = static_cast<const PartData*>(ptr(_currentAnimeRef->animePackData->parts));
+	const PartHierarchy* hierarchy = _currentAnimeRef->partHierarchy;
 
-		for (int index = 0; index < packData->numParts; index++)
-		{
-			int partIndex = _partIndex[index];
+	float identity[16];
+	IdentityMatrix(identity);
 
-			const PartData* partData = &parts[partIndex];
-			const char* partName = static_cast<const char*>(ptr(partData->name));
-			if (strcmp(partName, partsname.c_str()) == 0)
+	TRSMatrixBatch batch;
+	float parentMat[16];
+	for (int block = 0; block < hierarchy->getBlockNum(); block++)
+	{
+		const int* slotPart = &hierarchy->slotPart[block * PART_MATRIX_LANE];
+
+		//ブロック内に変更されたパーツがない場合は計算しない
+		bool changed = false;
+		for (int lane = 0; lane < PART_MATRIX_LANE; lane++)
+		{
+			if ((slotPart[lane] >= 0) && (_parts.at(slotPart[lane])->_isStateChanged))
 			{
-				_partVisible[partIndex] = flg;
+				changed = true;
 				break;
 			}
 		}
-	}
-}
-
-//パーツに割り当たるセルを変更します
-void Player::setPartCell(std::string partsname, std::string sscename, std::string cellname)
-{
-	if (_currentAnimeRef)
-	{
-		ToPointer ptr(_currentRs->data);
+		if (!changed)
+		{
+			continue;
+		}
 
-		int changeCellIndex = -1;
-		if ((sscename != "") && (cellname != ""))
+		//親は前の深さのブロックにあるので計算済み
+		bool rotationXY = false;
+		for (int lane = 0; lane < PART_MATRIX_LANE; lane++)
 		{
-			//セルマップIDを取得する
-			const Cell* cells = static_cast<const Cell*>(ptr(_currentRs->data->cells));
+			int partIndex = slotPart[lane];
+			if (partIndex < 0)
+			{
+				//空きのレーン
+				SetTRSMatrixBatch(batch, lane, identity, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f);
+				continue;
+			}
 
-			//名前からインデックスの取得
-			for (int i = 0; i < _currentRs->data->numCells; i++)
+			const State& state = _parts.at(partIndex)->_state;
+			const float* parent = identity;
+			if (partIndex > 0)
 			{
-				const Cell* cell = &cells[i];
-				const char* name1 = static_cast<const char*>(ptr(cell->name));
-				const CellMap* cellMap = static_cast<const CellMap*>(ptr(cell->cellMap));
-				const char* name2 = static_cast<const char*>(ptr(cellMap->name));
-				if (strcmp(cellname.c_str(), name1) == 0)
+				getPartMatrix(_partMatrix, hierarchy, parts[partIndex].parentIndex, parentMat, NULL);
+				parent = parentMat;
+			}
+
+			float lsx;
+			float lsy;
+			getLocalScale(state, lsx, lsy);
+			SetTRSMatrixBatch(batch, lane, parent, state.x, state.y, SSRadianToDegree(state.rotationZ), state.scaleX, state.scaleY, state.scaleX * lsx, state.scaleY * lsy);
+			if ((state.rotationX != 0.0f) || (state.rotationY != 0.0f))
+			{
+				rotationXY = true;
+			}
+		}
+
+		float* dst = &_partMatrix[block * PART_MATRIX_BLOCK_SIZE];
+		MultiplyTRSMatrixBatch(batch, dst, dst + PART_MATRIX_LOCAL);
+
+		if (rotationXY)
+		{
+			for (int lane = 0; lane < PART_MATRIX_LANE; lane++)
+			{
+				int partIndex = slotPart[lane];
+				if (partIndex < 0)
 				{
-					if (strcmp(sscename.c_str(), name2) == 0)
-					{
-						changeCellIndex = i;
-						break;
-					}
+					continue;
+				}
+				const State& state = _parts.at(partIndex)->_state;
+				if ((state.rotationX == 0.0f) && (state.rotationY == 0.0f))
+				{
+					continue;
 				}
+				float lsx;
+				float lsy;
+				getLocalScale(state, lsx, lsy);
+				float mat[16];
+				float localmat[16];
+				for (int e = 0; e < 16; e++)
+				{
+					mat[e] = batch.parent[e * PART_MATRIX_LANE + lane];
+				}
+				memcpy(localmat, mat, sizeof(float) * 16);
+				multiplyTRSMatrix(mat, state.x, state.y, state.rotationX, state.rotationY, state.rotationZ, state.scaleX, state.scaleY);
+				multiplyTRSMatrix(localmat, state.x, state.y, state.rotationX, state.rotationY, state.rotationZ, state.scaleX * lsx, state.scaleY * lsy);
+				setPartMatrix(_partMatrix, hierarchy, partIndex, mat, localmat);
 			}
 		}
+	}
+}
 
-		const AnimePackData* packData = _currentAnimeRef->animePackData;
-		const PartData* parts = static_cast<const PartData*>(ptr(packData->parts));
+//指定したアニメーション、フレームのパーツの状態をプレイヤーの状態を変更せずに計算する
+bool Player::evaluatePose(std::vector<PartPose>& pose, const std::string& animeName, int frameNo, const float* mat) const
+{
+	if (_currentRs == NULL)
+	{
+		return false;
+	}
+	AnimeHandle handle = _currentRs->animeCache->indexOf(animeName.c_str(), animeName.size());
+	return evaluatePose(pose, handle, frameNo, mat);
+}
 
-		for (int index = 0; index < packData->numParts; index++)
+bool Player::evaluatePose(std::vector<PartPose>& pose, AnimeHandle handle, int frameNo, const float* mat) const
+{
+	if ((_currentRs == NULL) || (_currentRs->data == NULL) || (handle < 0))
+	{
+		return false;
+	}
+	const AnimeRef* animeRef = _currentRs->animeCache->getReference(handle);
+	if (animeRef == NULL)
+	{
+		return false;
+	}
+	const AnimationData* animeData = animeRef->animationData;
+	if ((frameNo < 0) || (frameNo >= animeData->totalFrames))
+	{
+		return false;
+	}
+
+	ToPointer ptr(_currentRs->data);
+	const AnimePackData* packData = animeRef->animePackData;
+	const PartData* parts = static_cast<const PartData*>(ptr(packData->parts));
+	int numParts = packData->numParts;
+	pose.resize(numParts);
+
+	//ベイク済みのフレームはデコード済みのテーブルから取得する
+	const AnimeBakeData* bake = animeRef->bake;
+	if (bake && !bake->hasFrame(frameNo))
+	{
+		bake = NULL;
+	}
+	const ss_offset* frameDataIndex = static_cast<const ss_offset*>(ptr(animeData->frameData));
+	const ss_u16* frameDataArray = bake ? NULL : static_cast<const ss_u16*>(ptr(frameDataIndex[frameNo]));
+	DataArrayReader reader(frameDataArray);
+
+	//マトリクスの計算は親子関係の深さ順に行うため、デコードしたステータスをパーツ番号順に保存する
+	PartFrameData pf;
+	for (int index = 0; index < numParts; index++)
+	{
+		if (bake)
+		{
+			bake->get(frameNo, index, pf);
+		}
+		else
+		{
+			animeRef->decoder.decode(reader, pf);
+		}
+		int partIndex = pf.partIndex;
+		const PartData* partData = &parts[partIndex];
+		PartPose& partPose = pose[partIndex];
+
+		partPose.x = pf.x;
+		partPose.y = pf.y;
+		partPose.rotationX = pf.rotationX;
+		partPose.rotationY = pf.rotationY;
+		partPose.rotationZ = pf.rotationZ;
+		if (_direction == PLUS_DOWN)	//Y座標反転
+		{
+			partPose.y = -partPose.y;
+			partPose.rotationX = -partPose.rotationX;
+			partPose.rotationY = -partPose.rotationY;
+			partPose.rotationZ = -partPose.rotationZ;
+		}
+		partPose.scaleX = pf.scaleX;
+		partPose.scaleY = pf.scaleY;
+
+		//ローカルスケール対応
+		partPose.localscaleX = 1.0f;
+		partPose.localscaleY = 1.0f;
+		if ((pf.flags & PART_FLAG_LOCALSCALE_X) || (pf.flags & PART_FLAG_LOCALSCALE_Y))
 		{
-			int partIndex = _partIndex[index];
+			partPose.localscaleX = pf.localscaleX;
+			partPose.localscaleY = pf.localscaleY;
+		}
 
-			const PartData* partData = &parts[partIndex];
-			const char* partName = static_cast<const char*>(ptr(partData->name));
-			if (strcmp(partName, partsname.c_str()) == 0)
+		bool isVisibled = !(pf.flags & PART_FLAG_INVISIBLE);
+		if (pf.scaleX == 0 || pf.scaleY == 0 || pf.localscaleX == 0 || pf.localscaleY == 0) isVisibled = false;
+		CellRef* cellRef = pf.cellIndex >= 0 ? _currentRs->cellCache->getReference(pf.cellIndex) : nullptr;
+		if (cellRef == NULL)
+		{
+			//セルが無く通常パーツ、マスク、NULLパーツの時は非表示にする
+			if ((partData->type == PARTTYPE_NORMAL) || (partData->type == PARTTYPE_MASK) || (partData->type == PARTTYPE_NULL))
 			{
-				//セル番号を設定
-				_cellChange[partIndex] = changeCellIndex;	//上書き解除
-				break;
+				isVisibled = false;
 			}
 		}
+
+		partPose.opacity = pf.opacity;
+		if (partIndex > 0)
+		{
+			//ルートパーツのアルファ値を反映させる
+			partPose.opacity = (pf.opacity * _state.opacity) / 255;
+		}
+		partPose.cellIndex = pf.cellIndex;
+		partPose.boundingRadius = pf.boundingRadius;
+		partPose.isVisibled = isVisibled;
+	}
+
+	//パーツのマトリクスを作成する
+	const float* playerMat = mat ? mat : _state.mat;
+	float identity[16];
+	IdentityMatrix(identity);
+	const PartHierarchy* hierarchy = animeRef->partHierarchy;
+	for (int i = 0; i < (int)hierarchy->order.size(); i++)
+	{
+		int partIndex = hierarchy->order[i];
+		PartPose& partPose = pose[partIndex];
+
+		const float* parentMat = (partIndex > 0) ? pose[parts[partIndex].parentIndex].mat : identity;
+		memcpy(partPose.mat, parentMat, sizeof(float) * 16);
+		multiplyTRSMatrix(partPose.mat, partPose.x, partPose.y, partPose.rotationX, partPose.rotationY, partPose.rotationZ,
+			partPose.scaleX, partPose.scaleY);
+		memcpy(partPose.localMat, parentMat, sizeof(float) * 16);
+		multiplyTRSMatrix(partPose.localMat, partPose.x, partPose.y, partPose.rotationX, partPose.rotationY, partPose.rotationZ,
+			partPose.scaleX * partPose.localscaleX, partPose.scaleY * partPose.localscaleY);
+
+		//プレイヤーのマトリクスを適用する
+		IdentityMatrix(partPose.worldMat);
+		MultiplyMatrix(partPose.localMat, playerMat, partPose.worldMat);
 	}
+	return true;
 }
 
-// インスタンスパーツが再生するアニメを変更します。
-bool Player::changeInstanceAnime(std::string partsname, std::string animename, bool overWrite, Instance keyParam)
+//当たり判定が設定された全パーツの形状を取得する
+int Player::getHitShapes(std::vector<HitShape>& shapes, bool append) const
 {
-	//名前からパーツを取得
-	bool rc = false;
-	if (_currentAnimeRef)
+	if (append == false)
 	{
-		ToPointer ptr(_currentRs->data);
+		shapes.clear();
+	}
+	if ((_currentRs == NULL) || (_currentAnimeRef == NULL))
+	{
+		return 0;
+	}
 
-		const AnimePackData* packData = _currentAnimeRef->animePackData;
-		const PartData* parts = static_cast<const PartData*>(ptr(packData->parts));
+	ToPointer ptr(_currentRs->data);
+	const AnimePackData* packData = _currentAnimeRef->animePackData;
+	const PartData* parts = static_cast<const PartData*>(ptr(packData->parts));
+	int numParts = std::min((int)packData->numParts, (int)_parts.size());
 
-		for (int index = 0; index < packData->numParts; index++)
+	int count = 0;
+	for (int partIndex = 0; partIndex < numParts; partIndex++)
+	{
+		int boundsType = parts[partIndex].boundsType;
+		if ((boundsType <= SsBoundsType::none) || (boundsType >= SsBoundsType::num))
+		{
+			continue;
+		}
+		const CustomSprite* sprite = _parts[partIndex];
+		const State& state = sprite->_state;
+
+		//パーツのマトリクスにプレイヤーのマトリクスを適用してワールド座標系に変換する
+		float m[16];
+		MultiplyMatrix(state.mat, _state.mat, m);
+
+		shapes.push_back(HitShape());
+		HitShape& shape = shapes.back();
+		shape.player = const_cast<Player*>(this);
+		shape.playerIndex = 0;
+		shape.partIndex = partIndex;
+		shape.boundsType = boundsType;
+		shape.isVisibled = state.isVisibled;
+
+		if ((boundsType == SsBoundsType::quad) || (boundsType == SsBoundsType::aabb))
+		{
+			//描画と同じく原点補正を行った頂点を変換する
+			float cx = state.size_X * -state.pivotX;
+			float cy = state.size_Y * -state.pivotY;
+			const SSV3F_C4B_T2F* v[4] = { &state.quad.tl, &state.quad.tr, &state.quad.bl, &state.quad.br };
+			for (int i = 0; i < 4; i++)
+			{
+				float vx = v[i]->vertices.x + cx;
+				float vy = v[i]->vertices.y + cy;
+				shape.quad[i * 2 + 0] = vx * m[0] + vy * m[4] + m[12];
+				shape.quad[i * 2 + 1] = vx * m[1] + vy * m[5] + m[13];
+			}
+			shape.minX = shape.maxX = shape.quad[0];
+			shape.minY = shape.maxY = shape.quad[1];
+			for (int i = 1; i < 4; i++)
+			{
+				shape.minX = std::min(shape.minX, shape.quad[i * 2 + 0]);
+				shape.maxX = std::max(shape.maxX, shape.quad[i * 2 + 0]);
+				shape.minY = std::min(shape.minY, shape.quad[i * 2 + 1]);
+				shape.maxY = std::max(shape.maxY, shape.quad[i * 2 + 1]);
+			}
+			shape.x = (shape.minX + shape.maxX) * 0.5f;
+			shape.y = (shape.minY + shape.maxY) * 0.5f;
+			float hw = (shape.maxX - shape.minX) * 0.5f;
+			float hh = (shape.maxY - shape.minY) * 0.5f;
+			shape.radius = sqrtf(hw * hw + hh * hh);
+		}
+		else
 		{
-			int partIndex = _partIndex[index];
-
-			const PartData* partData = &parts[partIndex];
-			const char* partName = static_cast<const char*>(ptr(partData->name));
-			if (strcmp(partName, partsname.c_str()) == 0)
+			float radius = state.boundingRadius;
+			if (boundsType != SsBoundsType::circle)
 			{
-				CustomSprite* sprite = static_cast<CustomSprite*>(_parts.at(partIndex));
-				if (sprite->_ssplayer)
-				{
-					//パーツがインスタンスパーツの場合は再生するアニメを設定する
-					//アニメが入れ子にならないようにチェックする
-					if (_currentAnimename != animename)
-					{
-						sprite->_ssplayer->play(animename);
-						sprite->_ssplayer->setInstanceParam(overWrite, keyParam);	//インスタンスパラメータの設定
-						sprite->_ssplayer->animeResume();		//アニメ切り替え時にがたつく問題の対応
-						sprite->_liveFrame = 0;					//独立動作の場合再生位置をリセット
-						rc = true;
-					}
-				}
-
-				break;
+				//マトリクスの軸の長さからスケールを求める
+				float sx = sqrtf(m[0] * m[0] + m[1] * m[1]);
+				float sy = sqrtf(m[4] * m[4] + m[5] * m[5]);
+				radius *= (boundsType == SsBoundsType::circle_smin) ? std::min(sx, sy) : std::max(sx, sy);
 			}
+			shape.x = m[12];
+			shape.y = m[13];
+			shape.radius = radius;
+			shape.minX = shape.x - radius;
+			shape.minY = shape.y - radius;
+			shape.maxX = shape.x + radius;
+			shape.maxY = shape.y + radius;
+			memset(shape.quad, 0, sizeof(shape.quad));
 		}
+		count++;
 	}
-
-	return (rc);
-}
-//インスタンスパラメータを設定します
-void Player::setInstanceParam(bool overWrite, Instance keyParam)
-{
-	_instanceOverWrite = overWrite;		//インスタンス情報を上書きするか？
-	_instanseParam = keyParam;			//インスタンスパラメータ
-
-}
-//インスタンスパラメータを取得します
-void Player::getInstanceParam(bool *overWrite, Instance *keyParam)
-{
-	*overWrite = _instanceOverWrite;		//インスタンス情報を上書きするか？
-	*keyParam = _instanseParam;			//インスタンスパラメータ
-}
-
-//アニメーションの色成分を変更します
-void Player::setColor(int r, int g, int b)
-{
-	_col_r = r;
-	_col_g = g;
-	_col_b = b;
+	return count;
 }
 
-//アニメーションのループ範囲を設定します
-void Player::setStartFrame(int frame)
+//複数のプレイヤーの当たり判定の形状をまとめて取得する
+int Player::getHitShapes(std::vector<HitShape>& shapes, Player* const* players, int count)
 {
-	_startFrameOverWrite = frame;	//開始フレームの上書き設定
-	//現在フレームより後の場合は先頭フレームに設定する
-	if (getFrameNo() < frame)
+	shapes.clear();
+	for (int i = 0; i < count; i++)
 	{
-		setFrameNo(frame);
+		if (players[i] == NULL)
+		{
+			continue;
+		}
+		size_t start = shapes.size();
+		players[i]->getHitShapes(shapes, true);
+		for (size_t j = start; j < shapes.size(); j++)
+		{
+			shapes[j].playerIndex = i;
+		}
 	}
+	return (int)shapes.size();
 }
-void Player::setEndFrame(int frame)
-{
-	_endFrameOverWrite = frame;		//終了フレームの上書き設定
-}
-//アニメーションのループ範囲をラベル名で設定します
-void Player::setStartFrameToLabelName(char *findLabelName)
+
+//ポーズキャッシュの最大数を設定する
+void Player::setPoseCacheSize(int size)
 {
-	int frame = getLabelToFrame(findLabelName);
-	setStartFrame(frame);
+	PoseCache::getInstance()->setMaxSize(size);
 }
-void Player::setEndFrameToLabelName(char *findLabelName)
+
+//ポーズキャッシュを破棄する
+void Player::clearPoseCache()
 {
-	int frame = getLabelToFrame(findLabelName);
-	if (frame != -1)
-	{
-		frame += 1;
-	}
-	setEndFrame(frame);
+	PoseCache::getInstance()->clear();
 }
 
-//スプライト情報の取得
-CustomSprite* Player::getSpriteData(int partIndex)
+//現在の再生状態でポーズキャッシュを使用できるか
+bool Player::isPoseCacheUsable() const
 {
-	CustomSprite* sprite = NULL;
-	if ((int)_parts.size() < partIndex)
+	if (!PoseCache::getInstance()->isEnable())
 	{
+		return false;
 	}
-	else
+	//インスタンスパーツの再生状態、モーションブレンドはプレイヤー毎に異なるため対象外
+	if (_currentAnimeRef->hasInstancePart || (_blendSources.empty() == false))
 	{
-		sprite = static_cast<CustomSprite*>(_parts.at(partIndex));
+		return false;
 	}
-	return(sprite);
-}
-
-/*
-* 表示を行うパーツ数を取得します
-*/
-int Player::getDrawSpriteCount(void)
-{
-	return (_draw_count);
-}
-
-void Player::setParentMatrix(float* mat, bool use )
-{
-	memcpy(_parentMat, mat, sizeof(float) * 16);	//
-	_parentMatUse = use;					//プレイヤーが持つ継承されたマトリクスがあるか？
-
-	if (_parentMatUse == true)
+	//パーツの表示、セルが上書きされている
+	for (int partIndex = 0; partIndex < _currentAnimeRef->animePackData->numParts; partIndex++)
 	{
-		//プレイヤーが持つ継承されたマトリクスがある場合はこの時点でステータスを更新しておく
-		memcpy(_state.mat, _parentMat, sizeof(float) * 16);
+		if ((_partVisible[partIndex] == false) || (_cellChange[partIndex] != -1))
+		{
+			return false;
+		}
 	}
-
+	return true;
 }
 
-void Player::setFrame(int frameNo, float dt)
+bool Player::setFrame(int frameNo, float dt)
 {
-	if (!_currentAnimeRef) return;
-	if (!_currentRs->data) return;
+	if (!_currentAnimeRef) return false;
+	if (!_currentRs->data) return false;
 
-	bool forceUpdate = false;
+	// 前回の描画フレームと同じときはスキップ
+	// パラメータの変更（フリップはsetFlipで_isDirtyを設定する）や経過時間で変化するパーツ（独立動作のインスタンス、エフェクト）がある場合は更新する
+	if ((_isDirty == false) && (frameNo == _prevDrawFrameNo)
+	 && ((_isTimeDependent == false) || (dt == 0.0f)) && (_blendSources.empty())
+	 && (_cellRevision == _currentRs->cellCache->getRevision()))
 	{
-		// フリップに変化があったときは必ず描画を更新する
-		CustomSprite* root = static_cast<CustomSprite*>(_parts.at(0));
-		float scaleX = root->isFlippedX() ? -1.0f : 1.0f;
-		float scaleY = root->isFlippedY() ? -1.0f : 1.0f;
-		root->setStateValue(root->_state.x, scaleX);
-		root->setStateValue(root->_state.y, scaleY);
-		forceUpdate = root->_isStateChanged;
+		//インスタンスパーツのプレイヤーには親のマトリクスの変更のみ反映する
+		if ((_currentAnimeRef->hasInstancePart) && (_parentMatUse))
+		{
+			updateInstanceParentMatrix();
+		}
+		return false;
 	}
-	
-	// 前回の描画フレームと同じときはスキップ
-	//インスタンスアニメがあるので毎フレーム更新するためコメントに変更
-	//	if (!forceUpdate && frameNo == _prevDrawFrameNo) return;
+	bool timeDependent = false;
 
 	_maskIndexList.clear();
 
@@ -2863,76 +5402,127 @@ void Player::setFrame(int frameNo, float dt)
 	const AnimationData* animeData = _currentAnimeRef->animationData;
 	const ss_offset* frameDataIndex = static_cast<const ss_offset*>(ptr(animeData->frameData));
 	
-	const ss_u16* frameDataArray = static_cast<const ss_u16*>(ptr(frameDataIndex[frameNo]));
+	//ベイク済みのフレームはデコード済みのテーブルから取得する
+	const AnimeBakeData* bake = _currentAnimeRef->bake;
+	if (bake && !bake->hasFrame(frameNo))
+	{
+		bake = NULL;
+	}
+	const ss_u16* frameDataArray = bake ? NULL : static_cast<const ss_u16*>(ptr(frameDataIndex[frameNo]));
 	DataArrayReader reader(frameDataArray);
-	
-	const AnimationInitialData* initialDataList = static_cast<const AnimationInitialData*>(ptr(animeData->defaultData));
 
+	//ポーズキャッシュに同じフレームがある場合はデコードと親子関係の計算を行わない
+	bool usePoseCache = isPoseCacheUsable();
+	PoseKey poseKey = { _currentAnimeRef, frameNo, _direction, (_col_r << 16) | (_col_g << 8) | _col_b };
+	const Pose* pose = usePoseCache ? PoseCache::getInstance()->find(poseKey) : NULL;
+	if (pose)
+	{
+		for (int index = 0; index < packData->numParts; index++)
+		{
+			int partIndex = pose->partIndex[index];
+			const PosePart& posePart = pose->parts[partIndex];
+			CustomSprite* sprite = static_cast<CustomSprite*>(_parts.at(partIndex));
+			_partIndex[index] = partIndex;
+
+			sprite->setFlippedX(posePart.state.flipX);
+			sprite->setFlippedY(posePart.state.flipY);
+			sprite->setOpacity(posePart.state.opacity);
+			sprite->_state = posePart.state;
+			sprite->_orgState = sprite->_state;
+			setPartMatrix(_partMatrix, _currentAnimeRef->partHierarchy, partIndex, posePart.mat, posePart.localmat);
+			if (!posePart.meshVertices.empty())
+			{
+				//メッシュの頂点はこのプレイヤーの座標バッファを参照させる
+				memcpy(sprite->_mesh_vertices, &posePart.meshVertices[0], sizeof(float) * posePart.meshVertices.size());
+				sprite->_state.meshVertices = sprite->_mesh_vertices;
+			}
+			if (partIndex > 0)
+			{
+				//ルートパーツのアルファ値はプレイヤー毎に反映させる
+				sprite->_state.Calc_opacity = (sprite->_state.opacity * _state.opacity) / 255;
+			}
+			sprite->_isStateChanged = false;
+
+			if (sprite->_partData.type == PARTTYPE_MASK)
+			{
+				_maskIndexList.push_back(sprite);
+			}
+		}
+	}
+
+	//モーションブレンドの遷移元のステータスを取得する
+	if (_blendSources.empty() == false)
+	{
+		sampleMotionBlend();
+	}
 
 	State state;
+	PartFrameData pf;
 
-	for (int index = 0; index < packData->numParts; index++)
+	int numDecodeParts = pose ? 0 : packData->numParts;
+	for (int index = 0; index < numDecodeParts; index++)
 	{
-		int partIndex = reader.readS16();
+		if (bake)
+		{
+			bake->get(frameNo, index, pf);
+		}
+		else
+		{
+			_currentAnimeRef->decoder.decode(reader, pf);
+		}
+		int partIndex = pf.partIndex;
 		const PartData* partData = &parts[partIndex];
-		const AnimationInitialData* init = &initialDataList[partIndex];
 
 		// optional parameters
-		int flags				= reader.readU32();
-		int flags2				= reader.readU32();
-		int cellIndex			= flags & PART_FLAG_CELL_INDEX ? reader.readS16() : init->cellIndex;
-		float x					= flags & PART_FLAG_POSITION_X ? reader.readFloat() : init->positionX;
-		float y					= flags & PART_FLAG_POSITION_Y ? reader.readFloat() : init->positionY;
+		int flags				= pf.flags;
+		int flags2				= pf.flags2;
+		int cellIndex			= pf.cellIndex;
+		float x					= pf.x;
+		float y					= pf.y;
+		float z					= pf.z;
+		float pivotX			= pf.pivotX;
+		float pivotY			= pf.pivotY;
+		float rotationX			= pf.rotationX;
+		float rotationY			= pf.rotationY;
+		float rotationZ			= pf.rotationZ;
 		if (_direction == PLUS_DOWN)	//Y座標反転
 		{
 			y = -y;
-		}
-		float z					= flags & PART_FLAG_POSITION_Z ? reader.readFloat() : init->positionZ;
-		float pivotX			= flags & PART_FLAG_PIVOT_X ? reader.readFloat() : init->pivotX;
-		float pivotY			= flags & PART_FLAG_PIVOT_Y ? reader.readFloat() : init->pivotY;
-		if (_direction == PLUS_DOWN)	//Y座標反転
-		{
 			pivotY = -pivotY;
-		}
-		float rotationX			= flags & PART_FLAG_ROTATIONX ? reader.readFloat() : init->rotationX;
-		float rotationY			= flags & PART_FLAG_ROTATIONY ? reader.readFloat() : init->rotationY;
-		float rotationZ			= flags & PART_FLAG_ROTATIONZ ? reader.readFloat() : init->rotationZ;
-		if (_direction == PLUS_DOWN)	//Y座標反転
-		{
 			rotationX = -rotationX;
 			rotationY = -rotationY;
 			rotationZ = -rotationZ;
 		}
-		float scaleX			= flags & PART_FLAG_SCALE_X ? reader.readFloat() : init->scaleX;
-		float scaleY			= flags & PART_FLAG_SCALE_Y ? reader.readFloat() : init->scaleY;
-
-		float localscaleX		= flags & PART_FLAG_LOCALSCALE_X ? reader.readFloat() : init->localscaleX;
-		float localscaleY		= flags & PART_FLAG_LOCALSCALE_Y ? reader.readFloat() : init->localscaleY;
-		int opacity				= flags & PART_FLAG_OPACITY ? reader.readU16() : init->opacity;
-		int localopacity		= flags & PART_FLAG_LOCALOPACITY ? reader.readU16() : init->localopacity;
-		float size_X			= flags & PART_FLAG_SIZE_X ? reader.readFloat() : init->size_X;
-		float size_Y			= flags & PART_FLAG_SIZE_Y ? reader.readFloat() : init->size_Y;
-		float uv_move_X			= flags & PART_FLAG_U_MOVE ? reader.readFloat() : init->uv_move_X;
-		float uv_move_Y			= flags & PART_FLAG_V_MOVE ? reader.readFloat() : init->uv_move_Y;
-		float uv_rotation		= flags & PART_FLAG_UV_ROTATION ? reader.readFloat() : init->uv_rotation;
-		float uv_scale_X		= flags & PART_FLAG_U_SCALE ? reader.readFloat() : init->uv_scale_X;
-		float uv_scale_Y		= flags & PART_FLAG_V_SCALE ? reader.readFloat() : init->uv_scale_Y;
-		float boundingRadius	= flags & PART_FLAG_BOUNDINGRADIUS ? reader.readFloat() : init->boundingRadius;
-		float masklimen			= flags & PART_FLAG_MASK ? reader.readU16() : init->masklimen;
-		float priority			= flags & PART_FLAG_PRIORITY ? reader.readU16() : init->priority;
+		float scaleX			= pf.scaleX;
+		float scaleY			= pf.scaleY;
+
+		float localscaleX		= pf.localscaleX;
+		float localscaleY		= pf.localscaleY;
+		int opacity				= pf.opacity;
+		int localopacity		= pf.localopacity;
+		float size_X			= pf.size_X;
+		float size_Y			= pf.size_Y;
+		float uv_move_X			= pf.uv_move_X;
+		float uv_move_Y			= pf.uv_move_Y;
+		float uv_rotation		= pf.uv_rotation;
+		float uv_scale_X		= pf.uv_scale_X;
+		float uv_scale_Y		= pf.uv_scale_Y;
+		float boundingRadius	= pf.boundingRadius;
+		float masklimen			= pf.masklimen;
+		float priority			= pf.priority;
 
 		//インスタンスアトリビュート
-		int		instanceValue_curKeyframe	= flags & PART_FLAG_INSTANCE_KEYFRAME ? reader.readS32() : init->instanceValue_curKeyframe;
-		int		instanceValue_startFrame	= flags & PART_FLAG_INSTANCE_KEYFRAME ? reader.readS32() : init->instanceValue_startFrame;
-		int		instanceValue_endFrame		= flags & PART_FLAG_INSTANCE_KEYFRAME ? reader.readS32() : init->instanceValue_endFrame;
-		int		instanceValue_loopNum		= flags & PART_FLAG_INSTANCE_KEYFRAME ? reader.readS32() : init->instanceValue_loopNum;
-		float	instanceValue_speed			= flags & PART_FLAG_INSTANCE_KEYFRAME ? reader.readFloat() : init->instanceValue_speed;
-		int		instanceValue_loopflag		= flags & PART_FLAG_INSTANCE_KEYFRAME ? reader.readS32() : init->instanceValue_loopflag;
+		int		instanceValue_curKeyframe	= pf.instanceValue_curKeyframe;
+		int		instanceValue_startFrame	= pf.instanceValue_startFrame;
+		int		instanceValue_endFrame		= pf.instanceValue_endFrame;
+		int		instanceValue_loopNum		= pf.instanceValue_loopNum;
+		float	instanceValue_speed			= pf.instanceValue_speed;
+		int		instanceValue_loopflag		= pf.instanceValue_loopflag;
 		//エフェクトアトリビュート
-		int		effectValue_curKeyframe		= flags & PART_FLAG_EFFECT_KEYFRAME ? reader.readS32() : init->effectValue_curKeyframe;
-		int		effectValue_startTime		= flags & PART_FLAG_EFFECT_KEYFRAME ? reader.readS32() : init->effectValue_startTime;
-		float	effectValue_speed			= flags & PART_FLAG_EFFECT_KEYFRAME ? reader.readFloat() : init->effectValue_speed;
-		int		effectValue_loopflag		= flags & PART_FLAG_EFFECT_KEYFRAME ? reader.readS32() : init->effectValue_loopflag;
+		int		effectValue_curKeyframe		= pf.effectValue_curKeyframe;
+		int		effectValue_startTime		= pf.effectValue_startTime;
+		float	effectValue_speed			= pf.effectValue_speed;
+		int		effectValue_loopflag		= pf.effectValue_loopflag;
 
 
 		bool flipX = (bool)(flags & PART_FLAG_FLIP_H);
@@ -2992,21 +5582,17 @@ void Player::setFrame(int frameNo, float dt)
 		}
 
 		//モーションブレンド
-		if (_motionBlendPlayer)
-		{
-			CustomSprite* blendSprite = _motionBlendPlayer->getSpriteData(partIndex);
-			if (blendSprite)
-			{ 
-				float percent = _blendTime / _blendTimeMax;
-				x = parcentVal(x, blendSprite->_orgState.x, percent);
-				y = parcentVal(y, blendSprite->_orgState.y, percent);
-				scaleX = parcentVal(scaleX, blendSprite->_orgState.scaleX, percent);
-				scaleY = parcentVal(scaleY, blendSprite->_orgState.scaleY, percent);
-				rotationX = parcentValRot(rotationX, blendSprite->_orgState.rotationX, percent);
-				rotationY = parcentValRot(rotationY, blendSprite->_orgState.rotationY, percent);
-				rotationZ = parcentValRot(rotationZ, blendSprite->_orgState.rotationZ, percent);
-			}
-
+		if (_blendSources.empty() == false)
+		{
+			MotionBlendPart value = { x, y, scaleX, scaleY, rotationX, rotationY, rotationZ };
+			blendMotion(partIndex, value);
+			x = value.x;
+			y = value.y;
+			scaleX = value.scaleX;
+			scaleY = value.scaleY;
+			rotationX = value.rotationX;
+			rotationY = value.rotationY;
+			rotationZ = value.rotationZ;
 		}
 
 		//ステータス保存
@@ -3178,26 +5764,26 @@ void Player::setFrame(int frameNo, float dt)
 		// 頂点変形のオフセット値を反映
 		if (flags & PART_FLAG_VERTEX_TRANSFORM)
 		{
-			int vt_flags = reader.readU16();
+			int vt_flags = pf.vertexFlags;
 			if (vt_flags & VERTEX_FLAG_LT)
 			{
-				quad.tl.vertices.x += reader.readFloat();
-				quad.tl.vertices.y += reader.readFloat();
+				quad.tl.vertices.x += pf.vertexOffset[0];
+				quad.tl.vertices.y += pf.vertexOffset[1];
 			}
 			if (vt_flags & VERTEX_FLAG_RT)
 			{
-				quad.tr.vertices.x += reader.readFloat();
-				quad.tr.vertices.y += reader.readFloat();
+				quad.tr.vertices.x += pf.vertexOffset[2];
+				quad.tr.vertices.y += pf.vertexOffset[3];
 			}
 			if (vt_flags & VERTEX_FLAG_LB)
 			{
-				quad.bl.vertices.x += reader.readFloat();
-				quad.bl.vertices.y += reader.readFloat();
+				quad.bl.vertices.x += pf.vertexOffset[4];
+				quad.bl.vertices.y += pf.vertexOffset[5];
 			}
 			if (vt_flags & VERTEX_FLAG_RB)
 			{
-				quad.br.vertices.x += reader.readFloat();
-				quad.br.vertices.y += reader.readFloat();
+				quad.br.vertices.x += pf.vertexOffset[6];
+				quad.br.vertices.y += pf.vertexOffset[7];
 			}
 		}
 		
@@ -3217,7 +5803,7 @@ void Player::setFrame(int frameNo, float dt)
 		// パーツカラーの反映
 		if (flags & PART_FLAG_PARTS_COLOR)
 		{
-			int typeAndFlags = reader.readU16();
+			int typeAndFlags = pf.partsColorTypeAndFlags;
 			int funcNo = typeAndFlags & 0xff;
 			int cb_flags = (typeAndFlags >> 8) & 0xff;
 			float blend_rate = 1.0f;
@@ -3227,8 +5813,8 @@ void Player::setFrame(int frameNo, float dt)
 
 			if (cb_flags & VERTEX_FLAG_ONE)
 			{
-				blend_rate = reader.readFloat();
-				reader.readColor(color4);
+				blend_rate = pf.partsColorRate[0];
+				color4 = pf.partsColor[0];
 
 
 				color4.r = color4.r * _col_r / 255;
@@ -3252,32 +5838,32 @@ void Player::setFrame(int frameNo, float dt)
 			{
 				if (cb_flags & VERTEX_FLAG_LT)
 				{
-					blend_rate = reader.readFloat();
-					reader.readColor(color4);
+					blend_rate = pf.partsColorRate[0];
+					color4 = pf.partsColor[0];
 					quad.tl.colors = color4;
 
 					state.rate.vartTLRate = blend_rate;
 				}
 				if (cb_flags & VERTEX_FLAG_RT)
 				{
-					blend_rate = reader.readFloat();
-					reader.readColor(color4);
+					blend_rate = pf.partsColorRate[1];
+					color4 = pf.partsColor[1];
 					quad.tr.colors = color4;
 
 					state.rate.vartTRRate = blend_rate;
 				}
 				if (cb_flags & VERTEX_FLAG_LB)
 				{
-					blend_rate = reader.readFloat();
-					reader.readColor(color4);
+					blend_rate = pf.partsColorRate[2];
+					color4 = pf.partsColor[2];
 					quad.bl.colors = color4;
 
 					state.rate.vartBLRate = blend_rate;
 				}
 				if (cb_flags & VERTEX_FLAG_RB)
 				{
-					blend_rate = reader.readFloat();
-					reader.readColor(color4);
+					blend_rate = pf.partsColorRate[3];
+					color4 = pf.partsColor[3];
 					quad.br.colors = color4;
 
 					state.rate.vartBRRate = blend_rate;
@@ -3286,21 +5872,23 @@ void Player::setFrame(int frameNo, float dt)
 		}
 
 		//メッシュ情報
+		state.meshVertices = NULL;
+		state.meshVertexSize = 0;
 		if (flags2 & PART_FLAG_MESHDATA)
 		{
+			DataArrayReader meshReader(pf.meshData);
 			int i;
 			for (i = 0; i < sprite->_meshVertexSize; i++)
 			{
-				float mesh_x = reader.readFloat();
-				float mesh_y = reader.readFloat();
-				float mesh_z = reader.readFloat();
-				SsVector3 point(mesh_x, mesh_y, mesh_z);
-				state.meshVertexPoint.push_back(point);
-
+				float mesh_x = meshReader.readFloat();
+				float mesh_y = meshReader.readFloat();
+				float mesh_z = meshReader.readFloat();
 				sprite->_mesh_vertices[3 * i + 0] = mesh_x;					// 座標バッファ
 				sprite->_mesh_vertices[3 * i + 1] = mesh_y;					// 座標バッファ
 				sprite->_mesh_vertices[3 * i + 2] = mesh_z;					// 座標バッファ
 			}
+			state.meshVertices = sprite->_mesh_vertices;
+			state.meshVertexSize = sprite->_meshVertexSize;
 		}
 
 		//UVアトリビュート処理
@@ -3434,6 +6022,7 @@ void Player::setFrame(int frameNo, float dt)
 			//独立動作の場合
 			if (independent)
 			{
+				timeDependent = true;
 				float delta = dt / (1.0f / _animefps);						//	独立動作時は親アニメのfpsを使用する
 //				float delta = fdt / (1.0f / sprite->_ssplayer->_animefps);
 
@@ -3546,18 +6135,6 @@ void Player::setFrame(int frameNo, float dt)
 	{
 		IdentityMatrix(mat);
 
-		TranslationMatrix(t, _state.x, _state.y, 0.0f);
-		MultiplyMatrix(t, mat, mat);
-
-		Matrix4RotationX(t, SSRadianToDegree(_state.rotationX));
-		MultiplyMatrix(t, mat, mat);
-
-		Matrix4RotationY(t, SSRadianToDegree(_state.rotationY));
-		MultiplyMatrix(t, mat, mat);
-
-		Matrix4RotationZ(t, SSRadianToDegree(_state.rotationZ));
-		MultiplyMatrix(t, mat, mat);
-
 		float scale_x = _state.scaleX;
 		float scale_y = _state.scaleY;
 		if (_state.flipX == true)
@@ -3568,12 +6145,14 @@ void Player::setFrame(int frameNo, float dt)
 		{
 			scale_y = -scale_y;	//フラグ反転
 		}
-		ScaleMatrix(t, scale_x, scale_y, 1.0f);
-		MultiplyMatrix(t, mat, mat);
+		multiplyTRSMatrix(mat, _state.x, _state.y, _state.rotationX, _state.rotationY, _state.rotationZ, scale_x, scale_y);
 
 		memcpy(_state.mat, mat, sizeof(float) * 16);	//プレイヤーのマトリクスを作成する
 	}
 
+	//パーツのマトリクスを作成する
+	updatePartMatrix();
+
 	for (int partIndex = 0; partIndex < packData->numParts; partIndex++)
 	{
 		const PartData* partData = &parts[partIndex];
@@ -3582,24 +6161,8 @@ void Player::setFrame(int frameNo, float dt)
 		if (sprite->_isStateChanged)
 		{
 			{
-				int num = 1;
-				if ((sprite->_state.flags & PART_FLAG_LOCALSCALE_X) || (sprite->_state.flags & PART_FLAG_LOCALSCALE_Y))
+				if (partIndex == 0)
 				{
-					//ローカルスケール対応
-					num = 2;
-				}
-				int matcnt;
-				for (matcnt = 0; matcnt < num; matcnt++)
-				{
-					if (partIndex > 0)
-					{
-						//親のマトリクスを適用
-						CustomSprite* parent = static_cast<CustomSprite*>(_parts.at(partData->parentIndex));
-						memcpy(mat, parent->_mat, sizeof(float) * 16);
-					}
-					else
-					{
-						IdentityMatrix(mat);
 /*
 						sprite->_state.x += _state.x;
 						sprite->_state.y += _state.y;
@@ -3618,53 +6181,15 @@ void Player::setFrame(int frameNo, float dt)
 							sprite->_state.scaleY = -sprite->_state.scaleY;	//フラグ反転
 						}
 */
-						sprite->_state.Calc_rotationX = sprite->_state.rotationX;
-						sprite->_state.Calc_rotationY = sprite->_state.rotationY;
-						sprite->_state.Calc_rotationZ = sprite->_state.rotationZ;
-
-						sprite->_state.Calc_scaleX = sprite->_state.scaleX;
-						sprite->_state.Calc_scaleY = sprite->_state.scaleY;
-					}
-					TranslationMatrix(t, sprite->_state.x, sprite->_state.y, 0.0f);
-					MultiplyMatrix(t, mat, mat);
-
-					Matrix4RotationX(t, SSRadianToDegree(sprite->_state.rotationX));
-					MultiplyMatrix(t, mat, mat);
-
-					Matrix4RotationY(t, SSRadianToDegree(sprite->_state.rotationY));
-					MultiplyMatrix(t, mat, mat);
-
-					Matrix4RotationZ(t, SSRadianToDegree(sprite->_state.rotationZ));
-					MultiplyMatrix(t, mat, mat);
-
-					float sx = sprite->_state.scaleX;
-					float sy = sprite->_state.scaleY;
-					if (matcnt > 0)
-					{
-						//ローカルスケールを適用する
-						sx *= sprite->_state.localscaleX;
-						sy *= sprite->_state.localscaleY;
-					}
-					ScaleMatrix(t, sx, sy, 1.0f);
-					MultiplyMatrix(t, mat, mat);
-
-					if (matcnt > 0)
-					{
-						memcpy(sprite->_localmat, mat, sizeof(float) * 16);	//ローカルマトリクスを作成する
-					}
-					else
-					{
-						memcpy(sprite->_mat, mat, sizeof(float) * 16);		//継承マトリクスを作成する
-					}
-				}
+					sprite->_state.Calc_rotationX = sprite->_state.rotationX;
+					sprite->_state.Calc_rotationY = sprite->_state.rotationY;
+					sprite->_state.Calc_rotationZ = sprite->_state.rotationZ;
 
-				if (num == 1)
-				{
-					//ローカルスケールが使用されていない場合は継承マトリクスをローカルマトリクスに適用
-					memcpy(sprite->_localmat, mat, sizeof(float) * 16);
+					sprite->_state.Calc_scaleX = sprite->_state.scaleX;
+					sprite->_state.Calc_scaleY = sprite->_state.scaleY;
 				}
 
-				memcpy(sprite->_state.mat, sprite->_localmat, sizeof(float) * 16);	//表示にはローカルマトリクスを適用する
+				getPartMatrix(_partMatrix, _currentAnimeRef->partHierarchy, partIndex, NULL, sprite->_state.mat);	//表示にはローカルマトリクスを適用する
 
 				if (partIndex > 0)
 				{
@@ -3706,6 +6231,28 @@ void Player::setFrame(int frameNo, float dt)
 		}
 	}
 
+	//ポーズキャッシュへ登録する
+	if (usePoseCache && (pose == NULL))
+	{
+		Pose* newPose = PoseCache::getInstance()->add(poseKey);
+		if (newPose)
+		{
+			newPose->partIndex.assign(_partIndex, _partIndex + packData->numParts);
+			newPose->parts.resize(packData->numParts);
+			for (int partIndex = 0; partIndex < packData->numParts; partIndex++)
+			{
+				CustomSprite* sprite = static_cast<CustomSprite*>(_parts.at(partIndex));
+				PosePart& posePart = newPose->parts[partIndex];
+				posePart.state = sprite->_state;
+				getPartMatrix(_partMatrix, _currentAnimeRef->partHierarchy, partIndex, posePart.mat, posePart.localmat);
+				if (sprite->_state.flags2 & PART_FLAG_MESHDATA)
+				{
+					posePart.meshVertices.assign(sprite->_mesh_vertices, sprite->_mesh_vertices + 3 * sprite->_meshVertexSize);
+				}
+			}
+		}
+	}
+
 	// 特殊パーツのアップデート
 	for (int partIndex = 0; partIndex < packData->numParts; partIndex++)
 	{
@@ -3718,6 +6265,10 @@ void Player::setFrame(int frameNo, float dt)
 		{
 			sprite->_ssplayer->setMaskFunctionUse(_maskEnable);	//マスクの有無を設定する
 			sprite->_ssplayer->update(dt);
+			if (sprite->_ssplayer->_isTimeDependent)
+			{
+				timeDependent = true;
+			}
 		}
 		//エフェクトのアップデート
 		if (sprite->refEffect)
@@ -3749,6 +6300,7 @@ void Player::setFrame(int frameNo, float dt)
 				if (independent)
 				{
 					//独立動作
+					timeDependent = true;
 					if (sprite->effectAttrInitialized)
 					{
 						float delta = dt / (1.0f / _animefps);						//	独立動作時は親アニメのfpsを使用する
@@ -3783,6 +6335,10 @@ void Player::setFrame(int frameNo, float dt)
 		}
 	}
 	_prevDrawFrameNo = frameNo;	//再生したフレームを保存
+	_isDirty = false;
+	_isTimeDependent = timeDependent;
+	_cellRevision = _currentRs->cellCache->getRevision();
+	return true;
 }
 
 //プレイヤーの描画
@@ -3805,9 +6361,13 @@ void Player::draw()
 	const AnimePackData* packData = _currentAnimeRef->animePackData;
 
 
+	//影響を受けないマスクの番号がステンシルに収まらない場合は、マスク毎にステンシルをクリアして残りのマスクを描画しなおす
+	bool maskRedraw = false;
+	int mask_index = 0;
 	if (_maskFuncFlag == true) //マスク機能が有効（インスタンスのソースアニメではない）
 	{
 		//初期に適用されているマスクを精製
+		int replaceCount = 0;
 		for (size_t i = 0; i < _maskIndexList.size(); i++)
 		{
 			CustomSprite* sprite = _maskIndexList[i];
@@ -3817,11 +6377,14 @@ void Player::draw()
 				//ステンシルバッファの作成
 				SSDrawSprite(sprite);
 				_draw_count++;
+				if (!(sprite->_maskInfluence))
+				{
+					replaceCount++;
+				}
 			}
 		}
+		maskRedraw = (replaceCount > SSMASK_REPLACE_MAX);
 	}
-	int mask_index = 0;
-
 	for (int index = 0; index < packData->numParts; index++)
 	{
 
@@ -3838,7 +6401,7 @@ void Player::draw()
 			//マスクはパーツの描画より先に奥のマスクパーツから順にマスクを作成していく必要があるため
 			//通常パーツの描画順と同じ箇所で非表示によるスキップを行うとマスクのバッファがクリアされずに、
 			//マスクが手前の優先度に影響するようになってしまう。
-			if ((_maskFuncFlag == true) && (getMaskFunctionUse() == true)) //マスク機能が有効（インスタンスのソースアニメではない）
+			if ((_maskFuncFlag == true) && (getMaskFunctionUse() == true) && (maskRedraw == true))
 			{
 				clearMask();
 				mask_index++;	//0番は処理しないので先にインクメントする
@@ -3853,6 +6416,16 @@ void Player::draw()
 					}
 				}
 			}
+			else if ((_maskFuncFlag == true) && (getMaskFunctionUse() == true)) //マスク機能が有効（インスタンスのソースアニメではない）
+			{
+				//奥のパーツの描画が終わったマスクをステンシルから取り除く
+				//手前のマスクは描画済みなので描画しなおさない
+				if (sprite->_state.isVisibled == true)
+				{
+					removeMask(sprite);
+					_draw_count++;
+				}
+			}
 		}
 		if (sprite->_state.isVisibled == true)
 		{
@@ -3980,40 +6553,250 @@ void Player::checkUserData(int frameNo)
 
 }
 
-void  Player::setPosition(float x, float y)
-{
-	_state.x = x;
-	_state.y = y;
-}
-void  Player::setRotation(float x, float y, float z)
+void  Player::setPosition(float x, float y)
+{
+	if ((_state.x != x) || (_state.y != y))
+	{
+		_state.x = x;
+		_state.y = y;
+		_isDirty = true;
+	}
+}
+void  Player::setRotation(float x, float y, float z)
+{
+	if ((_state.rotationX != x) || (_state.rotationY != y) || (_state.rotationZ != z))
+	{
+		_state.rotationX = x;
+		_state.rotationY = y;
+		_state.rotationZ = z;
+		_isDirty = true;
+	}
+}
+
+void  Player::setScale(float x, float y)
+{
+	if ((_state.scaleX != x) || (_state.scaleY != y))
+	{
+		_state.scaleX = x;
+		_state.scaleY = y;
+		_isDirty = true;
+	}
+}
+
+void  Player::setAlpha(int a)
+{
+	if (_state.opacity != a)
+	{
+		_state.opacity = a;
+		_isDirty = true;
+	}
+}
+
+void  Player::setFlip(bool flipX, bool flipY)
+{
+	if ((_state.flipX != flipX) || (_state.flipY != flipY))
+	{
+		_state.flipX = flipX;
+		_state.flipY = flipY;
+		_isDirty = true;
+	}
+}
+
+void  Player::setMaskFunctionUse(bool flg)
+{
+	if (_maskEnable != flg)
+	{
+		_maskEnable = flg;
+		_isDirty = true;
+	}
+}
+
+
+//モーションブレンドの遷移元のフレームと遷移時間を進める
+//遷移元のフレームはブレンド用のプレイヤーで再生していた場合と同じように進める
+void Player::updateMotionBlend(float dt)
+{
+	int finished = -1;
+	for (int i = 0; i < (int)_blendSources.size(); i++)
+	{
+		MotionBlendSource& source = _blendSources[i];
+		const AnimationData* animeData = source.animeRef->animationData;
+
+		if (source.isPlaying)
+		{
+			int startFrame = animeData->startFrames;
+			int endFrame = animeData->endFrames;
+			if (endFrame + 1 > animeData->totalFrames)
+			{
+				endFrame = animeData->totalFrames - 1;
+			}
+
+			float s = dt / (1.0f / animeData->fps);
+			float next = source.frame + (s * source.step);
+
+			int nextFrameNo = static_cast<int>(next);
+			float nextFrameDecimal = next - static_cast<float>(nextFrameNo);
+			int currentFrameNo = static_cast<int>(source.frame);
+
+			if (source.step >= 0)
+			{
+				for (int c = nextFrameNo - currentFrameNo; c; c--)
+				{
+					int incFrameNo = currentFrameNo + 1;
+					if (incFrameNo > endFrame)
+					{
+						source.loopCount += 1;
+						if (source.loop && source.loopCount >= source.loop)
+						{
+							source.isPlaying = false;
+							break;
+						}
+						incFrameNo = startFrame;
+					}
+					currentFrameNo = incFrameNo;
+				}
+			}
+			else
+			{
+				for (int c = currentFrameNo - nextFrameNo; c; c--)
+				{
+					int decFrameNo = currentFrameNo - 1;
+					if (decFrameNo < startFrame)
+					{
+						source.loopCount += 1;
+						if (source.loop && source.loopCount >= source.loop)
+						{
+							source.isPlaying = false;
+							break;
+						}
+						decFrameNo = endFrame;
+					}
+					currentFrameNo = decFrameNo;
+				}
+			}
+			source.frame = static_cast<float>(currentFrameNo) + nextFrameDecimal;
+		}
+
+		source.blendTime = source.blendTime + dt;
+		if (source.blendTime >= source.blendTimeMax)
+		{
+			source.blendTime = source.blendTimeMax;
+			finished = i;
+		}
+	}
+
+	//遷移が終了した場合は、それより古い遷移元も参照されなくなるので削除する
+	if (finished >= 0)
+	{
+		_blendSources.erase(_blendSources.begin(), _blendSources.begin() + finished + 1);
+		_isDirty = true;
+	}
+}
+
+//モーションブレンドの遷移元のパーツのステータスをデコードする
+void Player::sampleMotionBlend()
 {
-	_state.rotationX = x;
-	_state.rotationY = y;
-	_state.rotationZ = z;
-}
+	ToPointer ptr(_currentRs->data);
+	PartFrameData pf;
 
-void  Player::setScale(float x, float y)
-{
-	_state.scaleX = x;
-	_state.scaleY = y;
-}
+	for (int i = 0; i < (int)_blendSources.size(); i++)
+	{
+		MotionBlendSource& source = _blendSources[i];
+		const AnimeRef* animeRef = source.animeRef;
+		int numParts = animeRef->animePackData->numParts;
+		int frameNo = static_cast<int>(source.frame);
+		source.parts.resize(numParts);
+
+		//ベイク済みのフレームはデコード済みのテーブルから取得する
+		const AnimeBakeData* bake = animeRef->bake;
+		if (bake && !bake->hasFrame(frameNo))
+		{
+			bake = NULL;
+		}
+		const ss_offset* frameDataIndex = static_cast<const ss_offset*>(ptr(animeRef->animationData->frameData));
+		const ss_u16* frameDataArray = bake ? NULL : static_cast<const ss_u16*>(ptr(frameDataIndex[frameNo]));
+		DataArrayReader reader(frameDataArray);
 
-void  Player::setAlpha(int a)
-{
-	_state.opacity = a;
-}
+		for (int index = 0; index < numParts; index++)
+		{
+			if (bake)
+			{
+				bake->get(frameNo, index, pf);
+			}
+			else
+			{
+				animeRef->decoder.decodeBlend(reader, pf);
+			}
 
-void  Player::setFlip(bool flipX, bool flipY)
-{
-	_state.flipX = flipX;
-	_state.flipY = flipY;
+			MotionBlendPart& part = source.parts[pf.partIndex];
+			part.x = pf.x;
+			part.y = pf.y;
+			part.scaleX = pf.scaleX;
+			part.scaleY = pf.scaleY;
+			part.rotationX = pf.rotationX;
+			part.rotationY = pf.rotationY;
+			part.rotationZ = pf.rotationZ;
+			if (_direction == PLUS_DOWN)	//Y座標反転
+			{
+				part.y = -part.y;
+				part.rotationX = -part.rotationX;
+				part.rotationY = -part.rotationY;
+				part.rotationZ = -part.rotationZ;
+			}
+		}
+	}
 }
 
-void  Player::setMaskFunctionUse(bool flg)
+//古い遷移元から順に、次のアニメーションへ補間していく
+//最後の遷移先は再生中のアニメーション（value）になる
+void Player::blendMotion(int partIndex, MotionBlendPart& value)
 {
-	_maskEnable = flg;
-}
+	int numSources = (int)_blendSources.size();
+	MotionBlendPart result = value;
+	bool valid = false;
+	for (int i = 0; i <= numSources; i++)
+	{
+		const MotionBlendPart* part = &value;
+		if (i < numSources)
+		{
+			if (partIndex >= (int)_blendSources[i].parts.size())
+			{
+				continue;	//パーツ構成が異なるアニメーションはブレンドしない
+			}
+			part = &_blendSources[i].parts[partIndex];
+		}
+		if (valid == false)
+		{
+			result = *part;
+			valid = true;
+			continue;
+		}
 
+		//ひとつ前のアニメーションからの遷移の割合
+		const MotionBlendSource& source = _blendSources[i - 1];
+		float percent = 1.0f;
+		if (source.blendTimeMax > 0.0f)
+		{
+			percent = source.blendTime / source.blendTimeMax;
+		}
+		if (partIndex < (int)source.weights.size())
+		{
+			float weight = source.weights[partIndex];
+			if (weight < 1.0f)
+			{
+				percent = 1.0f - ((1.0f - percent) * weight);
+			}
+		}
+		result.x = parcentVal(part->x, result.x, percent);
+		result.y = parcentVal(part->y, result.y, percent);
+		result.scaleX = parcentVal(part->scaleX, result.scaleX, percent);
+		result.scaleY = parcentVal(part->scaleY, result.scaleY, percent);
+		result.rotationX = parcentValRot(part->rotationX, result.rotationX, percent);
+		result.rotationY = parcentValRot(part->rotationY, result.rotationY, percent);
+		result.rotationZ = parcentValRot(part->rotationZ, result.rotationZ, percent);
+	}
+	value = result;
+}
 
 //割合に応じた中間値を取得します
 float Player::parcentVal(float val1, float val2, float parcent)
@@ -4088,7 +6871,7 @@ void Player::setPlayEndCallback(const PlayEndCallback& callback)
 	_playEndCallback = callback;
 }
 
-State Player::getState(void)
+const State& Player::getState(void) const
 {
 	return(_state);
 }
@@ -4167,4 +6950,465 @@ bool CustomSprite::isFlippedY()
 }
 
 
+/**
+ * HitShapeGrid
+ */
+
+//当たり判定の形状の判定処理
+static bool isCircleHitShape(const HitShape& shape)
+{
+	return (shape.boundsType == SsBoundsType::circle)
+		|| (shape.boundsType == SsBoundsType::circle_smin)
+		|| (shape.boundsType == SsBoundsType::circle_smax);
+}
+
+//四辺形、矩形を外周の順（左上、右上、右下、左下）の頂点にする
+static void getHitShapePolygon(const HitShape& shape, float* poly)
+{
+	if (shape.boundsType == SsBoundsType::quad)
+	{
+		poly[0] = shape.quad[0]; poly[1] = shape.quad[1];
+		poly[2] = shape.quad[2]; poly[3] = shape.quad[3];
+		poly[4] = shape.quad[6]; poly[5] = shape.quad[7];
+		poly[6] = shape.quad[4]; poly[7] = shape.quad[5];
+	}
+	else
+	{
+		poly[0] = shape.minX; poly[1] = shape.minY;
+		poly[2] = shape.maxX; poly[3] = shape.minY;
+		poly[4] = shape.maxX; poly[5] = shape.maxY;
+		poly[6] = shape.minX; poly[7] = shape.maxY;
+	}
+}
+
+//点が多角形の内側にあるか（頂点変形で凹形状になる場合もあるので交差数で判定する）
+static bool isPointInPolygon(float x, float y, const float* poly)
+{
+	bool inside = false;
+	for (int i = 0, j = 3; i < 4; j = i++)
+	{
+		float xi = poly[i * 2 + 0], yi = poly[i * 2 + 1];
+		float xj = poly[j * 2 + 0], yj = poly[j * 2 + 1];
+		if (((yi > y) != (yj > y)) && (x < (xj - xi) * (y - yi) / (yj - yi) + xi))
+		{
+			inside = !inside;
+		}
+	}
+	return inside;
+}
+
+//点と線分の距離の2乗
+static float getSegmentDistanceSq(float x, float y, float ax, float ay, float bx, float by)
+{
+	float dx = bx - ax;
+	float dy = by - ay;
+	float len = dx * dx + dy * dy;
+	float t = 0.0f;
+	if (len > 0.0f)
+	{
+		t = ((x - ax) * dx + (y - ay) * dy) / len;
+		t = std::max(0.0f, std::min(1.0f, t));
+	}
+	float px = ax + dx * t - x;
+	float py = ay + dy * t - y;
+	return px * px + py * py;
+}
+
+static bool isCircleInPolygon(float x, float y, float radius, const float* poly)
+{
+	if (isPointInPolygon(x, y, poly))
+	{
+		return true;
+	}
+	float r2 = radius * radius;
+	for (int i = 0, j = 3; i < 4; j = i++)
+	{
+		if (getSegmentDistanceSq(x, y, poly[j * 2 + 0], poly[j * 2 + 1], poly[i * 2 + 0], poly[i * 2 + 1]) <= r2)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+//線分の交差判定
+static float getCross(float ax, float ay, float bx, float by, float cx, float cy)
+{
+	return (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+}
+static bool isSegmentIntersect(const float* a, const float* b, const float* c, const float* d)
+{
+	float d1 = getCross(c[0], c[1], d[0], d[1], a[0], a[1]);
+	float d2 = getCross(c[0], c[1], d[0], d[1], b[0], b[1]);
+	float d3 = getCross(a[0], a[1], b[0], b[1], c[0], c[1]);
+	float d4 = getCross(a[0], a[1], b[0], b[1], d[0], d[1]);
+	return (((d1 > 0.0f) != (d2 > 0.0f)) || (d1 == 0.0f) || (d2 == 0.0f))
+		&& (((d3 > 0.0f) != (d4 > 0.0f)) || (d3 == 0.0f) || (d4 == 0.0f));
+}
+
+static bool isPolygonOverlap(const float* p, const float* q)
+{
+	for (int i = 0, j = 3; i < 4; j = i++)
+	{
+		for (int k = 0, l = 3; k < 4; l = k++)
+		{
+			if (isSegmentIntersect(&p[j * 2], &p[i * 2], &q[l * 2], &q[k * 2]))
+			{
+				return true;
+			}
+		}
+	}
+	//辺が交差しない場合はどちらかが内側に含まれている
+	return isPointInPolygon(p[0], p[1], q) || isPointInPolygon(q[0], q[1], p);
+}
+
+static bool isHitShapeOverlap(const HitShape& a, const HitShape& b)
+{
+	bool circleA = isCircleHitShape(a);
+	bool circleB = isCircleHitShape(b);
+	if (circleA && circleB)
+	{
+		float dx = a.x - b.x;
+		float dy = a.y - b.y;
+		float r = a.radius + b.radius;
+		return (dx * dx + dy * dy) <= (r * r);
+	}
+	float polyA[8];
+	float polyB[8];
+	if (circleA)
+	{
+		getHitShapePolygon(b, polyB);
+		return isCircleInPolygon(a.x, a.y, a.radius, polyB);
+	}
+	getHitShapePolygon(a, polyA);
+	if (circleB)
+	{
+		return isCircleInPolygon(b.x, b.y, b.radius, polyA);
+	}
+	getHitShapePolygon(b, polyB);
+	return isPolygonOverlap(polyA, polyB);
+}
+
+HitShapeGrid* HitShapeGrid::create(float cellSize)
+{
+	HitShapeGrid* obj = new HitShapeGrid(cellSize);
+	return obj;
+}
+
+HitShapeGrid::HitShapeGrid(float cellSize)
+	: _cellSize(64.0f)
+	, _queryStamp(0)
+	, _bucketMask(0)
+{
+	setCellSize(cellSize);
+}
+
+HitShapeGrid::~HitShapeGrid()
+{
+}
+
+void HitShapeGrid::setCellSize(float cellSize)
+{
+	SS_ASSERT2(cellSize > 0.0f, "Invalid cell size");
+	if (cellSize > 0.0f)
+	{
+		_cellSize = cellSize;
+	}
+}
+
+float HitShapeGrid::getCellSize() const
+{
+	return _cellSize;
+}
+
+void HitShapeGrid::addPlayer(Player* player)
+{
+	if ((player != NULL) && (std::find(_players.begin(), _players.end(), player) == _players.end()))
+	{
+		_players.push_back(player);
+	}
+}
+
+void HitShapeGrid::removePlayer(Player* player)
+{
+	std::vector<Player*>::iterator it = std::find(_players.begin(), _players.end(), player);
+	if (it != _players.end())
+	{
+		_players.erase(it);
+	}
+	//取得済みの形状も無効にする
+	_shapes.clear();
+	_entries.clear();
+	_wideShapes.clear();
+	_bucketStart.clear();
+}
+
+void HitShapeGrid::removeAllPlayer()
+{
+	_players.clear();
+	_shapes.clear();
+	_entries.clear();
+	_wideShapes.clear();
+	_bucketStart.clear();
+}
+
+const std::vector<HitShape>& HitShapeGrid::getShapes() const
+{
+	return _shapes;
+}
+
+//セルの番号（intに変換できない範囲はクランプする）
+static int getHitShapeCell(float v)
+{
+	const float limit = 1.0e9f;
+	return (int)floorf(std::min(std::max(v, -limit), limit));
+}
+
+//範囲を覆うセルを求める（座標が有限の値ではない場合はfalse）
+bool HitShapeGrid::getCellRange(float minX, float minY, float maxX, float maxY, int& x0, int& y0, int& x1, int& y1) const
+{
+	if (!std::isfinite(minX) || !std::isfinite(minY) || !std::isfinite(maxX) || !std::isfinite(maxY))
+	{
+		return false;
+	}
+	float inv = 1.0f / _cellSize;
+	x0 = getHitShapeCell(minX * inv);
+	y0 = getHitShapeCell(minY * inv);
+	x1 = getHitShapeCell(maxX * inv);
+	y1 = getHitShapeCell(maxY * inv);
+	return true;
+}
+
+//バケット数より多いセルにまたがる範囲はバケットを使用せずに全て調べた方が速い
+bool HitShapeGrid::isWideCellRange(int x0, int y0, int x1, int y1) const
+{
+	double numCells = ((double)x1 - x0 + 1) * ((double)y1 - y0 + 1);
+	return numCells > (double)(_bucketMask + 1);
+}
+
+int HitShapeGrid::getBucket(int cx, int cy) const
+{
+	unsigned int h = ((unsigned int)cx * 73856093u) ^ ((unsigned int)cy * 19349663u);
+	return (int)(h & (unsigned int)_bucketMask);
+}
+
+//全プレイヤーの形状を取得してバケットに振り分ける
+void HitShapeGrid::update(bool visibleOnly)
+{
+	Player::getHitShapes(_shapes, _players.empty() ? NULL : &_players[0], (int)_players.size());
+
+	//座標が有限の値ではない形状はセルを求められないので登録しない
+	size_t n = 0;
+	for (size_t i = 0; i < _shapes.size(); i++)
+	{
+		const HitShape& shape = _shapes[i];
+		if ((visibleOnly) && (!shape.isVisibled))
+		{
+			continue;
+		}
+		if (!std::isfinite(shape.minX) || !std::isfinite(shape.minY) || !std::isfinite(shape.maxX) || !std::isfinite(shape.maxY))
+		{
+			continue;
+		}
+		_shapes[n++] = shape;
+	}
+	_shapes.resize(n);
+
+	//バケット数は形状数の2倍以上の2の累乗にする
+	int numShapes = (int)_shapes.size();
+	int numBuckets = 64;
+	while (numBuckets < numShapes * 2)
+	{
+		numBuckets <<= 1;
+	}
+	_bucketMask = numBuckets - 1;
+	_bucketStart.assign(numBuckets + 1, 0);
+	_shapeMark.assign(numShapes, 0);
+	_queryStamp = 0;
+	_wideShapes.clear();
+
+	//バケット毎の数を数えてから開始位置を決め、形状のindexを詰める
+	for (int pass = 0; pass < 2; pass++)
+	{
+		for (int i = 0; i < numShapes; i++)
+		{
+			const HitShape& shape = _shapes[i];
+			int x0, y0, x1, y1;
+			getCellRange(shape.minX, shape.minY, shape.maxX, shape.maxY, x0, y0, x1, y1);
+			if (isWideCellRange(x0, y0, x1, y1))
+			{
+				//広い範囲の形状はセルに登録せず、検索毎に調べる
+				if (pass == 0)
+				{
+					_wideShapes.push_back(i);
+				}
+				continue;
+			}
+			for (int cy = y0; cy <= y1; cy++)
+			{
+				for (int cx = x0; cx <= x1; cx++)
+				{
+					int bucket = getBucket(cx, cy);
+					if (pass == 0)
+					{
+						_bucketStart[bucket + 1]++;
+					}
+					else
+					{
+						_entries[_bucketCursor[bucket]++] = i;
+					}
+				}
+			}
+		}
+		if (pass == 0)
+		{
+			for (int b = 0; b < numBuckets; b++)
+			{
+				_bucketStart[b + 1] += _bucketStart[b];
+			}
+			_entries.resize(_bucketStart[numBuckets]);
+			_bucketCursor.assign(_bucketStart.begin(), _bucketStart.end() - 1);
+		}
+	}
+}
+
+//範囲の外接矩形と重なる形状を_candidatesに集める
+void HitShapeGrid::queryBounds(float minX, float minY, float maxX, float maxY)
+{
+	_candidates.clear();
+	if (_shapes.empty() || _bucketStart.empty())
+	{
+		return;
+	}
+	_queryStamp++;
+
+	int x0, y0, x1, y1;
+	if (!getCellRange(minX, minY, maxX, maxY, x0, y0, x1, y1))
+	{
+		return;
+	}
+	if (isWideCellRange(x0, y0, x1, y1))
+	{
+		//バケット数より広い範囲は全形状を調べる
+		for (int i = 0; i < (int)_shapes.size(); i++)
+		{
+			const HitShape& shape = _shapes[i];
+			if ((shape.maxX >= minX) && (shape.minX <= maxX) && (shape.maxY >= minY) && (shape.minY <= maxY))
+			{
+				_candidates.push_back(i);
+			}
+		}
+		return;
+	}
+
+	for (int cy = y0; cy <= y1; cy++)
+	{
+		for (int cx = x0; cx <= x1; cx++)
+		{
+			int bucket = getBucket(cx, cy);
+			for (int e = _bucketStart[bucket]; e < _bucketStart[bucket + 1]; e++)
+			{
+				int i = _entries[e];
+				if (_shapeMark[i] == _queryStamp)
+				{
+					continue;	//複数のセルに登録されている形状は一度だけ調べる
+				}
+				_shapeMark[i] = _queryStamp;
+				const HitShape& shape = _shapes[i];
+				if ((shape.maxX >= minX) && (shape.minX <= maxX) && (shape.maxY >= minY) && (shape.minY <= maxY))
+				{
+					_candidates.push_back(i);
+				}
+			}
+		}
+	}
+
+	//セルに登録していない広い範囲の形状
+	for (size_t w = 0; w < _wideShapes.size(); w++)
+	{
+		int i = _wideShapes[w];
+		const HitShape& shape = _shapes[i];
+		if ((shape.maxX >= minX) && (shape.minX <= maxX) && (shape.maxY >= minY) && (shape.minY <= maxY))
+		{
+			_candidates.push_back(i);
+		}
+	}
+}
+
+int HitShapeGrid::queryPoint(float x, float y, std::vector<int>& result)
+{
+	result.clear();
+	queryBounds(x, y, x, y);
+	for (size_t c = 0; c < _candidates.size(); c++)
+	{
+		const HitShape& shape = _shapes[_candidates[c]];
+		bool hit;
+		if (isCircleHitShape(shape))
+		{
+			float dx = shape.x - x;
+			float dy = shape.y - y;
+			hit = (dx * dx + dy * dy) <= (shape.radius * shape.radius);
+		}
+		else
+		{
+			float poly[8];
+			getHitShapePolygon(shape, poly);
+			hit = isPointInPolygon(x, y, poly);
+		}
+		if (hit)
+		{
+			result.push_back(_candidates[c]);
+		}
+	}
+	return (int)result.size();
+}
+
+int HitShapeGrid::queryCircle(float x, float y, float radius, std::vector<int>& result)
+{
+	result.clear();
+	queryBounds(x - radius, y - radius, x + radius, y + radius);
+
+	HitShape circle;
+	circle.boundsType = SsBoundsType::circle;
+	circle.x = x;
+	circle.y = y;
+	circle.radius = radius;
+	for (size_t c = 0; c < _candidates.size(); c++)
+	{
+		if (isHitShapeOverlap(circle, _shapes[_candidates[c]]))
+		{
+			result.push_back(_candidates[c]);
+		}
+	}
+	return (int)result.size();
+}
+
+int HitShapeGrid::queryPlayer(Player* playerA, Player* playerB, std::vector<std::pair<int, int> >& result)
+{
+	result.clear();
+	for (int i = 0; i < (int)_shapes.size(); i++)
+	{
+		const HitShape& shape = _shapes[i];
+		if (shape.player != playerA)
+		{
+			continue;
+		}
+		queryBounds(shape.minX, shape.minY, shape.maxX, shape.maxY);
+		for (size_t c = 0; c < _candidates.size(); c++)
+		{
+			const HitShape& other = _shapes[_candidates[c]];
+			if ((other.player == playerA) || ((playerB != NULL) && (other.player != playerB)))
+			{
+				continue;
+			}
+			if (isHitShapeOverlap(shape, other))
+			{
+				result.push_back(std::make_pair(i, _candidates[c]));
+			}
+		}
+	}
+	return (int)result.size();
+}
+
+
 };
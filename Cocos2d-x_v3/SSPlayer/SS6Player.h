@@ -73,7 +73,25 @@ https://github.com/SpriteStudio/SpriteStudio6-SDK
 #ifndef SSPlayer_h
 #define SSPlayer_h
 
+#ifndef SS_HEADLESS
 #include "cocos2d.h"
+#else
+//cocos2d-xを使用しないヘッドレスビルド（SS6PlayerPlatformNull.cppと組み合わせて使用します）
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <list>
+#include <functional>
+#include <cassert>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#endif
+#include <thread>
+#include <memory>
 #include "SS6PlayerData.h"
 #include "SS6PlayerTypes.h"
 #include "SS6PlayerPlatform.h"
@@ -101,6 +119,14 @@ class ResourceSet;
 struct ProjectData;
 class SSSize;
 class Player;
+class SSPlayerControl;
+
+/**
+* アニメーションを番号で指定するためのハンドル.
+* Player::getAnimeHandleで取得し、同じssbpデータを設定しているプレイヤーで使用できます.
+* 名前の検索を省略できるので、頻繁にモーションを切り替える場合に使用してください.
+*/
+typedef int AnimeHandle;
 
 //関数定義
 extern void get_uv_rotation(float *u, float *v, float cu, float cv, float deg);
@@ -149,6 +175,7 @@ enum {
 	RATE,
 };
 
+#ifndef SS_HEADLESS
 /**
 * SSPlayerControl 
   Cocos2d-xからSSPlayerを使用するためのラッパークラス
@@ -191,6 +218,17 @@ public:
 	*/
 	void renderingBlendFuncEnable(int flg) { _enableRenderingBlendFunc = flg; };
 
+	/**
+	* cocos2d::TrianglesCommandで描画を行うかを設定します.
+	* 有効にするとテクスチャ、シェーダー、ブレンド方法が同じパーツがレンダラーでまとめて描画され、
+	* 同じセルマップを使用する複数のプレイヤーも1回の描画にまとめられます。
+	* マスク、減算ブレンド、ミックスのパーツカラーを含むフレームと、レンダリング用ブレンドファンクションを使用している場合は従来の描画になります。
+	*
+	* @param  flg	      CustomCommandで描画:false、TrianglesCommandで描画:true
+	*/
+	void setTrianglesCommandEnable(bool flg) { _enableTrianglesCommand = flg; };
+	bool isTrianglesCommandEnable() const { return _enableTrianglesCommand; };
+
 public:
 	SSPlayerControl();
 	~SSPlayerControl();
@@ -203,6 +241,7 @@ public:
 
 	void onDraw(cocos2d::Renderer *renderer, const cocos2d::Mat4 &transform, uint32_t flags);
 	void onRenderingDraw(cocos2d::Renderer *renderer, const cocos2d::Mat4 &transform, uint32_t flags);
+	bool drawTrianglesCommand(cocos2d::Renderer *renderer, uint32_t flags);
 	void initCustomShaderProgram( );
 
 	static cocos2d::GLProgram*	_defaultShaderProgram;
@@ -224,17 +263,30 @@ private:
 	cocos2d::CustomCommand _customCommand;
 	cocos2d::CustomCommand _customCommandRendering;
 
-	cocos2d::Vec2 _position;		//プレイヤーのポジション
 	bool _enableRenderingBlendFunc;	//レンダリング用のブレンドステートを使用する
+	bool _enableTrianglesCommand;	//TrianglesCommandで描画する
+
+	//TrianglesCommandと参照する頂点（レンダラーが描画するまで保持する）
+	struct TrianglesSlot
+	{
+		SSTrianglesBuffer triangles;
+		std::vector<cocos2d::TrianglesCommand> commands;
+	};
+	//RenderTexture等で1フレームに複数回描画される場合があるため、フレーム内の描画毎に別のスロットを使用する
+	std::vector<TrianglesSlot*> _trianglesSlots;
+	unsigned int _trianglesFrame;	//スロットを使用しているフレーム
+	size_t _trianglesSlotCount;		//フレーム内で使用したスロットの数
 };
+#endif	// SS_HEADLESS
 
 /**
 * State
 パーツの情報を格納します。Stateの内容をもとに描画処理を作成してください。
+毎フレーム更新、コピーされるため、文字列やメッシュの頂点のような可変長のデータは持たずに参照します。
 */
 struct State
 {
-	std::string name;				/// パーツ名
+	const char* name;				/// パーツ名（ssbpデータ内の文字列を参照）
 	int flags;						/// このフレームで更新が行われるステータスのフラグ
 	int flags2;						/// このフレームで更新が行われるステータスのフラグ2
 	int cellIndex;					/// パーツに割り当てられたセルの番号
@@ -293,10 +345,12 @@ struct State
 	float		effectValue_speed;
 	int			effectValue_loopflag;
 	//メッシュデータ
-	std::vector<SsVector3> meshVertexPoint;
+	const float* meshVertices;		/// メッシュの頂点座標（x,y,zの順、CustomSpriteの座標バッファを参照）
+	int meshVertexSize;				/// メッシュの頂点数
 
 	void init()
 	{
+		name = "";
 		flags = 0;
 		cellIndex = 0;
 		x = 0.0f;
@@ -361,7 +415,8 @@ struct State
 		Calc_scaleY = 1.0f;
 		Calc_opacity = 255;
 
-		meshVertexPoint.clear();
+		meshVertices = NULL;
+		meshVertexSize = 0;
 	}
 
 	State() { init(); }
@@ -381,8 +436,6 @@ private:
 	bool				_flipY;
 
 public:
-	float				_mat[16];		//継承マトリクス
-	float				_localmat[16];	//ローカルマトリクス
 	State				_state;
 	bool				_isStateChanged;
 	CustomSprite*		_parent;
@@ -548,8 +601,8 @@ public:
 		_state.Calc_scaleY = state.Calc_scaleY;
 		_state.Calc_opacity = state.Calc_opacity;
 
-		_state.meshVertexPoint.clear();
-		_state.meshVertexPoint = state.meshVertexPoint;
+		_state.meshVertices = state.meshVertices;
+		_state.meshVertexSize = state.meshVertexSize;
 	}
 
 
@@ -623,7 +676,7 @@ public:
 	 * @param  imageBaseDir  画像ファイルの読み込み元ルートパス. 省略時はssbpのある場所をルートとします.
 	 * @param  zipFilepath   上記 addData のコメントを参照してください。
 	 * @param  imageZipLoad  上記 addData のコメントを参照してください。
-	 * @return dataKey
+	 * @return dataKey（既に登録済み、または非同期で読み込み中の場合は空文字）
 	 */
 	std::string addDataWithKey(const std::string& dataKey, const std::string& ssbpFilepath, const std::string& imageBaseDir = s_null, const std::string& zipFilepath = s_null, bool imageZipLoad = true);
 
@@ -635,9 +688,43 @@ public:
 	 * @param  imageBaseDir  画像ファイルの読み込み元ルートパス. 省略時はssbpのある場所をルートとします.
 	 * @param  zipFilepath   上記 addData のコメントを参照してください。
 	 * @param  imageZipLoad  上記 addData のコメントを参照してください。
-	 * @return dataKey
+	 * @return dataKey（既に登録済み、または非同期で読み込み中の場合は空文字）
 	 */
 	std::string addData(const std::string& dataKey, const ProjectData* data, const std::string& imageBaseDir = s_null, const std::string& zipFilepath = s_null, bool imageZipLoad = true);
+
+	/**
+	 * 非同期読み込みが完了したときに呼ばれるコールバック.
+	 * dataKey と、読み込みに成功したかが渡されます.
+	 */
+	typedef std::function<void(const std::string& dataKey, bool success)> AddDataCallback;
+
+	/**
+	 * ssbpファイルを非同期で読み込み管理対象とします.
+	 * ファイルの読み込み、キャッシュの作成、画像のデコードはワーカースレッドで行い、
+	 * FileUtilsを使用する画像のパスの解決と、テクスチャの転送と登録のみをメインスレッドで行います.
+	 * 読み込み中の dataKey は addData 等で登録することはできません.
+	 * 登録が完了すると callback がメインスレッドで呼ばれ、以降は getData 等で参照できるようになります.
+	 * 読み込み中は ResourceManager を破棄しないでください.
+	 *
+	 * @param  ssbpFilepath  ssbp ファイルのパス
+	 * @param  callback      読み込み完了時のコールバック
+	 * @param  imageBaseDir  上記 addData のコメントを参照してください。
+	 * @param  zipFilepath   上記 addData のコメントを参照してください。
+	 * @param  imageZipLoad  上記 addData のコメントを参照してください。
+	 * @return dataKey（既に登録済み、または読み込み中の場合は空文字）
+	 */
+	std::string addDataAsync(const std::string& ssbpFilepath, const AddDataCallback& callback, const std::string& imageBaseDir = s_null, const std::string& zipFilepath = s_null, bool imageZipLoad = true);
+
+	/**
+	 * dataKey を指定して ssbpファイルを非同期で読み込み管理対象とします.
+	 * 詳細は addDataAsync のコメントを参照してください.
+	 */
+	std::string addDataWithKeyAsync(const std::string& dataKey, const std::string& ssbpFilepath, const AddDataCallback& callback, const std::string& imageBaseDir = s_null, const std::string& zipFilepath = s_null, bool imageZipLoad = true);
+
+	/**
+	 * 非同期読み込み中であればtrueを返します.
+	 */
+	bool isDataLoading(const std::string& dataKey);
 	
 	/**
 	 * 指定データを解放します.
@@ -705,6 +792,34 @@ public:
 	*/
 	int getTotalFrame(std::string ssbpName, std::string animeName);
 
+	/**
+	* アニメーションの全フレームを事前にデコードし、アトリビュート毎の配列に展開したテーブルを作成します.
+	* テーブルを作成したアニメーションは、再生時にフレームデータのデコードを行わずテーブルから値を取得します.
+	* 同じアニメーションを多数のプレイヤーで再生する場合にCPU負荷を下げることができますが、
+	* フレーム数 x パーツ数 分のメモリを使用します。使用量は getBakeAnimeMemorySize で取得できます.
+	* テーブルは releaseBakeAnime または removeData で破棄されます.
+	*
+	* @param  dataKey        ssbp名（拡張子を除くファイル名）
+	* @param  animeName      ssae/モーション名（空文字の場合はssbpに含まれる全てのアニメーション）
+	* @return 作成できたか
+	*/
+	bool bakeAnime(const std::string& dataKey, const std::string& animeName = s_null);
+
+	/**
+	* bakeAnime で作成したテーブルを破棄します.
+	*
+	* @param  dataKey        ssbp名（拡張子を除くファイル名）
+	* @param  animeName      ssae/モーション名（空文字の場合はssbpに含まれる全てのアニメーション）
+	*/
+	void releaseBakeAnime(const std::string& dataKey, const std::string& animeName = s_null);
+
+	/**
+	* bakeAnime で作成したテーブルが使用しているメモリのサイズ（バイト）を取得します.
+	*
+	* @param  dataKey        ssbp名（拡張子を除くファイル名）
+	*/
+	size_t getBakeAnimeMemorySize(const std::string& dataKey);
+
 	/**
 	* 名前が登録されていればtrueを返します
 	*
@@ -713,6 +828,18 @@ public:
 	*/
 	bool isDataKeyExists(const std::string& dataKey);
 
+	/**
+	* ssbpファイルをメモリマップドファイルとして読み込むかを設定します.
+	* true の場合、ZIP を使用しない ssbp ファイルはヒープにコピーせず読み取り専用でマップし、そのまま参照します.
+	* マップしたデータは removeData でリソースが破棄されるときに解放されます.
+	* マップできない場合（Android の APK 内のファイル等）は通常のファイル読み込みを行います.
+	* 設定はこの後に読み込むデータから有効になります.
+	*
+	* @param  flag           マップする場合は true（デフォルトは false）
+	*/
+	void setFileMapEnable(bool flag);
+	bool isFileMapEnable() const;
+
 	/**
 	 * 新たなResourceManagerインスタンスを構築します.
 	 *
@@ -725,7 +852,16 @@ public:
 	virtual ~ResourceManager();
 
 protected:
+	static ResourceSet* createResourceSet(const ProjectData* data, const std::string& baseDir, CellCache* cellCache);
+	void joinLoadThread(std::thread::id id);
+	bool isDataKeyUsed(const std::string& dataKey) const;
+	void readTextureAsync(const std::string& dataKey, const std::string& ssbpFilepath, void* loadData, unsigned long dataSize, bool isMapped, const AddDataCallback& callback, const std::string& imageBaseDir, const std::string& zipFilepath, bool imageZipLoad);
+
 	std::map<std::string, ResourceSet*>	_dataDic;
+	std::set<std::string>	_asyncLoadingKeys;	//非同期読み込み中のdataKey
+	std::list<std::thread>	_loadThreads;		//非同期読み込みのワーカースレッド
+	std::shared_ptr<bool>	_asyncAlive;		//メインスレッドの完了処理でマネージャが有効かを判定する
+	bool _fileMapEnable;
 };
 
 
@@ -833,6 +969,54 @@ struct ResluteState
 	int	part_labelcolor;			/// ラベルカラー
 };
 
+/**
+* PartPose
+* Player::evaluatePose で計算したパーツの状態。
+* マトリクスは全てルートパーツまでの親子関係を計算済みです。
+*/
+struct PartPose
+{
+	float x;						/// SSアトリビュート：X座標（座標系の反転適用済）
+	float y;						/// SSアトリビュート：Y座標（座標系の反転適用済）
+	float rotationX;				/// SSアトリビュート：X回転（座標系の反転適用済）
+	float rotationY;				/// SSアトリビュート：Y回転（座標系の反転適用済）
+	float rotationZ;				/// SSアトリビュート：Z回転（座標系の反転適用済）
+	float scaleX;					/// SSアトリビュート：Xスケール
+	float scaleY;					/// SSアトリビュート：Yスケール
+	float localscaleX;				/// SSアトリビュート：Xローカルスケール（設定されていない場合は1）
+	float localscaleY;				/// SSアトリビュート：Yローカルスケール（設定されていない場合は1）
+	float mat[16];					/// プレイヤー座標系のマトリクス（子パーツに継承されるもの）
+	float localMat[16];				/// プレイヤー座標系のマトリクス（ローカルスケール適用済、描画に使用するもの）
+	float worldMat[16];				/// ワールド座標系のマトリクス（localMatにプレイヤーのマトリクスを適用したもの）
+	int opacity;					/// 不透明度（0～255）（プレイヤーの不透明度適用済）
+	int cellIndex;					/// パーツに割り当てられたセルの番号（-1はセルなし）
+	float boundingRadius;			/// SS6アトリビュート：当たり半径
+	bool isVisibled;				/// 表示状態
+};
+
+/**
+* HitShape
+* Player::getHitShapes で取得する当たり判定の形状（ワールド座標系）。
+* 当たり判定種類（SsBoundsType）に合わせて円、または四辺形として使用してください。
+* 全ての種類で外接円（x,y,radius）と外接矩形（minX～maxY）が設定されるので、大まかな判定に使用できます。
+*/
+struct HitShape
+{
+	Player* player;					/// 取得したプレイヤー
+	int playerIndex;				/// 複数のプレイヤーから取得した場合のプレイヤーの番号
+	int partIndex;					/// パーツのindex
+	int boundsType;					/// 当たり判定種類（SsBoundsType）
+	float x;						/// 中心X座標（circle系はパーツの原点、quad、aabbは外接矩形の中心）
+	float y;						/// 中心Y座標
+	float radius;					/// 半径（circle系は当たり半径にスケールを適用したもの、quad、aabbは外接円の半径）
+	float minX;						/// 外接矩形
+	float minY;
+	float maxX;
+	float maxY;
+	float quad[8];					/// 四辺形の頂点（左上、右上、左下、右下の順にx,y）quad、aabbのみ
+	bool isVisibled;				/// パーツの表示状態（当たり判定用のパーツは非表示で作成される事が多いので判定には含めています）
+};
+
 /**
 * 再生するフレームに含まれるパーツデータのフラグ
 */
@@ -1024,6 +1208,40 @@ enum
 //プレイヤーで扱えるアニメに含まれるパーツの最大数
 #define PART_VISIBLE_MAX (512)
 
+/**
+* MotionBlendPart
+* モーションブレンドで合成するパーツのステータス
+*/
+struct MotionBlendPart
+{
+	float	x;
+	float	y;
+	float	scaleX;
+	float	scaleY;
+	float	rotationX;
+	float	rotationY;
+	float	rotationZ;
+};
+
+/**
+* MotionBlendSource
+* モーションブレンドの遷移元アニメーション
+* 遷移元は再生を続けるため、フレームを進めてデコーダーからパーツのステータスを取得します。
+*/
+struct MotionBlendSource
+{
+	AnimeRef*						animeRef;
+	float							frame;			//再生フレーム
+	float							step;			//再生スピード
+	int								loop;			//ループ数（0は無限ループ）
+	int								loopCount;		//ループした回数
+	bool							isPlaying;		//再生中か？（ループ数分再生した場合はfalse）
+	float							blendTime;		//遷移を開始してからの時間
+	float							blendTimeMax;	//遷移にかける時間
+	std::vector<float>				weights;		//パーツ毎のブレンドの重み
+	std::vector<MotionBlendPart>	parts;			//パーツ毎のステータス（パーツ番号順）
+};
+
 //このサンプルでは3D機能を使用して描画します。
 //それぞれのプラットフォームに合わせた座標系で使用してください。
 //座標系を反転させる場合はsetPositionで画面サイズから引いた座標を設定して運用するといいと思います。
@@ -1105,6 +1323,35 @@ public:
 	*/
 	void play(const std::string& animeName, int loop = 0, int startFrameNo = 0);
 
+	/**
+	* アニメーションの再生を開始します.
+	* getAnimeHandleで取得したハンドルから再生するデータを選択します.
+	* 名前の検索を行わないので、頻繁にアニメーションを切り替える場合に使用してください.
+	*
+	* @param  handle        再生するアニメーションのハンドル
+	* @param  loop          再生ループ数の指定. 省略時は0
+	* @param  startFrameNo  再生を開始するフレームNoの指定. 省略時は0
+	*/
+	void play(AnimeHandle handle, int loop = 0, int startFrameNo = 0);
+
+	/**
+	* アニメーション名からハンドルを取得します.
+	* ハンドルは設定されているssbpデータ内で有効です.
+	*
+	* @param  animeName     アニメーション名（ssae名/モーション名）
+	* @return ハンドル（見つからない場合は-1）
+	*/
+	AnimeHandle getAnimeHandle(const std::string& animeName);
+
+	/**
+	* パック名とモーション名からハンドルを取得します.
+	*
+	* @param  ssaeName      パック名(ssae名）
+	* @param  motionName    モーション名
+	* @return ハンドル（見つからない場合は-1）
+	*/
+	AnimeHandle getAnimeHandle(const std::string& ssaeName, const std::string& motionName);
+
 	/**
 	* 現在再生しているモーションとブレンドしながら再生します。
 	* アニメーション名から再生するデータを選択します.
@@ -1124,6 +1371,10 @@ public:
 	* それ以外のアトリビュートは遷移先アニメの値が適用されます。
 	* インスタンスパーツが参照しているソースアニメはブレンドされません。
 	* エフェクトパーツから発生したパーティクルはブレンドされません。
+	*
+	* 遷移元のアニメーションはプレイヤーを作成せずにパーツのステータスのみをデコードします。
+	* ブレンド中に motionBlendPlay を呼び出した場合は、ブレンド中の姿勢から新しいアニメーションへブレンドします。
+	* パーツ毎のブレンドの重みは setMotionBlendPartWeight で設定してください。
 	* 
 	*
 	* @param  animeName     再生するアニメーション名
@@ -1133,6 +1384,36 @@ public:
 	*/
 	void motionBlendPlay(const std::string& animeName, int loop = 0, int startFrameNo = 0, float blendTime = 0.1f);
 
+	/**
+	* 現在再生しているモーションとブレンドしながら再生します。
+	* getAnimeHandleで取得したハンドルから再生するデータを選択します.
+	* ブレンドの条件は上記 motionBlendPlay のコメントを参照してください.
+	*/
+	void motionBlendPlay(AnimeHandle handle, int loop = 0, int startFrameNo = 0, float blendTime = 0.1f);
+
+	/**
+	* モーションブレンドを行う際のパーツ毎のブレンドの重みを設定します.
+	* motionBlendPlay を呼び出した時点の設定がそのブレンドに適用されます。
+	* 0を設定したパーツはブレンドされずに遷移先アニメの値が適用されます。
+	* 上半身のみブレンドする等、パーツ毎にブレンドを変える場合に使用します。
+	* アニメーションを切り替えても設定は保持されます。
+	*
+	* @param  partsname     パーツ名
+	* @param  weight        ブレンドの重み（0.0～1.0、デフォルトは1.0）
+	*/
+	void setMotionBlendPartWeight(std::string partsname, float weight);
+
+	/**
+	* パーツのindexからブレンドの重みを設定します.
+	* indexはindexOfPartで取得してください.
+	*/
+	void setMotionBlendPartWeight(int partIndex, float weight);
+
+	/**
+	* パーツ毎のブレンドの重みを全て1.0に戻します.
+	*/
+	void clearMotionBlendPartWeight(void);
+
 	/**
 	 * 再生を中断します.
 	 */
@@ -1258,8 +1539,27 @@ public:
 
 	/**
 	* ラベル名からフレーム位置を取得します.
+	* ラベルはデータ読み込み時にテーブル化されているので、検索のコストは一定です.
+	*
+	* @return ラベルのフレーム（存在しない場合は-1）
 	*/
 	int getLabelToFrame(char* findLabelName);
+	int getLabelToFrame(const std::string& findLabelName);
+
+	/**
+	* 再生しているアニメーションのラベル一覧を取得します.
+	* ラベルはフレーム順に並んでいます.
+	*/
+	const std::vector<LabelData>& getLabelList() const;
+
+	/**
+	* 指定したフレーム以前で最も近いラベルを取得します.
+	* 指定したフレームにラベルがある場合はそのラベルを返します.
+	*
+	* @param  frameNo       フレーム番号
+	* @return ラベル（存在しない場合はNULL）
+	*/
+	const LabelData* getLabelAtOrBefore(int frameNo) const;
 
 	/**
 	* 再生しているアニメーションに含まれるパーツ数を取得します.
@@ -1277,6 +1577,10 @@ public:
 
 	/**
 	* パーツ名からindexを取得します.
+	* パーツ名はデータ読み込み時にテーブル化されているので、検索のコストは一定です.
+	* 取得したindexは同じアニメーションを再生している間、index指定の関数に使用できます.
+	*
+	* @return パーツのindex（見つからない場合は-1）
 	*/
 	int indexOfPart(const char* partName) const;
 
@@ -1289,6 +1593,66 @@ public:
 	*/
 	bool getPartState(ResluteState& result, const char* name, int frameNo = -1);
 
+	/**
+	* パーツのindexから、パーツ情報を取得します.
+	* indexはindexOfPartで取得してください.
+	*
+	* @param  result        パーツ情報を受け取るバッファ
+	* @param  partIndex     取得するパーツのindex
+	* @param  frameNo       取得するフレーム番号 -1の場合は現在再生しているフレームが適用される
+	*/
+	bool getPartState(ResluteState& result, int partIndex, int frameNo = -1);
+
+	/**
+	* 指定したアニメーション、フレームの全パーツの状態を計算します.
+	* getPartStateと異なりプレイヤーの状態（再生フレーム、パーツ、インスタンス、エフェクト）は変更しません。
+	* AIの先読み等で再生していないフレームの状態を調べる場合に使用してください。
+	* setPartVisible、setPartCell、モーションブレンドの設定は反映されません。
+	* フレームデータのデコーダもAnimeCacheの作成後は変更されないため、プレイヤーとリソースの状態は一切変更しません。
+	* 同じプレイヤーに対して複数のスレッドから同時に呼び出せますが、update等のプレイヤーを変更する処理とは同時に呼び出さないでください。
+	*
+	* @param  pose          結果を受け取るバッファ（パーツ番号順、パーツ数にリサイズされます）
+	* @param  handle        アニメーションのハンドル（設定されているssbpデータ内のアニメーション）
+	* @param  frameNo       計算するフレーム番号
+	* @param  mat           ワールドマトリクスの計算に使用するプレイヤーのマトリクス（NULLの場合は現在のプレイヤーのマトリクス）
+	* @return 計算できた場合はtrue
+	*/
+	bool evaluatePose(std::vector<PartPose>& pose, AnimeHandle handle, int frameNo, const float* mat = NULL) const;
+
+	/**
+	* アニメーション名（ssae名/モーション名）を指定してパーツの状態を計算します.
+	*/
+	bool evaluatePose(std::vector<PartPose>& pose, const std::string& animeName, int frameNo, const float* mat = NULL) const;
+
+	/**
+	* 当たり判定が設定された全パーツの形状をワールド座標系で取得します.
+	* パーツ設定の当たり判定種類がnone以外のパーツが対象です。
+	* 現在のパーツの状態から計算するので、update()の後に呼び出してください。
+	* パーツ毎にgetPartStateを呼び出すよりも高速に取得できます。
+	*
+	* circle        当たり半径（スケールは適用しない）
+	* circle_smin   当たり半径にx,yスケールの小さい方を適用
+	* circle_smax   当たり半径にx,yスケールの大きい方を適用
+	* quad          頂点変形を適用した四辺形
+	* aabb          四辺形を囲む回転しない矩形
+	*
+	* @param  shapes        結果を受け取るバッファ（毎フレーム同じバッファを使用するとメモリの確保が発生しません）
+	* @param  append        trueの場合はshapesの後ろに追加、falseの場合はクリアしてから設定
+	* @return 取得した形状の数
+	*/
+	int getHitShapes(std::vector<HitShape>& shapes, bool append = false) const;
+
+	/**
+	* 複数のプレイヤーの当たり判定の形状をまとめて取得します.
+	* HitShape::playerIndex には players 内の番号が設定されます。
+	*
+	* @param  shapes        結果を受け取るバッファ（クリアしてから設定されます）
+	* @param  players       プレイヤーの配列（NULLは無視されます）
+	* @param  count         プレイヤーの数
+	* @return 取得した形状の数
+	*/
+	static int getHitShapes(std::vector<HitShape>& shapes, Player* const* players, int count);
+
 	/**
 	* パーツ名からパーツの表示、非表示を設定します.
 	* コリジョン用のパーツや差し替えグラフィック等、SS上で表示を行うがゲーム中では非表示にする場合に使用します。
@@ -1296,6 +1660,12 @@ public:
 	*/
 	void setPartVisible(std::string partsname, bool flg);
 
+	/**
+	* パーツのindexからパーツの表示、非表示を設定します.
+	* indexはindexOfPartで取得してください.
+	*/
+	void setPartVisible(int partIndex, bool flg);
+
 	/**
 	* パーツ名からパーツに割り当たるセルを変更します.
 	* この関数で設定したパーツは参照セルアトリビュートの影響をうけません。
@@ -1307,6 +1677,16 @@ public:
 	*/
 	void setPartCell(std::string partsname, std::string sscename, std::string cellname);
 
+	/**
+	* パーツのindexからパーツに割り当たるセルを変更します.
+	* indexはindexOfPartで取得してください.
+	*
+	* @param  partIndex         パーツのindex
+	* @param  sscename          セルマップ名
+	* @param  cellname          表示させたいセル名
+	*/
+	void setPartCell(int partIndex, const std::string& sscename, const std::string& cellname);
+
 	/*
 	* プレイヤー本体の位置を設定します。
 	*/
@@ -1364,6 +1744,12 @@ public:
 	*/
 	bool changeInstanceAnime(std::string partsname, std::string animeName, bool overWrite, Instance keyParam);
 
+	/*
+	* パーツのindexを指定してパーツの再生するインスタンスアニメを変更します。
+	* indexはindexOfPartで取得してください.
+	*/
+	bool changeInstanceAnime(int partIndex, const std::string& animeName, bool overWrite, Instance keyParam);
+
 	/*
 	* プレイヤーにインスタンスパラメータを設定します。
 	*
@@ -1445,6 +1831,15 @@ public:
 	*/
 	void setParentMatrix(float* mat, bool use);
 
+	/*
+	* アニメーションの更新を行わずに、rootパーツの状態を決めるマトリクスのみを更新します。
+	* パーツのステータスはプレイヤーの位置に依存しないため、移動のみの場合に使用します。
+	* インスタンスパーツのプレイヤーにもマトリクスが反映されます。
+	*
+	* @param  mat			与えるマトリクス
+	*/
+	void updateParentMatrix(float* mat);
+
 	typedef std::function<void(Player*, const UserData*)> UserDataCallback;
 	typedef std::function<void(Player*)> PlayEndCallback;
 	/**
@@ -1500,15 +1895,62 @@ public:
 	*/
 	void setPlayEndCallback(const PlayEndCallback& callback);
 
+	/**
+	* ポーズキャッシュの最大数を設定します.
+	* 同じアニメーションの同じフレームを再生するプレイヤーが多い場合（群衆等）に使用します。
+	* パーツのステータスとマトリクスの計算結果を全プレイヤーで共有し、
+	* キャッシュにあるフレームはデコードと親子関係の計算を省略します。
+	* プレイヤーの位置、回転、スケール、反転、不透明度はキャッシュの外で反映されます。
+	* 最大数を超えた場合は最も使用されていないものから破棄されます。
+	*
+	* 以下のプレイヤーはキャッシュを使用しません。
+	* ・インスタンスパーツを含むアニメーション
+	* ・モーションブレンド中
+	* ・setPartVisible、setPartCell でパーツを上書きしている
+	*
+	* @param  size  キャッシュするフレームの最大数（0の場合は使用しない、デフォルトは0）
+	*/
+	static void setPoseCacheSize(int size);
+
+	/**
+	* ポーズキャッシュを破棄します.
+	*/
+	static void clearPoseCache();
+
+	/**
+	* パーツプールの最大数を設定します.
+	* アニメーションを切り替えた際に、再生していたアニメーションのパーツとインスタンスパーツのプレイヤーを
+	* 参照アニメーション毎にプールし、同じアニメーションを再生する際に再利用します。
+	* インスタンスパーツを多く含むアニメーションを頻繁に切り替える場合の生成、破棄の負荷を軽減します。
+	* プールしたパーツはResourceManagerでデータを解放した際に破棄されます。
+	*
+	* @param  size  参照アニメーション毎に保持する最大数（0の場合は使用しない、デフォルトは8）
+	*/
+	static void setPartsPoolSize(int size);
+
+	/**
+	* パーツプールを破棄します.
+	*/
+	static void clearPartsPool();
+
 
 public:
 	Player(void);
 	~Player();
 	bool init();
-	void update(float dt);
+
+	/*
+	* アニメーションを更新します。
+	* 再生フレーム、反転、カラー、パーツの表示・セルの上書き、インスタンスパーツのフレーム、
+	* エフェクトの時間のいずれも変化していない場合はパーツの再計算を省略します。
+	*
+	* @retval true   パーツのステータスを再計算した
+	* @retval false  変化がないため再計算を省略した
+	*/
+	bool update(float dt);
 	void draw();
 
-	State getState(void);
+	const State& getState(void) const;
 	bool getMaskFunctionUse(void) { return _maskEnable; };
 
 	SSPlayerControl*	_playercontrol;
@@ -1517,15 +1959,24 @@ protected:
 	void allocParts(int numParts, bool useCustomShaderProgram);
 	void releaseParts();
 	void setPartsParentage();
+	void releaseInstancePlayers();
+	void recycle();
 
 	void play(AnimeRef* animeRef, int loop, int startFrameNo);
-	void updateFrame(float dt);
-	void setFrame(int frameNo, float dt = 0.0f);
+	bool updateFrame(float dt);
+	bool setFrame(int frameNo, float dt = 0.0f);
 	void checkUserData(int frameNo);
 	float parcentVal(float val1, float val2, float parcent);
 	float parcentValRot(float val1, float val2, float parcent);
 	void setMaskFuncFlag(bool flg);
 	void setMaskParentSetting(bool flg);
+	bool isPoseCacheUsable() const;
+	int getLabelToFrame(const char* findLabelName, size_t len);
+	void updatePartMatrix();
+	void updateInstanceParentMatrix();
+	void updateMotionBlend(float dt);
+	void sampleMotionBlend();
+	void blendMotion(int partIndex, MotionBlendPart& value);
 
 protected:
 	ResourceManager*	_resman;
@@ -1534,10 +1985,10 @@ protected:
 	std::string			_currentAnimename;
 	AnimeRef*			_currentAnimeRef;
 	std::vector<CustomSprite *>	_parts;
+	std::vector<float>	_partMatrix;	//パーツの継承マトリクスとローカルマトリクス（PartHierarchyのブロック順のSoA）
 
-	Player*				_motionBlendPlayer;
-	float				_blendTime;
-	float				_blendTimeMax;
+	std::vector<MotionBlendSource>	_blendSources;		//モーションブレンドの遷移元（古い順）
+	float				_blendPartWeight[PART_VISIBLE_MAX];	//パーツ毎のブレンドの重み
 
 	bool				_frameSkipEnabled;
 	float				_playingFrame;
@@ -1548,6 +1999,9 @@ protected:
 	bool				_isPausing;
 	bool				_isPlayFirstUserdataChack;
 	int					_prevDrawFrameNo;
+	bool				_isDirty;						//前回の計算からパラメータが変更されたか？
+	bool				_isTimeDependent;				//経過時間で変化するパーツ（独立動作のインスタンス、エフェクト）があるか？
+	int					_cellRevision;					//前回の計算時の参照テクスチャの変更回数
 	bool				_partVisible[PART_VISIBLE_MAX];
 	int					_cellChange[PART_VISIBLE_MAX];
 	int					_partIndex[PART_VISIBLE_MAX];
@@ -1583,6 +2037,113 @@ protected:
 };
 
 
+/**
+ * HitShapeGrid
+ * 登録したプレイヤーの当たり判定の形状を均一グリッド（空間ハッシュ）に登録して交差判定を行います.
+ * 総当たりの判定を行わずに、近くにある形状のみを判定するので、弾幕のように大量の判定を行う場合に使用してください。
+ *
+ * //使用例
+ * grid->addPlayer(player1);
+ * grid->addPlayer(player2);
+ * //毎フレーム、全プレイヤーのupdateの後に呼び出す
+ * grid->update();
+ * grid->queryCircle(bulletX, bulletY, bulletR, hits);
+ * for (int i : hits) { const HitShape& shape = grid->getShapes()[i]; ... }
+ */
+class HitShapeGrid
+{
+public:
+	/**
+	 * HitShapeGridインスタンスを構築します.
+	 *
+	 * @param  cellSize  グリッドの1セルのサイズ（判定する形状の平均的な大きさ程度を設定してください）
+	 * @return HitShapeGridインスタンス
+	 */
+	static HitShapeGrid* create(float cellSize = 64.0f);
+
+	/**
+	 * グリッドの1セルのサイズを設定します.
+	 * 次のupdate()から反映されます。
+	 */
+	void setCellSize(float cellSize);
+	float getCellSize() const;
+
+	/**
+	 * 判定対象のプレイヤーを登録、解除します.
+	 * 登録したプレイヤーを破棄する場合は先に解除してください。
+	 */
+	void addPlayer(Player* player);
+	void removePlayer(Player* player);
+	void removeAllPlayer();
+
+	/**
+	 * 登録されている全プレイヤーの当たり判定の形状を取得してグリッドを再構築します.
+	 * 全プレイヤーのupdate()の後に呼び出してください。
+	 *
+	 * @param  visibleOnly  trueの場合は表示されているパーツのみを登録します
+	 */
+	void update(bool visibleOnly = false);
+
+	/**
+	 * update()で取得した形状を取得します.
+	 * 各判定関数の結果はこの配列のindexになります。
+	 */
+	const std::vector<HitShape>& getShapes() const;
+
+	/**
+	 * 座標に重なる形状を取得します.
+	 *
+	 * @param  x, y     判定する座標
+	 * @param  result   重なった形状のindexを受け取るバッファ（クリアしてから設定されます）
+	 * @return 重なった形状の数
+	 */
+	int queryPoint(float x, float y, std::vector<int>& result);
+
+	/**
+	 * 円に重なる形状を取得します.
+	 *
+	 * @param  x, y     円の中心座標
+	 * @param  radius   円の半径
+	 * @param  result   重なった形状のindexを受け取るバッファ（クリアしてから設定されます）
+	 * @return 重なった形状の数
+	 */
+	int queryCircle(float x, float y, float radius, std::vector<int>& result);
+
+	/**
+	 * 2つのプレイヤー間で重なる形状の組み合わせを取得します.
+	 * playerBにNULLを指定した場合はplayerAと他の全プレイヤーとの組み合わせを取得します。
+	 *
+	 * @param  playerA  判定するプレイヤー
+	 * @param  playerB  判定する相手のプレイヤー
+	 * @param  result   重なった形状のindexの組み合わせ（first:playerAの形状、second:相手の形状）を受け取るバッファ（クリアしてから設定されます）
+	 * @return 重なった組み合わせの数
+	 */
+	int queryPlayer(Player* playerA, Player* playerB, std::vector<std::pair<int, int> >& result);
+
+public:
+	HitShapeGrid(float cellSize = 64.0f);
+	virtual ~HitShapeGrid();
+
+protected:
+	bool getCellRange(float minX, float minY, float maxX, float maxY, int& x0, int& y0, int& x1, int& y1) const;
+	bool isWideCellRange(int x0, int y0, int x1, int y1) const;
+	int getBucket(int cx, int cy) const;
+	void queryBounds(float minX, float minY, float maxX, float maxY);
+
+	float					_cellSize;
+	std::vector<Player*>	_players;
+	std::vector<HitShape>	_shapes;
+	std::vector<int>		_bucketStart;		//バケット毎の_entriesの開始位置（バケット数+1）
+	std::vector<int>		_entries;			//バケット順に並べた形状のindex
+	std::vector<int>		_wideShapes;		//バケットに登録しない広い範囲の形状のindex（検索毎に全て調べる）
+	std::vector<int>		_bucketCursor;		//_entries作成時の書き込み位置
+	std::vector<int>		_shapeMark;			//検索済みの形状の判定用（_queryStampと一致したら検索済み）
+	std::vector<int>		_candidates;		//検索で見つかった形状
+	int						_queryStamp;
+	int						_bucketMask;
+};
+
+
 };	// namespace ss
 
 #endif
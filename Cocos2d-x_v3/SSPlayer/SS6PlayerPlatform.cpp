@@ -2,6 +2,17 @@
 //  SS6Platform.cpp
 //
 #include "SS6PlayerPlatform.h"
+#include <mutex>
+#include <algorithm>
+
+#if (CC_TARGET_PLATFORM == CC_PLATFORM_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 /**
 * 各プラットフォームに合わせて処理を作成してください
@@ -31,6 +42,16 @@ namespace ss
 
 	#define OPENGLES20	(1)	//Opengl 2.0で動作するコードにする場合は1
 
+	//ZIPアーカイブのキャッシュ
+	//ZIPファイルごとに一度だけ開き、セントラルディレクトリとファイルハンドルを保持して使いまわす
+	struct SSZipArchive
+	{
+		cocos2d::ZipFile* zipfile;
+		cocos2d::Data buffer;		//ファイルとして開けない場合（APK内等）に展開したZIPの中身
+	};
+	static std::map<std::string, SSZipArchive*> zipArchiveCache;
+	static std::recursive_mutex zipArchiveMutex;	//非同期読み込みのスレッドからも参照されるので排他する
+
 	//アプリケーション初期化時の処理
 	void SSPlatformInit(void)
 	{
@@ -56,6 +77,7 @@ namespace ss
 		{
 			SSTextureRelese(i);
 		}
+		SSZipArchiveCacheClear();
 	}
 
 	/**
@@ -90,6 +112,111 @@ namespace ss
 		enableRenderingBlendFunc = flg;
 	}
 
+	/**
+	* ZIPアーカイブの取得
+	* 同じZIPファイルは一度だけ開き、以降はキャッシュしたアーカイブを返します。
+	*/
+	//ファイルシステム上のパスか
+	//AndroidのFileUtilsはAPK内のリソース（"assets/"から始まるパス）も絶対パスとして扱うので、fopenで開けるパスかを判定する
+	static bool SSIsFileSystemPath(const std::string& path)
+	{
+		if ((path.length() > 0) && ((path[0] == '/') || (path[0] == '\\')))
+		{
+			return true;
+		}
+		return isAbsolutePath(path);	//ドライブレターから始まるパス
+	}
+
+	static cocos2d::ZipFile* SSGetZipArchiveFullPath(const std::string& fullpath);
+	static cocos2d::ZipFile* SSGetZipArchive(const char* pszZipFileName)
+	{
+		std::string fullpath = cocos2d::FileUtils::getInstance()->fullPathForFilename(pszZipFileName);
+		return SSGetZipArchiveFullPath(fullpath);
+	}
+
+	/**
+	* フルパスを指定してZIPアーカイブを取得
+	* 絶対パスの場合はFileUtilsを使用しないので、メインスレッド以外から呼び出せます。
+	*/
+	static cocos2d::ZipFile* SSGetZipArchiveFullPath(const std::string& fullpath)
+	{
+		std::map<std::string, SSZipArchive*>::iterator it = zipArchiveCache.find(fullpath);
+		if (it != zipArchiveCache.end())
+		{
+			//キャッシュ済み
+			return it->second->zipfile;
+		}
+
+		SSZipArchive* archive = new SSZipArchive();
+		archive->zipfile = nullptr;
+		if (SSIsFileSystemPath(fullpath))
+		{
+			//ファイルを開いたままにしてエントリを名前で取り出す
+			archive->zipfile = new cocos2d::ZipFile(fullpath);
+			if (archive->zipfile->setFilter("") == false)
+			{
+				//ZipFileは開けなかった場合もインスタンスを返すのでここで判定する
+				delete archive->zipfile;
+				archive->zipfile = nullptr;
+			}
+		}
+		else
+		{
+			//ファイルとして開けないので中身を読み込んで保持する
+			archive->buffer = cocos2d::FileUtils::getInstance()->getDataFromFile(fullpath);
+			if (archive->buffer.isNull() == false)
+			{
+				archive->zipfile = cocos2d::ZipFile::createWithBuffer(archive->buffer.getBytes(), archive->buffer.getSize());
+			}
+		}
+		if (archive->zipfile == nullptr)
+		{
+			//ZIPファイルが開けなかった
+			//キャッシュには登録しないので、次回の読み込みで再度開く
+			delete archive;
+			return nullptr;
+		}
+		zipArchiveCache[fullpath] = archive;
+
+		return archive->zipfile;
+	}
+
+	/**
+	* ZIPアーカイブのキャッシュを解放
+	* ZIPファイルを差し替える場合や、ZIPからの読み込みが終わった後に呼び出してください。
+	*/
+	void SSZipArchiveCacheClear(void)
+	{
+		std::lock_guard<std::recursive_mutex> lock(zipArchiveMutex);
+
+		std::map<std::string, SSZipArchive*>::iterator it = zipArchiveCache.begin();
+		for (; it != zipArchiveCache.end(); it++)
+		{
+			SSZipArchive* archive = it->second;
+			delete archive->zipfile;
+			delete archive;
+		}
+		zipArchiveCache.clear();
+	}
+
+	/**
+	* ファイル名からフルパスを取得
+	* FileUtilsのパスキャッシュはスレッドセーフではないので、メインスレッドから呼び出してください。
+	*/
+	std::string SSGetFullPath(const char* pszFileName)
+	{
+		return cocos2d::FileUtils::getInstance()->fullPathForFilename(pszFileName);
+	}
+
+	/**
+	* メインスレッドで処理を実行する
+	* 非同期読み込みのワーカースレッドからテクスチャの転送と登録を依頼するのに使用します。
+	*/
+	void SSRunOnMainThread(const std::function<void()>& func)
+	{
+		cocos2d::Director::getInstance()->getScheduler()->performFunctionInCocosThread(func);
+	}
+
 	/**
 	* ファイル読み込み
 	*/
@@ -101,14 +228,13 @@ namespace ss
 		if (strcmp(pszZipFileName,"") != 0 )
 		{
 			//Zipファイルの読込み
-			std::string fullpath = cocos2d::FileUtils::getInstance()->fullPathForFilename(pszZipFileName);
-			cocos2d::Data zipdata = std::move(cocos2d::FileUtils::getInstance()->getDataFromFile(fullpath));
-			cocos2d::ZipFile* zipfile = cocos2d::ZipFile::createWithBuffer(zipdata.getBytes(), zipdata.getSize());
+			std::lock_guard<std::recursive_mutex> lock(zipArchiveMutex);
+			cocos2d::ZipFile* zipfile = SSGetZipArchive(pszZipFileName);
 			if (zipfile)
 			{
 				// ZIPファイルを読み込めた
 				loadData = zipfile->getFileData(pszFileName, &nSize);
-				delete zipfile;
+				*pSize = (long)nSize;
 			}
 		}
 		else
@@ -131,10 +257,279 @@ namespace ss
 		return (unsigned char *)loadData;
 	}
 
+	/**
+	* ファイルを読み取り専用でメモリにマップする
+	* ヒープへのコピーを行わずにファイルの内容を直接参照します。
+	* マップできない場合（APK内のリソース等）はNULLを返すので、SSFileOpenで読み込んでください。
+	*/
+	unsigned char* SSFileMap(const char* pszFileName, unsigned long * pSize)
+	{
+		std::string fullpath = cocos2d::FileUtils::getInstance()->fullPathForFilename(pszFileName);
+		return SSFileMapFullPath(fullpath.c_str(), pSize);
+	}
+
+	/**
+	* フルパスを指定してファイルをマップする
+	* FileUtilsを使用しないので、メインスレッド以外から呼び出せます。
+	*/
+	unsigned char* SSFileMapFullPath(const char* pszFullPath, unsigned long * pSize)
+	{
+		void* mapData = NULL;
+		*pSize = 0;
+
+		std::string fullpath = pszFullPath;
+		if (SSIsFileSystemPath(fullpath) == false)
+		{
+			return NULL;
+		}
+
+#if (CC_TARGET_PLATFORM == CC_PLATFORM_WIN32)
+		//パスはUTF-8なのでワイド文字に変換して開く
+		int len = MultiByteToWideChar(CP_UTF8, 0, fullpath.c_str(), -1, NULL, 0);
+		std::vector<wchar_t> wpath(len);
+		MultiByteToWideChar(CP_UTF8, 0, fullpath.c_str(), -1, &wpath[0], len);
+
+		HANDLE hFile = CreateFileW(&wpath[0], GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (hFile == INVALID_HANDLE_VALUE)
+		{
+			return NULL;
+		}
+		DWORD size = GetFileSize(hFile, NULL);
+		if ((size != INVALID_FILE_SIZE) && (size > 0))
+		{
+			HANDLE hMap = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (hMap)
+			{
+				mapData = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+				//ビューが有効な間はマッピングが保持されるのでハンドルは閉じてよい
+				CloseHandle(hMap);
+				if (mapData)
+				{
+					*pSize = (unsigned long)size;
+				}
+			}
+		}
+		CloseHandle(hFile);
+#else
+		int fd = open(fullpath.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			return NULL;
+		}
+		struct stat st;
+		if ((fstat(fd, &st) == 0) && (st.st_size > 0))
+		{
+			void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			if (p != MAP_FAILED)
+			{
+				mapData = p;
+				*pSize = (unsigned long)st.st_size;
+			}
+		}
+		//マップ後はファイルディスクリプタを閉じてよい
+		close(fd);
+#endif
+
+		return (unsigned char *)mapData;
+	}
+
+	/**
+	* SSFileMapでマップしたファイルの解放
+	*/
+	void SSFileUnmap(unsigned char* pData, unsigned long size)
+	{
+		if (pData == NULL)
+		{
+			return;
+		}
+#if (CC_TARGET_PLATFORM == CC_PLATFORM_WIN32)
+		UnmapViewOfFile(pData);
+#else
+		munmap(pData, (size_t)size);
+#endif
+	}
+
 	/**
 	* テクスチャの読み込み
 	*/
+	static long SSTextureLoadSub(const char* pszFileName, int  wrapmode, int filtermode, const char *pszZipFileName, cocos2d::Image* readImage);
 	long SSTextureLoad(const char* pszFileName, int  wrapmode, int filtermode, const char *pszZipFileName)
+	{
+		return SSTextureLoadSub(pszFileName, wrapmode, filtermode, pszZipFileName, nullptr);
+	}
+
+	//フルパスで指定したファイルを読み込む（FileUtilsを使用しないのでメインスレッド以外から呼び出せる）
+	static unsigned char* SSReadLocalFile(const char* pszFullPath, ssize_t* pSize)
+	{
+		*pSize = 0;
+#if (CC_TARGET_PLATFORM == CC_PLATFORM_WIN32)
+		//パスはUTF-8なのでワイド文字に変換して開く
+		int len = MultiByteToWideChar(CP_UTF8, 0, pszFullPath, -1, NULL, 0);
+		std::vector<wchar_t> wpath(len);
+		MultiByteToWideChar(CP_UTF8, 0, pszFullPath, -1, &wpath[0], len);
+		FILE* fp = _wfopen(&wpath[0], L"rb");
+#else
+		FILE* fp = fopen(pszFullPath, "rb");
+#endif
+		if (fp == NULL)
+		{
+			return NULL;
+		}
+		unsigned char* buffer = NULL;
+		fseek(fp, 0, SEEK_END);
+		long size = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		if (size > 0)
+		{
+			buffer = (unsigned char*)malloc(size);
+			if (fread(buffer, 1, size, fp) == (size_t)size)
+			{
+				*pSize = (ssize_t)size;
+			}
+			else
+			{
+				free(buffer);
+				buffer = NULL;
+			}
+		}
+		fclose(fp);
+		return buffer;
+	}
+
+	/**
+	* フルパスを指定してファイルを読み込む
+	* FileUtilsを使用しないので、メインスレッド以外から呼び出せます。
+	* パスはメインスレッドでSSGetFullPathを使用して解決したものを指定してください（ZIPの場合はエントリ名）。
+	* ファイルシステムから開けないパス（APK内のリソース等）はNULLを返すので、メインスレッドでSSFileOpenを使用して読み込んでください。
+	*/
+	unsigned char* SSFileReadFullPath(const char* pszFullPath, unsigned long * pSize, const char *pszZipFullPath)
+	{
+		unsigned char* loadData = NULL;
+		ssize_t filesize = 0;
+		*pSize = 0;
+		if (strcmp(pszFullPath, "") == 0)
+		{
+			return NULL;
+		}
+
+		if (strcmp(pszZipFullPath, "") != 0)
+		{
+			//Zipファイルの読込み
+			if (SSIsFileSystemPath(pszZipFullPath) == false)
+			{
+				return NULL;
+			}
+			std::lock_guard<std::recursive_mutex> lock(zipArchiveMutex);
+			cocos2d::ZipFile* zipfile = SSGetZipArchiveFullPath(pszZipFullPath);
+			if (zipfile)
+			{
+				loadData = zipfile->getFileData(pszFullPath, &filesize);
+			}
+		}
+		else if (SSIsFileSystemPath(pszFullPath))
+		{
+			//パスからファイルを読む
+			loadData = SSReadLocalFile(pszFullPath, &filesize);
+		}
+		if (loadData)
+		{
+			*pSize = (unsigned long)filesize;
+		}
+		return loadData;
+	}
+
+	//アルファ乗算済みでデコードされた画像をストレートアルファに戻す
+	//RGBA8888以外の形式は戻せないのでNULLを返す
+	static cocos2d::Image* SSUnpremultiplyImage(cocos2d::Image* image)
+	{
+		if (image->getRenderFormat() != cocos2d::Texture2D::PixelFormat::RGBA8888)
+		{
+			CC_SAFE_RELEASE(image);
+			return nullptr;
+		}
+
+		unsigned char* pixel = image->getData();
+		ssize_t length = image->getDataLen();
+		for (ssize_t i = 0; i + 3 < length; i += 4)
+		{
+			unsigned int a = pixel[i + 3];
+			if ((a == 0) || (a == 255))
+			{
+				continue;
+			}
+			for (int c = 0; c < 3; c++)
+			{
+				unsigned int v = (pixel[i + c] * 255 + a / 2) / a;
+				pixel[i + c] = (unsigned char)((v > 255) ? 255 : v);
+			}
+		}
+
+		cocos2d::Image* straight = new (std::nothrow) cocos2d::Image();
+		if (straight->initWithRawData(pixel, length, image->getWidth(), image->getHeight(), 8, false) == false)
+		{
+			CC_SAFE_RELEASE(straight);
+		}
+		CC_SAFE_RELEASE(image);
+		return straight;
+	}
+
+	/**
+	* テクスチャ画像ファイルの読み込みとデコード
+	* GLへの転送はSSTextureLoadReadで行います。
+	* メインスレッド以外から呼び出すことができます。
+	* パスはSSFileReadFullPathと同じく、メインスレッドで解決したものを指定してください。
+	* 読み込めない場合はNULLを返すので、メインスレッドでSSTextureLoadを使用して読み込んでください。
+	* 戻り値はSSTextureLoadReadに渡して登録するか、SSTextureReadReleseで解放してください。
+	*/
+	void* SSTextureRead(const char* pszFullPath, const char *pszZipFullPath)
+	{
+		unsigned long filesize = 0;
+		unsigned char* loadData = SSFileReadFullPath(pszFullPath, &filesize, pszZipFullPath);
+		if (loadData == NULL)
+		{
+			return nullptr;
+		}
+
+		cocos2d::Image* image = new (std::nothrow) cocos2d::Image();
+		bool bRet = image->initWithImageData(loadData, (ssize_t)filesize);
+		free(loadData);
+		if (bRet == false)
+		{
+			CC_SAFE_RELEASE(image);
+			return nullptr;
+		}
+		if (image->hasPremultipliedAlpha())
+		{
+			//PNGのアルファ乗算の設定はImageのグローバルな設定で、メインスレッド以外から変更できない
+			//プレイヤーはストレートアルファのテクスチャを使用するので画像ごとに戻しておく
+			image = SSUnpremultiplyImage(image);
+		}
+		return image;
+	}
+
+	/**
+	* デコードした画像からテクスチャを作成する
+	* SSTextureReadでデコードした画像をGLへ転送して登録します。メインスレッドから呼び出してください。
+	* データはこの関数内で解放されます。
+	*/
+	long SSTextureLoadRead(const char* pszFileName, void* readData, int  wrapmode, int filtermode)
+	{
+		cocos2d::Image* image = static_cast<cocos2d::Image*>(readData);
+		long rc = SSTextureLoadSub(pszFileName, wrapmode, filtermode, "", image);
+		SSTextureReadRelese(readData);
+		return rc;
+	}
+
+	/**
+	* SSTextureReadでデコードした画像の解放
+	*/
+	void SSTextureReadRelese(void* readData)
+	{
+		cocos2d::Image* image = static_cast<cocos2d::Image*>(readData);
+		CC_SAFE_RELEASE(image);
+	}
+
+	static long SSTextureLoadSub(const char* pszFileName, int  wrapmode, int filtermode, const char *pszZipFileName, cocos2d::Image* readImage)
 	{
 		/**
 		* テクスチャ管理用のユニークな値を返してください。
@@ -163,12 +558,16 @@ namespace ss
 					//キャッシュにテクスチャがない場合は読み込む
 					cocos2d::CCImage::setPNGPremultipliedAlphaEnabled(false);	//ストーレートアルファで読み込む
 
-					if (strcmp(pszZipFileName, "") != 0)
+					if (readImage)
+					{
+						//デコード済みの画像を転送する
+						tex = texCache->addImage(readImage, pszFileName);
+					}
+					else if (strcmp(pszZipFileName, "") != 0)
 					{
 						//Zipファイルの読込み
-						std::string fullpath = cocos2d::FileUtils::getInstance()->fullPathForFilename(pszZipFileName);
-						cocos2d::Data zipdata = std::move(cocos2d::FileUtils::getInstance()->getDataFromFile(fullpath));
-						cocos2d::ZipFile* zipfile = cocos2d::ZipFile::createWithBuffer(zipdata.getBytes(), zipdata.getSize());
+						std::lock_guard<std::recursive_mutex> lock(zipArchiveMutex);
+						cocos2d::ZipFile* zipfile = SSGetZipArchive(pszZipFileName);
 						if(zipfile)
 						{
 							// ZIPファイルを読み込めた
@@ -189,8 +588,6 @@ namespace ss
 								free(loadData);
 							}
 						}
-						//ZIPを破棄する
-						delete zipfile;
 					}
 					else
 					{
@@ -367,10 +764,158 @@ namespace ss
 	};
 	SSDrawState _ssDrawState;
 
+	/**
+	* 描画バッチ
+	* テクスチャ、ブレンド方法、シェーダー、ステンシルの設定が変わるまで頂点をバッファにため、まとめて描画します。
+	* 頂点はワールド座標に変換済みなので、プレイヤーやパーツをまたいで連結できます。
+	*/
+	struct SSBatchKey
+	{
+		GLuint texture;
+		int blendfunc;
+		cocos2d::GLProgram* program;
+		float rate;
+	};
+	static SSBatchKey _batchKey;
+	static bool _batchKeyValid = false;
+	static std::vector<SSV3F_C4B_T2F> _batchVertices;
+	static std::vector<GLushort> _batchIndices;
+	static int _drawCallCount = 0;
+
+	//TrianglesCommand用に頂点を取得している場合の出力先
+	static SSTrianglesBuffer* _capture = nullptr;
+	static bool _captureFailed = false;
+	static_assert(sizeof(SSV3F_C4B_T2F) == sizeof(cocos2d::V3F_C4B_T2F), "vertex layout mismatch");
+
+	static bool isSameBatchKey(const SSBatchKey& a, const SSBatchKey& b)
+	{
+		return (a.texture == b.texture) && (a.blendfunc == b.blendfunc) && (a.program == b.program) && (a.rate == b.rate);
+	}
+
+	//ブレンド方法をcocos2d::BlendFuncに変換する
+	//glBlendEquationの変更が必要な減算はBlendFuncで表現できないのでfalseを返す
+	static bool getTrianglesBlendFunc(int blendfunc, cocos2d::BlendFunc& blend)
+	{
+		switch (blendfunc)
+		{
+		case BLEND_MIX:			blend.src = GL_SRC_ALPHA;				blend.dst = GL_ONE_MINUS_SRC_ALPHA;	break;
+		case BLEND_MUL:			blend.src = GL_ZERO;					blend.dst = GL_SRC_COLOR;				break;
+		case BLEND_ADD:			blend.src = GL_SRC_ALPHA;				blend.dst = GL_ONE;					break;
+		case BLEND_MULALPHA:	blend.src = GL_DST_COLOR;				blend.dst = GL_ONE_MINUS_SRC_ALPHA;	break;
+		case BLEND_SCREEN:		blend.src = GL_ONE_MINUS_DST_COLOR;	blend.dst = GL_ONE;					break;
+		case BLEND_EXCLUSION:	blend.src = GL_ONE_MINUS_DST_COLOR;	blend.dst = GL_ONE_MINUS_SRC_COLOR;	break;
+		case BLEND_INVERT:		blend.src = GL_ONE_MINUS_DST_COLOR;	blend.dst = GL_ZERO;					break;
+		default:
+			return false;
+		}
+		return true;
+	}
+
+	//ためている頂点を描画する
+	static void SSFlushBatch(void)
+	{
+		if (_batchIndices.empty())
+		{
+			return;
+		}
+		if (_capture)
+		{
+			//TrianglesCommand用のバッファに移す
+			SSTrianglesBatch batch;
+			batch.texture = _batchKey.texture;
+			batch.program = _batchKey.program;
+			getTrianglesBlendFunc(_batchKey.blendfunc, batch.blend);
+			batch.vertexStart = (int)_capture->vertices.size();
+			batch.vertexCount = (int)_batchVertices.size();
+			batch.indexStart = (int)_capture->indices.size();
+			batch.indexCount = (int)_batchIndices.size();
+			_capture->batches.push_back(batch);
+
+			const cocos2d::V3F_C4B_T2F* verts = reinterpret_cast<const cocos2d::V3F_C4B_T2F*>(&_batchVertices[0]);
+			_capture->vertices.insert(_capture->vertices.end(), verts, verts + _batchVertices.size());
+			_capture->indices.insert(_capture->indices.end(), _batchIndices.begin(), _batchIndices.end());
+
+			_batchVertices.clear();
+			_batchIndices.clear();
+			return;
+		}
+		const char* base = (const char*)&_batchVertices[0];
+		glVertexAttribPointer(cocos2d::GLProgram::VERTEX_ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, sizeof(SSV3F_C4B_T2F), (void*)(base + offsetof(SSV3F_C4B_T2F, vertices)));
+		glVertexAttribPointer(cocos2d::GLProgram::VERTEX_ATTRIB_TEX_COORD, 2, GL_FLOAT, GL_FALSE, sizeof(SSV3F_C4B_T2F), (void*)(base + offsetof(SSV3F_C4B_T2F, texCoords)));
+		glVertexAttribPointer(cocos2d::GLProgram::VERTEX_ATTRIB_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(SSV3F_C4B_T2F), (void*)(base + offsetof(SSV3F_C4B_T2F, colors)));
+		glDrawElements(GL_TRIANGLES, (GLsizei)_batchIndices.size(), GL_UNSIGNED_SHORT, &_batchIndices[0]);
+		CC_INCREMENT_GL_DRAWN_BATCHES_AND_VERTICES(1, _batchVertices.size());
+		_drawCallCount++;
+
+		_batchVertices.clear();
+		_batchIndices.clear();
+	}
+
+	//バッチに頂点を追加する
+	//インデックスは追加する頂点の先頭からの番号で指定し、戻り値の頂点バッファに頂点を設定してください。
+	static SSV3F_C4B_T2F* SSAllocBatch(int numVertices, const GLushort* indices, int numIndices)
+	{
+		if (_batchVertices.size() + numVertices > 65536)
+		{
+			SSFlushBatch();	//16bitのインデックスで参照できる頂点数を超える
+		}
+		size_t base = _batchVertices.size();
+		_batchVertices.resize(base + numVertices);
+		for (int i = 0; i < numIndices; i++)
+		{
+			_batchIndices.push_back((GLushort)(base + indices[i]));
+		}
+		return &_batchVertices[base];
+	}
+
+	/**
+	* SSDrawSpriteで発行したドローコールの数を取得します.
+	* SSResetDrawCallCountを呼び出してからの合計になります。
+	*/
+	int SSGetDrawCallCount(void)
+	{
+		return _drawCallCount;
+	}
+	void SSResetDrawCallCount(void)
+	{
+		_drawCallCount = 0;
+	}
+
+	/**
+	* SSDrawSpriteの出力をTrianglesCommand用のバッファに切り替えます.
+	* SSEndTrianglesCaptureまでの間はGLの命令を発行しません。
+	*/
+	void SSBeginTrianglesCapture(SSTrianglesBuffer* buffer)
+	{
+		SSFlushBatch();
+		_capture = buffer;
+		_captureFailed = false;
+		_batchKeyValid = false;
+	}
+
+	/**
+	* TrianglesCommand用のバッファへの出力を終了します.
+	* TrianglesCommandで描画できないパーツがあった場合はfalseを返します。
+	*/
+	bool SSEndTrianglesCapture(void)
+	{
+		SSFlushBatch();
+		_capture = nullptr;
+		_batchKeyValid = false;
+		return (_captureFailed == false);
+	}
+
 	//各プレイヤーの描画を行う前の初期化処理
 	GLboolean _currentStencilEnabled = GL_FALSE;
 	void SSRenderSetup( void )
 	{
+		if (_capture)
+		{
+			//TrianglesCommandの場合はレンダラーがステートを設定する
+			_ssDrawState.init();
+			_batchKeyValid = false;
+			return;
+		}
 #if OPENGLES20
 #else
 		glDisableClientState(GL_COLOR_ARRAY);
@@ -392,11 +937,19 @@ namespace ss
 
 		cocos2d::GL::enableVertexAttribs(cocos2d::GL::VERTEX_ATTRIB_FLAG_POS_COLOR_TEX);
 
+		_matrixP = cocos2d::Director::getInstance()->getMatrix(cocos2d::MATRIX_STACK_TYPE::MATRIX_STACK_PROJECTION);
+		SSResetShaderState();
+
 		_ssDrawState.init();
+		_batchKeyValid = false;
 	}
 	void SSRenderEnd(void)
 	{
-//		CC_INCREMENT_GL_DRAWS(1);
+		SSFlushBatch();
+		if (_capture)
+		{
+			return;
+		}
 
 #if OPENGLES20
 #else
@@ -443,6 +996,99 @@ namespace ss
 		}
 	}
 
+	//パーツカラーのブレンドタイプに対応したシェーダーを取得する
+	static cocos2d::GLProgram* getPartsColorProgram(BlendType blendType, VertexFlag colorBlendTarget)
+	{
+		switch (blendType)
+		{
+		case BlendType::BLEND_MIX:
+			return (colorBlendTarget == VertexFlag::VERTEX_FLAG_ONE) ? SSPlayerControl::_partColorMIXONEShaderProgram : SSPlayerControl::_partColorMIXVERTShaderProgram;
+		case BlendType::BLEND_MUL:
+			return SSPlayerControl::_partColorMULShaderProgram;
+		case BlendType::BLEND_ADD:
+			return SSPlayerControl::_partColorADDShaderProgram;
+		case BlendType::BLEND_SUB:
+			return SSPlayerControl::_partColorSUBShaderProgram;
+		default:
+			break;
+		}
+		return SSPlayerControl::_defaultShaderProgram;
+	}
+
+	/**
+	* シェーダーのステート
+	* 同じシェーダーが続く場合はプログラムの切り替えを省略し、ユニフォームは値が変わった時だけ送信します。
+	* プロジェクション行列はSSRenderSetupで取得し、プレイヤーの描画中は同じ値を使用します。
+	*/
+	struct SSShaderCache
+	{
+		cocos2d::GLProgram* program;	//シェーダー
+		bool useRate;					//ブレンド率を送信済みか
+		float rate;						//送信済みのブレンド率
+	};
+	#define SSSHADER_CACHE_MAX	(8)
+	static SSShaderCache _shaderCache[SSSHADER_CACHE_MAX];
+	static int _shaderCacheNum = 0;
+	static cocos2d::GLProgram* _currentProgram = nullptr;
+	static cocos2d::Mat4 _matrixP;
+
+	//シェーダーのステートを破棄する（cocos側でシェーダーが変更される可能性がある場合に呼ぶ）
+	static void SSResetShaderState(void)
+	{
+		_shaderCacheNum = 0;
+		_currentProgram = nullptr;
+	}
+
+	//シェーダーを適用する
+	//uniform_mapがnullptrの場合はcocosのビルトインユニフォームのみ設定する
+	static void SSApplyShader(cocos2d::GLProgram* program, std::map<int, int>* uniform_map, bool useRate, float rate)
+	{
+		if (_currentProgram != program)
+		{
+			program->use();
+			program->setUniformsForBuiltins();
+			_currentProgram = program;
+		}
+		if (uniform_map == nullptr)
+		{
+			return;
+		}
+
+		SSShaderCache* cache = nullptr;
+		for (int i = 0; i < _shaderCacheNum; i++)
+		{
+			if (_shaderCache[i].program == program)
+			{
+				cache = &_shaderCache[i];
+				break;
+			}
+		}
+		if (cache == nullptr)
+		{
+			SS_ASSERT2(_shaderCacheNum < SSSHADER_CACHE_MAX, "shader cache overflow");
+			if (_shaderCacheNum >= SSSHADER_CACHE_MAX)
+			{
+				SSResetShaderState();
+				_currentProgram = program;
+			}
+			//このセットアップで初めて使用するシェーダーなのでマトリクスとサンプラを送る
+			cache = &_shaderCache[_shaderCacheNum];
+			_shaderCacheNum++;
+			cache->program = program;
+			cache->useRate = false;
+			cache->rate = 0.0f;
+			glUniformMatrix4fv((*uniform_map)[WVP], 1, 0, (float *)&_matrixP.m);
+			// テクスチャサンプラ情報をシェーダーに送る  
+			glUniform1i((*uniform_map)[SAMPLER], 0);
+		}
+		if ((useRate == true) && ((cache->useRate == false) || (cache->rate != rate)))
+		{
+			glUniform1f((*uniform_map)[RATE], rate);
+			cache->useRate = true;
+			cache->rate = rate;
+		}
+	}
+
 	/**
 	パーツカラー用
 	ブレンドタイプに応じたテクスチャコンバイナの設定を行う
@@ -452,175 +1098,69 @@ namespace ss
 	*/
 	void setupPartsColorTextureCombiner(SSPlayerControl* pc, BlendType blendType, VertexFlag colorBlendTarget, float rate)
 	{
-		const auto& matrixP = cocos2d::Director::getInstance()->getMatrix(cocos2d::MATRIX_STACK_TYPE::MATRIX_STACK_PROJECTION);
-		cocos2d::Mat4 matrixMVP = matrixP;
-		cocos2d::GLProgram *glprogram;
-
 		//パーツカラーの反映
 		switch (blendType)
 		{
 		case BlendType::BLEND_MIX:
 			if ((VertexFlag)colorBlendTarget == VertexFlag::VERTEX_FLAG_ONE)
 			{
-				//シェーダーを適用する
-				pc->setGLProgram(SSPlayerControl::_partColorMIXONEShaderProgram);
-				pc->getShaderProgram()->use();
-				glprogram = pc->getGLProgram();	//
-				glprogram->setUniformsForBuiltins();
-				//マトリクスを設定
-				glUniformMatrix4fv(SSPlayerControl::_MIXONE_uniform_map[(int)WVP], 1, 0, (float *)&matrixMVP.m);
-				// テクスチャサンプラ情報をシェーダーに送る  
-				glUniform1i(SSPlayerControl::_MIXONE_uniform_map[SAMPLER], 0);
-				glUniform1f(SSPlayerControl::_MIXONE_uniform_map[RATE], rate);
+				SSApplyShader(SSPlayerControl::_partColorMIXONEShaderProgram, &SSPlayerControl::_MIXONE_uniform_map, true, rate);
 			}
 			else
 			{
-				//シェーダーを適用する
-				pc->setGLProgram(SSPlayerControl::_partColorMIXVERTShaderProgram);
-				pc->getShaderProgram()->use();
-				glprogram = pc->getGLProgram();	//
-				glprogram->setUniformsForBuiltins();
-				//マトリクスを設定
-				glUniformMatrix4fv(SSPlayerControl::_MIXVERT_uniform_map[WVP], 1, 0, (float *)&matrixMVP.m);
-				// テクスチャサンプラ情報をシェーダーに送る  
-				glUniform1i(SSPlayerControl::_MIXVERT_uniform_map[SAMPLER], 0);
-				glUniform1f(SSPlayerControl::_MIXVERT_uniform_map[RATE], rate);
+				SSApplyShader(SSPlayerControl::_partColorMIXVERTShaderProgram, &SSPlayerControl::_MIXVERT_uniform_map, true, rate);
 			}
 			break;
 		case BlendType::BLEND_MUL:
-			//シェーダーを適用する
-			pc->setGLProgram(SSPlayerControl::_partColorMULShaderProgram);
-			pc->getShaderProgram()->use();
-			glprogram = pc->getGLProgram();	//
-			glprogram->setUniformsForBuiltins();
-			//マトリクスを設定
-			glUniformMatrix4fv(SSPlayerControl::_MUL_uniform_map[WVP], 1, 0, (float *)&matrixMVP.m);
-			// テクスチャサンプラ情報をシェーダーに送る  
-			glUniform1i(SSPlayerControl::_MUL_uniform_map[SAMPLER], 0);
+			SSApplyShader(SSPlayerControl::_partColorMULShaderProgram, &SSPlayerControl::_MUL_uniform_map, false, rate);
 			break;
 		case BlendType::BLEND_ADD:
-			//シェーダーを適用する
-			pc->setGLProgram(SSPlayerControl::_partColorADDShaderProgram);
-			pc->getShaderProgram()->use();
-			glprogram = pc->getGLProgram();	//
-			glprogram->setUniformsForBuiltins();
-			//マトリクスを設定
-			glUniformMatrix4fv(SSPlayerControl::_ADD_uniform_map[WVP], 1, 0, (float *)&matrixMVP.m);
-			// テクスチャサンプラ情報をシェーダーに送る  
-			glUniform1i(SSPlayerControl::_ADD_uniform_map[SAMPLER], 0);
+			SSApplyShader(SSPlayerControl::_partColorADDShaderProgram, &SSPlayerControl::_ADD_uniform_map, false, rate);
 			break;
 		case BlendType::BLEND_SUB:
-			//シェーダーを適用する
-			pc->setGLProgram(SSPlayerControl::_partColorSUBShaderProgram);
-			pc->getShaderProgram()->use();
-			glprogram = pc->getGLProgram();	//
-			glprogram->setUniformsForBuiltins();
-			//マトリクスを設定
-			glUniformMatrix4fv(SSPlayerControl::_SUB_uniform_map[WVP], 1, 0, (float *)&matrixMVP.m);
-			// テクスチャサンプラ情報をシェーダーに送る  
-			glUniform1i(SSPlayerControl::_SUB_uniform_map[SAMPLER], 0);
+			SSApplyShader(SSPlayerControl::_partColorSUBShaderProgram, &SSPlayerControl::_SUB_uniform_map, false, rate);
 			break;
 		}
 	}
 
-	//頂点バッファにパラメータを保存する
-	void setClientState(SSV3F_C4B_T2F point, int index, float* uvs, unsigned char* colors, float* vertices)
-	{
-		uvs[0 + (index * 2)] = point.texCoords.u;
-		uvs[1 + (index * 2)] = point.texCoords.v;
-
-		colors[0 + (index * 4)] = point.colors.r;
-		colors[1 + (index * 4)] = point.colors.g;
-		colors[2 + (index * 4)] = point.colors.b;
-		colors[3 + (index * 4)] = point.colors.a;
-
-		vertices[0 + (index * 3)] = point.vertices.x;
-		vertices[1 + (index * 3)] = point.vertices.y;
-		vertices[2 + (index * 3)] = point.vertices.z;
-	}
-
 	/**
 	* メッシュの表示
+	* シェーダー等の設定はSSDrawSpriteで行い、頂点をバッチに追加します。
 	*/
-	void SSDrawMesh(CustomSprite *sprite, State state)
+	void SSDrawMesh(CustomSprite *sprite, const State& state)
 	{
-		bool ispartColor = (state.flags & PART_FLAG_PARTS_COLOR);
-
 		// 単色で処理する
 		unsigned char alpha = (state.quad.tl.colors.a * state.Calc_opacity ) / 255;
-		unsigned char setcol[4];
-		setcol[0] = state.quad.tl.colors.r;	//cocosはbyteで処理しているので
-		setcol[1] = state.quad.tl.colors.g;
-		setcol[2] = state.quad.tl.colors.b;
-		setcol[3] = alpha;
-
-//		if (
-//			(_ssDrawState.partsColorFunc != state.partsColorFunc)
-//			|| (_ssDrawState.partsColorType != state.partsColorType)
-//			|| (_ssDrawState.partsColorUse != ispartColor)
-//			)
-		{
-			if (state.flags & PART_FLAG_PARTS_COLOR)
-			{
-				setupPartsColorTextureCombiner(sprite->_playercontrol, (BlendType)state.partsColorFunc, (VertexFlag)state.partsColorType, state.rate.oneRate);
-			}
-			else
-			{
-				//パーツカラーが設定されていない場合はディフォルトシェーダーを使用する
-				sprite->_playercontrol->setGLProgram(sprite->_playercontrol->_defaultShaderProgram);
-				sprite->_playercontrol->getShaderProgram()->use();
-				auto glprogram = sprite->_playercontrol->getGLProgram();	//
-				glprogram->setUniformsForBuiltins();
-			}
-		}
-
+		SSColor4B setcol;
+		setcol.r = state.quad.tl.colors.r;	//cocosはbyteで処理しているので
+		setcol.g = state.quad.tl.colors.g;
+		setcol.b = state.quad.tl.colors.b;
+		setcol.a = alpha;
 
 		//メッシュの座標データは親子の計算が済んでいるのでプレイヤーのTRSで変形させる
-		float t[16];
+		const State& pls = sprite->_parentPlayer->getState();
 		float mat[16];
-		IdentityMatrix(mat);
-		State pls = sprite->_parentPlayer->getState();
-
-		MultiplyMatrix(pls.mat, mat, mat);
-
-		for (size_t i = 0; i < sprite->_meshVertexSize; i++)
+		if ( sprite->_meshIsBind == false )
 		{
-			sprite->_mesh_colors[i * 4 + 0] = setcol[0];
-			sprite->_mesh_colors[i * 4 + 1] = setcol[1];
-			sprite->_mesh_colors[i * 4 + 2] = setcol[2];
-			sprite->_mesh_colors[i * 4 + 3] = setcol[3];
-
-			if ( sprite->_meshIsBind == true )
-			{
-				//プレイヤーのマトリクスをメッシュデータに与える
-				TranslationMatrix(t, sprite->_mesh_vertices[i * 3 + 0], sprite->_mesh_vertices[i * 3 + 1], sprite->_mesh_vertices[i * 3 + 2]);
-				MultiplyMatrix(t, mat, t);
-				sprite->_mesh_vertices[i * 3 + 0] = t[12];
-				sprite->_mesh_vertices[i * 3 + 1] = t[13];
-				sprite->_mesh_vertices[i * 3 + 2] = 0;
-			}
-			else
-			{
-				//バインドされていないメッシュはパーツのマトリクスを与える
-				TranslationMatrix(t, sprite->_mesh_vertices[i * 3 + 0], sprite->_mesh_vertices[i * 3 + 1], sprite->_mesh_vertices[i * 3 + 2]);
-				MultiplyMatrix(t, state.mat, t);
-				MultiplyMatrix(t, mat, t);
-				sprite->_mesh_vertices[i * 3 + 0] = t[12];
-				sprite->_mesh_vertices[i * 3 + 1] = t[13];
-				sprite->_mesh_vertices[i * 3 + 2] = 0;
-			}
+			//バインドされていないメッシュはパーツのマトリクスを与える
+			MultiplyMatrix(state.mat, pls.mat, mat);
+		}
+		else
+		{
+			memcpy(mat, pls.mat, sizeof(mat));
 		}
 
-		// vertex
-		glVertexAttribPointer(cocos2d::GLProgram::VERTEX_ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)sprite->_mesh_vertices);
-
-		// texCoods
-		glVertexAttribPointer(cocos2d::GLProgram::VERTEX_ATTRIB_TEX_COORD, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)sprite->_mesh_uvs);
-
-		// color
-		glVertexAttribPointer(cocos2d::GLProgram::VERTEX_ATTRIB_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, 4 * sizeof(unsigned char), (void*)sprite->_mesh_colors);
-
-		glDrawElements(GL_TRIANGLES, sprite->_meshTriangleSize * 3, GL_UNSIGNED_SHORT, sprite->_mesh_indices);
+		//座標バッファは次のフレームの計算まで保持されるので、変換した頂点はバッチ側に書き込む
+		SSV3F_C4B_T2F* v = SSAllocBatch(sprite->_meshVertexSize, sprite->_mesh_indices, sprite->_meshTriangleSize * 3);
+		const float* src = sprite->_mesh_vertices;
+		for (size_t i = 0; i < sprite->_meshVertexSize; i++, src += 3)
+		{
+			TransformVertex(mat, src[0], src[1], src[2], &v[i].vertices.x, &v[i].vertices.y);
+			v[i].vertices.z = 0;
+			v[i].texCoords.u = sprite->_mesh_uvs[i * 2 + 0];
+			v[i].texCoords.v = sprite->_mesh_uvs[i * 2 + 1];
+			v[i].colors = setcol;
+		}
 	}
 
 	/**
@@ -632,16 +1172,8 @@ namespace ss
 		if (sprite->_playercontrol == nullptr) return;
 
 		//ステータスから情報を取得し、各プラットフォームに合わせて機能を実装してください。
-		State state;
-		if (overwrite_state)
-		{
-			//個別に用意したステートを使用する（エフェクトのパーティクル用）
-			state = *overwrite_state;
-		}
-		else
-		{
-			state = sprite->_state;
-		}
+		//個別に用意したステートがある場合はそちらを使用する（エフェクトのパーティクル用）
+		const State& state = overwrite_state ? *overwrite_state : sprite->_state;
 		int tex_index = state.texture.handle;
 		if (texture[tex_index] == nullptr)
 		{
@@ -675,34 +1207,15 @@ namespace ss
 		quad.br.vertices.x += cx;
 		quad.br.vertices.y += cy;
 
+		//SS上のTRSとプレイヤーのTRSをまとめたワールド行列で頂点を変換する
 		float mat[16];
-		IdentityMatrix(mat);
-		State pls = sprite->_parentPlayer->getState();	//プレイヤーのTRSを最終座標に加える
-
-		MultiplyMatrix(pls.mat, mat, mat);
-
-		float t[16];
-		TranslationMatrix(t, quad.tl.vertices.x, quad.tl.vertices.y, 0.0f);
-
-		MultiplyMatrix(t, state.mat, t);	//SS上のTRS
-		MultiplyMatrix(t, mat, t);			//プレイヤーのTRS	
-		quad.tl.vertices.x = t[12];
-		quad.tl.vertices.y = t[13];
-		TranslationMatrix(t, quad.tr.vertices.x, quad.tr.vertices.y, 0.0f);
-		MultiplyMatrix(t, state.mat, t);
-		MultiplyMatrix(t, mat, t);
-		quad.tr.vertices.x = t[12];
-		quad.tr.vertices.y = t[13];
-		TranslationMatrix(t, quad.bl.vertices.x, quad.bl.vertices.y, 0.0f);
-		MultiplyMatrix(t, state.mat, t);
-		MultiplyMatrix(t, mat, t);
-		quad.bl.vertices.x = t[12];
-		quad.bl.vertices.y = t[13];
-		TranslationMatrix(t, quad.br.vertices.x, quad.br.vertices.y, 0.0f);
-		MultiplyMatrix(t, state.mat, t);
-		MultiplyMatrix(t, mat, t);
-		quad.br.vertices.x = t[12];
-		quad.br.vertices.y = t[13];
+		const State& pls = sprite->_parentPlayer->getState();
+		MultiplyMatrix(state.mat, pls.mat, mat);
+
+		TransformVertex(mat, quad.tl.vertices.x, quad.tl.vertices.y, 0.0f, &quad.tl.vertices.x, &quad.tl.vertices.y);
+		TransformVertex(mat, quad.tr.vertices.x, quad.tr.vertices.y, 0.0f, &quad.tr.vertices.x, &quad.tr.vertices.y);
+		TransformVertex(mat, quad.bl.vertices.x, quad.bl.vertices.y, 0.0f, &quad.bl.vertices.x, &quad.bl.vertices.y);
+		TransformVertex(mat, quad.br.vertices.x, quad.br.vertices.y, 0.0f, &quad.br.vertices.x, &quad.br.vertices.y);
 
 		//頂点カラーにアルファを設定
 		float alpha = state.Calc_opacity / 255.0f;
@@ -729,9 +1242,65 @@ namespace ss
 			quad.br.colors.a = quad.br.colors.a * alpha;
 		}
 
+		bool ispartColor = (state.flags & PART_FLAG_PARTS_COLOR);
+
+		//シェーダーの選択
+		float rate = 0.0f;
+		cocos2d::GLProgram* program = SSPlayerControl::_defaultShaderProgram;
+		if (sprite->_partData.type == PARTTYPE_MASK)
+		{
+			//不透明度からマスク閾値へ変更
+			program = SSPlayerControl::_MASKShaderProgram;
+			rate = (float)(255 - state.masklimen) / 255.0f;
+		}
+		else if (ispartColor)
+		{
+			//パーツカラーの反映
+			program = getPartsColorProgram((BlendType)state.partsColorFunc, (VertexFlag)state.partsColorType);
+			if ((BlendType)state.partsColorFunc == BlendType::BLEND_MIX)
+			{
+				//単色（メッシュは単色で処理する）はレート、頂点は不透明度をシェーダーに渡す
+				if (((VertexFlag)state.partsColorType == VertexFlag::VERTEX_FLAG_ONE) || (sprite->_partData.type == PARTTYPE_MESH))
+				{
+					rate = state.rate.oneRate;
+				}
+				else
+				{
+					rate = alpha;
+				}
+			}
+		}
+
+		if (_capture)
+		{
+			//TrianglesCommandで表現できないステートを使用するパーツ
+			cocos2d::BlendFunc blend;
+			if ((sprite->_partData.type == PARTTYPE_MASK)
+			 || (program == SSPlayerControl::_partColorMIXONEShaderProgram)
+			 || (program == SSPlayerControl::_partColorMIXVERTShaderProgram)
+			 || (enableRenderingBlendFunc == true)
+			 || (getTrianglesBlendFunc(state.blendfunc, blend) == false))
+			{
+				_captureFailed = true;
+				return;
+			}
+		}
+
+		//描画ステートが変わる場合はためている頂点を描画してから設定を行う
+		SSBatchKey key;
+		key.texture = texture[tex_index]->getName();
+		key.blendfunc = state.blendfunc;
+		key.program = program;
+		key.rate = rate;
+		bool stateChanged = (_batchKeyValid == false) || (isSameBatchKey(key, _batchKey) == false);
+		if (stateChanged)
+		{
+			SSFlushBatch();
+		}
+
 		//テクスチャ有効
 		int	gl_target = GL_TEXTURE_2D;
-		if (_ssDrawState.texture != texture[tex_index]->getName())
+		if ((_capture == nullptr) && (_ssDrawState.texture != texture[tex_index]->getName()))
 		{
 #if OPENGLES20
 #else
@@ -746,7 +1315,7 @@ namespace ss
 
 		//描画モード
 		//
-		if (_ssDrawState.partBlendfunc != state.blendfunc)
+		if ((_capture == nullptr) && (_ssDrawState.partBlendfunc != state.blendfunc))
 		{
 			glBlendEquation(GL_FUNC_ADD);
 			if (enableRenderingBlendFunc == false)
@@ -853,103 +1422,50 @@ namespace ss
 			}
 		}
 
-		bool ispartColor = (state.flags & PART_FLAG_PARTS_COLOR);
-
-		//メッシュの場合描画
-		if (sprite->_partData.type == PARTTYPE_MESH)
-		{
-			SSDrawMesh(sprite, state);
-
-			_ssDrawState.texture = texture[tex_index]->getName();
-			_ssDrawState.partType = sprite->_partData.type;
-			_ssDrawState.partBlendfunc = state.blendfunc;
-			_ssDrawState.partsColorFunc = state.partsColorFunc;
-			_ssDrawState.partsColorType = state.partsColorType;
-			_ssDrawState.partsColorUse = (int)ispartColor;
-			_ssDrawState.maskInfluence = (int)sprite->_maskInfluence;
-
-			return;
-		}
-
-		if (sprite->_partData.type == PARTTYPE_MASK)
+		//シェーダーの適用
+		if (stateChanged)
 		{
-//			if (_ssDrawState.partType != sprite->_partData.type)
+			if (_capture)
 			{
-				//不透明度からマスク閾値へ変更
-				float mask_alpha = (float)(255 - state.masklimen) / 255.0f;
-
-				const auto& matrixP = cocos2d::Director::getInstance()->getMatrix(cocos2d::MATRIX_STACK_TYPE::MATRIX_STACK_PROJECTION);
-				cocos2d::Mat4 matrixMVP = matrixP;
-				//シェーダーを適用する
-				sprite->_playercontrol->setGLProgram(SSPlayerControl::_MASKShaderProgram);
-				sprite->_playercontrol->getShaderProgram()->use();
-				auto glprogram = sprite->_playercontrol->getGLProgram();	//
-				glprogram->setUniformsForBuiltins();
-				//マトリクスを設定
-				glUniformMatrix4fv(SSPlayerControl::_MASK_uniform_map[(int)WVP], 1, 0, (float *)&matrixMVP.m);
-				// テクスチャサンプラ情報をシェーダーに送る  
-				glUniform1i(SSPlayerControl::_MASK_uniform_map[SAMPLER], 0);
-				glUniform1f(SSPlayerControl::_MASK_uniform_map[RATE], mask_alpha);
+				//TrianglesCommandの場合はレンダラーがシェーダーを設定する
 			}
-		}
-		else
-		{
-			//パーツカラーの適用
-//			if (
-//				 (_ssDrawState.partsColorFunc != state.partsColorFunc)
-//			  || (_ssDrawState.partsColorType != state.partsColorType)
-//			  || ( _ssDrawState.partsColorUse != ispartColor)
-//			  || (sprite->_partData.type == PARTTYPE_MASK)
-//			   )
+			else if (program == SSPlayerControl::_MASKShaderProgram)
 			{
-				//パーツカラーの反映
-				if (state.flags & PART_FLAG_PARTS_COLOR)
-				{
-					//パーツカラーの反映
-					if ((VertexFlag)state.partsColorType == VertexFlag::VERTEX_FLAG_ONE)
-					{
-						//単色
-						setupPartsColorTextureCombiner(sprite->_playercontrol, (BlendType)state.partsColorFunc, (VertexFlag)state.partsColorType, state.rate.oneRate);
-					}
-					else
-					{
-						//頂点
-						setupPartsColorTextureCombiner(sprite->_playercontrol, (BlendType)state.partsColorFunc, (VertexFlag)state.partsColorType, alpha);
-					}
-				}
-				else
-				{
-					//パーツカラーが設定されていない場合はディフォルトシェーダーを使用する
-					sprite->_playercontrol->setGLProgram(sprite->_playercontrol->_defaultShaderProgram);
-					sprite->_playercontrol->getShaderProgram()->use();
-					auto glprogram = sprite->_playercontrol->getGLProgram();	//
-					glprogram->setUniformsForBuiltins();
-				}
+				SSApplyShader(SSPlayerControl::_MASKShaderProgram, &SSPlayerControl::_MASK_uniform_map, true, rate);
+			}
+			else if (program == SSPlayerControl::_defaultShaderProgram)
+			{
+				//パーツカラーが設定されていない場合はディフォルトシェーダーを使用する
+				SSApplyShader(SSPlayerControl::_defaultShaderProgram, nullptr, false, rate);
+			}
+			else
+			{
+				setupPartsColorTextureCombiner(sprite->_playercontrol, (BlendType)state.partsColorFunc, (VertexFlag)state.partsColorType, rate);
 			}
-		}
 
+			_batchKey = key;
+			_batchKeyValid = true;
+		}
 
+		if (sprite->_partData.type == PARTTYPE_MESH)
+		{
+			//メッシュの場合描画
+			SSDrawMesh(sprite, state);
+		}
 #if USE_TRIANGLE_FIN
-
 		//きれいな頂点変形に対応
-		if ((state.flags & PART_FLAG_PARTS_COLOR) || (state.flags & PART_FLAG_VERTEX_TRANSFORM))
+		else if ((state.flags & PART_FLAG_PARTS_COLOR) || (state.flags & PART_FLAG_VERTEX_TRANSFORM))
 		{
 			// ssbpLibでは4つの頂点でスプライトの表示を実装しています。
 			// SS6では５つの頂点でスプライトの表示を行っており、頂点変形時のゆがみ方が異なります。
-			float			uvs[2 * 5];			// UVバッファ
-			unsigned char	colors[4 * 5];		// カラーバッファ
-			float			vertices[3 * 5];	// 座標バッファ
-
-			memset(uvs, 0, sizeof(uvs));
-			memset(colors, 0, sizeof(colors));
-			memset(vertices, 0, sizeof(vertices));
-
-			setClientState(quad.tl, 0, uvs, colors, vertices);
-			setClientState(quad.tr, 1, uvs, colors, vertices);
-			setClientState(quad.bl, 2, uvs, colors, vertices);
-			setClientState(quad.br, 3, uvs, colors, vertices);
-
 			//頂点変形、パーツカラーを使用した場合は中心に頂点を作成し4つのポリゴンに分割して描画を行う。
+			static const GLushort indices[] = { 4, 3, 1, 4, 1, 0, 4, 0, 2, 4, 2, 3 };
+			SSV3F_C4B_T2F* v = SSAllocBatch(5, indices, 12);
+			v[0] = quad.tl;
+			v[1] = quad.tr;
+			v[2] = quad.bl;
+			v[3] = quad.br;
+
 			//頂点の算出
 			SsVector2	vertexCoordinateLU = SsVector2(quad.tl.vertices.x, quad.tl.vertices.y);// : 左上頂点座標（ピクセル座標系）
 			SsVector2	vertexCoordinateRU = SsVector2(quad.tr.vertices.x, quad.tr.vertices.y);// : 右上頂点座標（ピクセル座標系）
@@ -964,92 +1480,30 @@ namespace ss
 			SsVector2 center;
 			CoordinateGetDiagonalIntersection(center, CoordinateLURU, CoordinateRURD, CoordinateLULD, CoordinateLDRD);
 
-			SsVector2*	coodinatetable[] = { &vertexCoordinateLU , &vertexCoordinateRU , &vertexCoordinateLD , &vertexCoordinateRD , &center };
-
-			//頂点の設定
-			int i;
-			vertices[4 * 3 + 0] = center.x;
-			vertices[4 * 3 + 1] = center.y;
-			vertices[4 * 3 + 2] = 0;
+			//中心の頂点の設定
+			v[4].vertices.x = center.x;
+			v[4].vertices.y = center.y;
+			v[4].vertices.z = 0;
 			//UVの設定
-			for (i = 0; i < 4; ++i)
-			{
-				uvs[4 * 2] += uvs[i * 2];
-				uvs[4 * 2 + 1] += uvs[i * 2 + 1];
-			}
-			uvs[4 * 2] /= 4.0f;
-			uvs[4 * 2 + 1] /= 4.0f;
-
-			int a, r, g, b;
-			a = r = g = b = 0;
-			for (int i = 0; i < 4; i++)
-			{
-				int idx = i * 4;
-				r += colors[idx++];
-				g += colors[idx++];
-				b += colors[idx++];
-				a += colors[idx++];
-			}
+			v[4].texCoords.u = (v[0].texCoords.u + v[1].texCoords.u + v[2].texCoords.u + v[3].texCoords.u) / 4.0f;
+			v[4].texCoords.v = (v[0].texCoords.v + v[1].texCoords.v + v[2].texCoords.v + v[3].texCoords.v) / 4.0f;
 			//カラー値の設定
-			int idx = 4 * 4;
-			colors[idx++] = (unsigned char)(r / 4.0f);
-			colors[idx++] = (unsigned char)(g / 4.0f);
-			colors[idx++] = (unsigned char)(b / 4.0f);
-			colors[idx++] = (unsigned char)(a / 4.0f);
-
-			//描画
-
-			// vertex
-			glVertexAttribPointer(cocos2d::GLProgram::VERTEX_ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, 0, (void*)vertices);
-
-			// texCoods
-			glVertexAttribPointer(cocos2d::GLProgram::VERTEX_ATTRIB_TEX_COORD, 2, GL_FLOAT, GL_FALSE, 0, (void*)uvs);
-
-			// color
-			glVertexAttribPointer(cocos2d::GLProgram::VERTEX_ATTRIB_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, (void*)colors);
-
-			static const GLubyte indices[] = { 4, 3, 1, 0, 2, 3 };
-			glDrawElements(GL_TRIANGLE_FAN, 6, GL_UNSIGNED_BYTE, indices);
-
+			v[4].colors.r = (unsigned char)((v[0].colors.r + v[1].colors.r + v[2].colors.r + v[3].colors.r) / 4.0f);
+			v[4].colors.g = (unsigned char)((v[0].colors.g + v[1].colors.g + v[2].colors.g + v[3].colors.g) / 4.0f);
+			v[4].colors.b = (unsigned char)((v[0].colors.b + v[1].colors.b + v[2].colors.b + v[3].colors.b) / 4.0f);
+			v[4].colors.a = (unsigned char)((v[0].colors.a + v[1].colors.a + v[2].colors.a + v[3].colors.a) / 4.0f);
 		}
+#endif
 		else
 		{
-			// 変形しないスプライトはZ型の2ポリゴンで分割表示する
-#define kQuadSize sizeof(quad.bl)
-			long offset = (long)&quad;
-
-			// vertex
-			int diff = offsetof(cocos2d::V3F_C4B_T2F, vertices);
-			glVertexAttribPointer(cocos2d::GLProgram::VERTEX_ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, kQuadSize, (void*)(offset + diff));
-
-			// texCoods
-			diff = offsetof(cocos2d::V3F_C4B_T2F, texCoords);
-			glVertexAttribPointer(cocos2d::GLProgram::VERTEX_ATTRIB_TEX_COORD, 2, GL_FLOAT, GL_FALSE, kQuadSize, (void*)(offset + diff));
-
-			// color
-			diff = offsetof(cocos2d::V3F_C4B_T2F, colors);
-			glVertexAttribPointer(cocos2d::GLProgram::VERTEX_ATTRIB_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, kQuadSize, (void*)(offset + diff));
-
-			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+			// 変形しないスプライトはZ型の2ポリゴンで分割表示する（頂点はtl,bl,tr,brの順に並んでいる）
+			static const GLushort indices[] = { 0, 1, 2, 2, 1, 3 };
+			SSV3F_C4B_T2F* v = SSAllocBatch(4, indices, 6);
+			v[0] = quad.tl;
+			v[1] = quad.bl;
+			v[2] = quad.tr;
+			v[3] = quad.br;
 		}
-#else
-#define kQuadSize sizeof(quad.bl)
-		long offset = (long)&quad;
-
-		// vertex
-		int diff = offsetof(cocos2d::V3F_C4B_T2F, vertices);
-		glVertexAttribPointer(cocos2d::GLProgram::VERTEX_ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, kQuadSize, (void*)(offset + diff));
-
-		// texCoods
-		diff = offsetof(cocos2d::V3F_C4B_T2F, texCoords);
-		glVertexAttribPointer(cocos2d::GLProgram::VERTEX_ATTRIB_TEX_COORD, 2, GL_FLOAT, GL_FALSE, kQuadSize, (void*)(offset + diff));
-
-		// color
-		diff = offsetof(cocos2d::V3F_C4B_T2F, colors);
-		glVertexAttribPointer(cocos2d::GLProgram::VERTEX_ATTRIB_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, kQuadSize, (void*)(offset + diff));
-
-		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-#endif
 
 #define DRAW_DEBUG (0)
 #if ( DRAW_DEBUG == 1 )
@@ -1090,14 +1544,39 @@ namespace ss
 }
 
 
+	/**
+	* マスクのステンシル
+	* 1bit目はマスクの重なりの偶奇、2bit目以降は最後に重なった「マスクの影響を受けない」マスクの番号を保持します。
+	* マスクを取り除く時は、手前にある影響を受けないマスクが重なっていない部分だけ偶奇を反転させることで、
+	* 残りのマスクを描画しなおさずにステンシルを更新します。
+	* 影響を受けないマスクがSSMASK_REPLACE_MAXより多い場合は、Player::drawでステンシルをクリアして描画しなおします。
+	*/
+	static int _maskReplaceCount = 0;		//描画した影響を受けないマスクの数
+	static int _maskRemoveReplaceCount = 0;	//取り除いた影響を受けないマスクの数
+	static bool _maskRemove = false;		//マスクを取り除く描画を行う
+
 	void clearMask()
 	{
+		SSFlushBatch();
+		_maskReplaceCount = 0;
+		_maskRemoveReplaceCount = 0;
+		_maskRemove = false;
+		if (_capture)
+		{
+			return;
+		}
+		glStencilMask(0xff);
 		glClear(GL_STENCIL_BUFFER_BIT);
 		enableMask(false);
 	}
 
 	void enableMask(bool flag)
 	{
+		SSFlushBatch();
+		if (_capture)
+		{
+			return;
+		}
 
 		if (flag)
 		{
@@ -1106,6 +1585,7 @@ namespace ss
 		else {
 			glDisable(GL_STENCIL_TEST);
 			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			glStencilMask(0xff);
 		}
 		_ssDrawState.maskInfluence = -1;		//マスクを実行する
 		_ssDrawState.partType = -1;		//マスクを実行する
@@ -1113,11 +1593,18 @@ namespace ss
 
 	void execMask(CustomSprite *sprite)
 	{
+		if (_capture)
+		{
+			return;	//マスクを含むフレームはTrianglesCommandを使用しない
+		}
+		bool isMask = (sprite->_partData.type == PARTTYPE_MASK);
 		if (
 			(_ssDrawState.partType != sprite->_partData.type)
 			|| (_ssDrawState.maskInfluence != (int)sprite->_maskInfluence)
+			|| ((isMask) && ((_maskRemove) || !(sprite->_maskInfluence)))	//マスク毎に参照値が変わる
 		   )
 		{
+			SSFlushBatch();	//ステンシルの設定を変える前にためている頂点を描画する
 			glEnable(GL_STENCIL_TEST);
 			if (sprite->_partData.type == PARTTYPE_MASK)
 			{
@@ -1126,14 +1613,28 @@ namespace ss
 
 				//			cocos2d::Director::getInstance()->setDefaultValues
 
-				if (!(sprite->_maskInfluence)) { //マスクが有効では無い＝重ね合わせる
-					glStencilFunc(GL_ALWAYS, 1, ~0);  //常に通過
+				if (_maskRemove) { //マスクを取り除く
+					if (!(sprite->_maskInfluence))
+					{
+						_maskRemoveReplaceCount = std::min(_maskRemoveReplaceCount + 1, SSMASK_REPLACE_MAX);
+					}
+					//手前の影響を受けないマスクが重なっていない部分の偶奇を反転
+					glStencilFunc(GL_GEQUAL, _maskRemoveReplaceCount << 1, 0xfe);
+					glStencilOp(GL_KEEP, GL_KEEP, GL_INVERT);
+					glStencilMask(0x01);
+				}
+				else if (!(sprite->_maskInfluence)) { //マスクが有効では無い＝重ね合わせる
+					_maskReplaceCount = std::min(_maskReplaceCount + 1, SSMASK_REPLACE_MAX);
+					glStencilFunc(GL_ALWAYS, (_maskReplaceCount << 1) | 1, ~0);  //常に通過
 					glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-					//描画部分を1へ
+					glStencilMask(0xff);
+					//描画部分の偶奇を1、マスクの番号を書き込む
 				}
 				else {
 					glStencilFunc(GL_ALWAYS, 1, ~0);  //常に通過
-					glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
+					glStencilOp(GL_KEEP, GL_KEEP, GL_INVERT);
+					glStencilMask(0x01);
+					//描画部分の偶奇を反転
 				}
 #if OPENGLES20
 #else
@@ -1172,6 +1673,19 @@ namespace ss
 		}
 	}
 
+	/**
+	* マスクパーツをステンシルから取り除きます.
+	* マスクパーツより奥のパーツを描画した後に呼び出します。
+	* マスクは描画順に取り除く必要があります。
+	*/
+	void removeMask(CustomSprite *sprite)
+	{
+		_maskRemove = true;
+		SSDrawSprite(sprite);
+		_maskRemove = false;
+		_ssDrawState.partType = -1;		//次のパーツでステンシルの設定を戻す
+	}
+
 	/**
 	* 文字コード変換
 	*/ 
@@ -19,7 +19,17 @@ namespace ss
 	extern void SSGetPlusDirection(int &direction, int &window_w, int &window_h);
 	extern void SSRenderingBlendFuncEnable(int flg);
 	extern unsigned char* SSFileOpen(const char* pszFileName, const char* pszMode, unsigned long * pSize, const char * pszZipFileName);
+	extern unsigned char* SSFileMap(const char* pszFileName, unsigned long * pSize);
+	extern unsigned char* SSFileMapFullPath(const char* pszFullPath, unsigned long * pSize);
+	extern unsigned char* SSFileReadFullPath(const char* pszFullPath, unsigned long * pSize, const char *pszZipFullPath);
+	extern void SSFileUnmap(unsigned char* pData, unsigned long size);
+	extern void SSZipArchiveCacheClear(void);
+	extern std::string SSGetFullPath(const char* pszFileName);
+	extern void SSRunOnMainThread(const std::function<void()>& func);
 	extern long SSTextureLoad(const char* pszFileName, int  wrapmode, int filtermode, const char *pszZipFileName);
+	extern void* SSTextureRead(const char* pszFullPath, const char *pszZipFullPath);
+	extern long SSTextureLoadRead(const char* pszFileName, void* readData, int  wrapmode, int filtermode);
+	extern void SSTextureReadRelese(void* readData);
 	extern bool SSTextureRelese(long handle);
 	extern bool SSGetTextureIndex(std::string  key, std::vector<int> *indexList);
 	extern bool isAbsolutePath(const std::string& strPath);
@@ -27,9 +37,76 @@ namespace ss
 	extern void SSRenderEnd(void);
 	extern void SSDrawSprite(CustomSprite *sprite, State *overwrite_state = NULL);
 	extern bool SSGetTextureSize(long handle, int &w, int &h);
+	#define SSMASK_REPLACE_MAX	(0x7f)		//ステンシルに番号を保持できる影響を受けないマスクの数
 	extern void clearMask();
 	extern void enableMask(bool flag);
 	extern void execMask(CustomSprite *sprite);
+	extern void removeMask(CustomSprite *sprite);
+	extern int SSGetDrawCallCount(void);
+	extern void SSResetDrawCallCount(void);
+
+#ifndef SS_HEADLESS
+	/**
+	* TrianglesCommand用の描画データ
+	* SSBeginTrianglesCaptureからSSEndTrianglesCaptureの間にSSDrawSpriteで作成した頂点を
+	* テクスチャ、シェーダー、ブレンド方法が同じ範囲ごとにまとめて保持します。
+	*/
+	struct SSTrianglesBatch
+	{
+		GLuint texture;
+		cocos2d::GLProgram* program;
+		cocos2d::BlendFunc blend;
+		int vertexStart;
+		int vertexCount;
+		int indexStart;
+		int indexCount;
+	};
+	struct SSTrianglesBuffer
+	{
+		std::vector<cocos2d::V3F_C4B_T2F> vertices;
+		std::vector<unsigned short> indices;
+		std::vector<SSTrianglesBatch> batches;
+
+		void clear()
+		{
+			vertices.clear();
+			indices.clear();
+			batches.clear();
+		}
+	};
+	extern void SSBeginTrianglesCapture(SSTrianglesBuffer* buffer);
+	extern bool SSEndTrianglesCapture(void);
+#endif
+
+#ifdef SS_HEADLESS
+	/**
+	* ヘッドレスビルド(SS_HEADLESS)用のバックエンド
+	* SS6PlayerPlatformNull.cppで使用するファイルとテクスチャの処理をアプリケーション側の関数に差し替えます。
+	* 設定されていない関数は標準の処理（fopenによる読み込み、サイズ0のダミーテクスチャ）になります。
+	* 描画は行われないため、Player::update()で更新したパーツのステータスをアプリケーション側で参照してください。
+	*/
+	struct SSPlatformBackend
+	{
+		/**
+		* ファイル読み込み
+		* mallocで確保したバッファを返してください。プレイヤー側でfreeされます。
+		* 失敗した場合はNULLを返してください。
+		*/
+		std::function<unsigned char*(const char* fileName, const char* zipFileName, unsigned long* size)> fileLoad;
+		/**
+		* テクスチャ読み込み
+		* userHandleにアプリケーション側のテクスチャ識別子、w,hにテクスチャのサイズを設定してtrueを返してください。
+		*/
+		std::function<bool(const char* fileName, const char* zipFileName, int wrapmode, int filtermode, long& userHandle, int& w, int& h)> textureLoad;
+		/**
+		* テクスチャ解放
+		*/
+		std::function<void(long userHandle)> textureRelease;
+	};
+	extern void SSSetPlatformBackend(const SSPlatformBackend& backend);
+	extern long SSGetTextureUserHandle(long handle);
+	extern void SSPlatformProcessMainThread(void);
+#endif
 
 
 
@@ -0,0 +1,446 @@
+﻿// 
+//  SS6PlayerPlatformNull.cpp
+//
+//  cocos2d-xを使用しないヘッドレスビルド(SS_HEADLESS)用のプラットフォーム処理
+//  ファイルとテクスチャの処理はSSSetPlatformBackendで設定した関数を使用し、描画は行いません。
+//  サーバーでのアニメーション計算やツール、テスト等でPlayer::updateを実行する場合に使用します。
+//
+#include "SS6PlayerPlatform.h"
+
+#ifdef SS_HEADLESS
+
+#include <mutex>
+#include <deque>
+
+#if _WIN32
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace ss
+{
+	//テクスチャ割り当て管理用バッファ
+	#define TEXTURE_MAX (512)						//全プレイヤーで使えるのセルマップの枚数
+	struct SSNullTexture
+	{
+		bool used;
+		std::string key;			//登録したテクスチャのキー
+		long userHandle;			//バックエンドが返したテクスチャ識別子
+		int width;
+		int height;
+	};
+	static SSNullTexture texture[TEXTURE_MAX];
+	static int texture_index = 0;
+
+	//アプリケーション側の処理
+	static SSPlatformBackend backend;
+
+	//メインスレッドで実行する処理のキュー
+	static std::deque<std::function<void()> > mainThreadQueue;
+	static std::mutex mainThreadMutex;
+
+	//座標系設定
+	static int _direction = PLUS_UP;
+	static int _window_w = 1280;
+	static int _window_h = 720;
+
+	//アプリケーション初期化時の処理
+	void SSPlatformInit(void)
+	{
+		int i;
+		for (i = 0; i < TEXTURE_MAX; i++)
+		{
+			texture[i].used = false;
+			texture[i].key = "";
+			texture[i].userHandle = 0;
+			texture[i].width = 0;
+			texture[i].height = 0;
+		}
+		texture_index = 0;
+
+		_direction = PLUS_UP;
+		_window_w = 1280;
+		_window_h = 720;
+	}
+	//アプリケーション終了時の処理
+	void SSPlatformRelese(void)
+	{
+		int i;
+		for (i = 0; i < TEXTURE_MAX; i++)
+		{
+			SSTextureRelese(i);
+		}
+		std::lock_guard<std::mutex> lock(mainThreadMutex);
+		mainThreadQueue.clear();
+	}
+
+	/**
+	* ファイルとテクスチャの処理を設定します.
+	* SSPlatformInitの後、データを読み込む前に呼び出してください。
+	*/
+	void SSSetPlatformBackend(const SSPlatformBackend& b)
+	{
+		backend = b;
+	}
+
+	void SSSetPlusDirection(int direction, int window_w, int window_h)
+	{
+		_direction = direction;
+		_window_w = window_w;
+		_window_h = window_h;
+	}
+	void SSGetPlusDirection(int &direction, int &window_w, int &window_h)
+	{
+		direction = _direction;
+		window_w = _window_w;
+		window_h = _window_h;
+	}
+
+	void SSRenderingBlendFuncEnable(int /*flg*/)
+	{
+	}
+
+	void SSZipArchiveCacheClear(void)
+	{
+	}
+
+	/**
+	* ファイル名からフルパスを取得
+	* パスの解決はバックエンド側で行うのでそのまま返します。
+	*/
+	std::string SSGetFullPath(const char* pszFileName)
+	{
+		return pszFileName;
+	}
+
+	/**
+	* メインスレッドで処理を実行する
+	* SSPlatformProcessMainThreadが呼ばれるまでキューに保持します。
+	*/
+	void SSRunOnMainThread(const std::function<void()>& func)
+	{
+		std::lock_guard<std::mutex> lock(mainThreadMutex);
+		mainThreadQueue.push_back(func);
+	}
+
+	/**
+	* SSRunOnMainThreadで登録された処理を実行します.
+	* ResourceManager::addDataWithKeyAsyncを使用する場合は、アプリケーションのメインループから定期的に呼び出してください。
+	*/
+	void SSPlatformProcessMainThread(void)
+	{
+		std::deque<std::function<void()> > queue;
+		{
+			std::lock_guard<std::mutex> lock(mainThreadMutex);
+			queue.swap(mainThreadQueue);
+		}
+		while (!queue.empty())
+		{
+			queue.front()();
+			queue.pop_front();
+		}
+	}
+
+	/**
+	* ファイル読み込み
+	*/
+	unsigned char* SSFileOpen(const char* pszFileName, const char* pszMode, unsigned long * pSize, const char *pszZipFileName)
+	{
+		*pSize = 0;
+		if (backend.fileLoad)
+		{
+			return backend.fileLoad(pszFileName, pszZipFileName, pSize);
+		}
+
+		if (strcmp(pszZipFileName, "") != 0)
+		{
+			//ZIPの展開はバックエンドで行う
+			DEBUG_PRINTF("Can't load zip archive without backend > %s", pszZipFileName);
+			return NULL;
+		}
+
+		unsigned char* loadData = NULL;
+		FILE* fp = fopen(pszFileName, pszMode);
+		if (fp)
+		{
+			fseek(fp, 0, SEEK_END);
+			long size = ftell(fp);
+			fseek(fp, 0, SEEK_SET);
+			if (size > 0)
+			{
+				loadData = (unsigned char*)malloc(size);
+				if (fread(loadData, 1, size, fp) == (size_t)size)
+				{
+					*pSize = (unsigned long)size;
+				}
+				else
+				{
+					SS_SAFE_FREE(loadData);
+				}
+			}
+			fclose(fp);
+		}
+		if (loadData == NULL)
+		{
+			//ファイルの読み込みに失敗
+			DEBUG_PRINTF("Can't load project data > %s", pszFileName);
+		}
+		return loadData;
+	}
+
+	/**
+	* ファイルを読み取り専用でメモリにマップする
+	* バックエンドでファイル読み込みを行う場合はNULLを返し、SSFileOpenで読み込みます。
+	*/
+	unsigned char* SSFileMap(const char* pszFileName, unsigned long * pSize)
+	{
+		return SSFileMapFullPath(pszFileName, pSize);
+	}
+
+	/**
+	* フルパスを指定してファイルをマップする
+	* パスの解決はバックエンド側で行うので、SSFileMapと同じ処理になります。
+	*/
+	unsigned char* SSFileMapFullPath(const char* pszFullPath, unsigned long * pSize)
+	{
+		*pSize = 0;
+#if _WIN32
+		(void)pszFullPath;
+		return NULL;
+#else
+		if (backend.fileLoad)
+		{
+			return NULL;
+		}
+
+		void* mapData = NULL;
+		int fd = open(pszFullPath, O_RDONLY);
+		if (fd < 0)
+		{
+			return NULL;
+		}
+		struct stat st;
+		if ((fstat(fd, &st) == 0) && (st.st_size > 0))
+		{
+			void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			if (p != MAP_FAILED)
+			{
+				mapData = p;
+				*pSize = (unsigned long)st.st_size;
+			}
+		}
+		close(fd);
+		return (unsigned char *)mapData;
+#endif
+	}
+
+	/**
+	* フルパスを指定してファイルを読み込む
+	* バックエンドがスレッドセーフとは限らないため、バックエンドで読み込む場合とZIPの場合はNULLを返します。
+	* その場合はメインスレッドでSSFileOpenから読み込まれます。
+	*/
+	unsigned char* SSFileReadFullPath(const char* pszFullPath, unsigned long * pSize, const char *pszZipFullPath)
+	{
+		*pSize = 0;
+		if ((backend.fileLoad) || (strcmp(pszZipFullPath, "") != 0))
+		{
+			return NULL;
+		}
+		return SSFileOpen(pszFullPath, "rb", pSize, "");
+	}
+
+	/**
+	* SSFileMapでマップしたファイルの解放
+	*/
+	void SSFileUnmap(unsigned char* pData, unsigned long size)
+	{
+#if _WIN32
+#else
+		if (pData)
+		{
+			munmap(pData, (size_t)size);
+		}
+#endif
+	}
+
+	/**
+	* テクスチャの読み込み
+	* 空きバッファにバックエンドで読み込んだテクスチャを登録してインデックスを返します。
+	*/
+	long SSTextureLoad(const char* pszFileName, int  wrapmode, int filtermode, const char *pszZipFileName)
+	{
+		long rc = 0;
+
+		//空きバッファを検索して使用する
+		int start_index = texture_index;
+		while (true)
+		{
+			if (texture[texture_index].used == false)
+			{
+				long userHandle = 0;
+				int w = 0;
+				int h = 0;
+				bool isLoad = true;
+				if (backend.textureLoad)
+				{
+					isLoad = backend.textureLoad(pszFileName, pszZipFileName, wrapmode, filtermode, userHandle, w, h);
+				}
+				if (isLoad)
+				{
+					SSNullTexture& tex = texture[texture_index];
+					tex.used = true;
+					tex.key = pszFileName;
+					tex.userHandle = userHandle;
+					tex.width = w;
+					tex.height = h;
+					rc = texture_index;
+				}
+				else
+				{
+					DEBUG_PRINTF("テクスチャの読み込み失敗\n");
+				}
+				texture_index = (texture_index + 1) % TEXTURE_MAX;
+				break;
+			}
+			texture_index = (texture_index + 1) % TEXTURE_MAX;
+			if (texture_index == start_index)
+			{
+				//一周したバッファが開いてない
+				DEBUG_PRINTF("テクスチャバッファの空きがない\n");
+				break;
+			}
+		}
+		return rc;
+	}
+
+	/**
+	* テクスチャ画像ファイルの読み込み
+	* バックエンドがスレッドセーフとは限らないため、ワーカースレッドでは読み込まずにNULLを返します。
+	* テクスチャはメインスレッドでSSTextureLoadから読み込まれます。
+	*/
+	void* SSTextureRead(const char* /*pszFullPath*/, const char* /*pszZipFullPath*/)
+	{
+		return NULL;
+	}
+
+	long SSTextureLoadRead(const char* /*pszFileName*/, void* readData, int /*wrapmode*/, int /*filtermode*/)
+	{
+		SSTextureReadRelese(readData);
+		return -1;
+	}
+
+	void SSTextureReadRelese(void* /*readData*/)
+	{
+	}
+
+	/**
+	* テクスチャの解放
+	*/
+	bool SSTextureRelese(long handle)
+	{
+		if ((handle < 0) || (handle >= TEXTURE_MAX) || (texture[handle].used == false))
+		{
+			return false;
+		}
+		if (backend.textureRelease)
+		{
+			backend.textureRelease(texture[handle].userHandle);
+		}
+		texture[handle].used = false;
+		texture[handle].key = "";
+		texture[handle].userHandle = 0;
+		return true;
+	}
+
+	/**
+	* テクスチャハンドルからバックエンドのテクスチャ識別子を取得
+	* State::texture.handleを描画に使用する場合に参照してください。
+	*/
+	long SSGetTextureUserHandle(long handle)
+	{
+		if ((handle < 0) || (handle >= TEXTURE_MAX) || (texture[handle].used == false))
+		{
+			return 0;
+		}
+		return texture[handle].userHandle;
+	}
+
+	bool SSGetTextureIndex(std::string  key, std::vector<int> *indexList)
+	{
+		bool rc = false;
+
+		indexList->clear();
+
+		int i;
+		for (i = 0; i < TEXTURE_MAX; i++)
+		{
+			if ((texture[i].used) && (texture[i].key == key))
+			{
+				indexList->push_back(i);
+				rc = true;
+			}
+		}
+		return rc;
+	}
+
+	bool SSGetTextureSize(long handle, int &w, int &h)
+	{
+		if ((handle < 0) || (handle >= TEXTURE_MAX) || (texture[handle].used == false))
+		{
+			return false;
+		}
+		w = texture[handle].width;
+		h = texture[handle].height;
+		return true;
+	}
+
+	//描画は行わない
+	void SSRenderSetup(void)
+	{
+	}
+	void SSRenderEnd(void)
+	{
+	}
+	void SSDrawSprite(CustomSprite* /*sprite*/, State* /*overwrite_state*/)
+	{
+	}
+	void clearMask()
+	{
+	}
+	void enableMask(bool /*flag*/)
+	{
+	}
+	void execMask(CustomSprite* /*sprite*/)
+	{
+	}
+	void removeMask(CustomSprite* /*sprite*/)
+	{
+	}
+	int SSGetDrawCallCount(void)
+	{
+		return 0;
+	}
+	void SSResetDrawCallCount(void)
+	{
+	}
+
+	/**
+	* windows用パスチェック
+	*/
+	bool isAbsolutePath(const std::string& strPath)
+	{
+		if (strPath.length() > 2
+			&& ((strPath[0] >= 'a' && strPath[0] <= 'z') || (strPath[0] >= 'A' && strPath[0] <= 'Z'))
+			&& strPath[1] == ':')
+		{
+			return true;
+		}
+		return false;
+	}
+
+};	// namespace ss
+
+#endif	// SS_HEADLESS
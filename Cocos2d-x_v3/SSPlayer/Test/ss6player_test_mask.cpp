@@ -0,0 +1,244 @@
+﻿/**
+*  ss6player_test_mask.cpp
+*
+*  マスクの描画（Player::draw、execMask、removeMask）のステンシルの操作を再現して、
+*  マスクを1回ずつ描画して取り除く方法が、マスク毎にステンシルをクリアして残りのマスクを描画しなおす方法と
+*  同じ結果になるかを確認します。
+*  ランダムなマスクの並びで計算して、一致しなかった数を表示します（一致しない場合は終了コード1）。
+*/
+#include "SS6PlayerPlatform.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <random>
+
+namespace
+{
+	enum { PIXEL_NUM = 16 };
+
+	//ステンシルの比較方法、更新方法（GL_ALWAYS、GL_GEQUAL、GL_REPLACE、GL_INVERTに対応）
+	enum { STENCIL_ALWAYS, STENCIL_GEQUAL };
+	enum { STENCIL_REPLACE, STENCIL_INVERT };
+
+	std::mt19937 engine(12345);
+
+	int randomInt(int minValue, int maxValue)
+	{
+		std::uniform_int_distribution<int> dist(minValue, maxValue);
+		return dist(engine);
+	}
+
+	struct Mask
+	{
+		bool	influence;			//マスクの影響を受ける
+		bool	visible;
+		bool	cover[PIXEL_NUM];	//マスクが描画されるピクセル
+	};
+
+	//execMaskで設定するステンシルの状態
+	struct MaskState
+	{
+		int		replaceCount;
+		int		removeReplaceCount;
+		bool	remove;
+	};
+
+	//ステンシルの比較（glStencilFunc）
+	bool stencilTest(int func, int ref, int mask, unsigned char value)
+	{
+		switch (func)
+		{
+		case STENCIL_ALWAYS:	return true;
+		case STENCIL_GEQUAL:	return (ref & mask) >= (value & mask);
+		}
+		return false;
+	}
+
+	//ステンシルの更新（glStencilOp、glStencilMask）
+	void stencilWrite(int op, int ref, int writeMask, unsigned char& value)
+	{
+		int result = value;
+		switch (op)
+		{
+		case STENCIL_REPLACE:	result = ref; break;
+		case STENCIL_INVERT:	result = ~value; break;
+		}
+		value = (unsigned char)((value & ~writeMask) | (result & writeMask));
+	}
+
+	//execMaskの設定でマスクを描画する
+	void drawMask(unsigned char* stencil, const Mask& mask, MaskState& state)
+	{
+		int func;
+		int ref;
+		int op;
+		int writeMask;
+		if (state.remove)
+		{
+			if (!mask.influence)
+			{
+				state.removeReplaceCount = std::min(state.removeReplaceCount + 1, SSMASK_REPLACE_MAX);
+			}
+			func = STENCIL_GEQUAL;
+			ref = state.removeReplaceCount << 1;
+			op = STENCIL_INVERT;
+			writeMask = 0x01;
+		}
+		else if (!mask.influence)
+		{
+			state.replaceCount = std::min(state.replaceCount + 1, SSMASK_REPLACE_MAX);
+			func = STENCIL_ALWAYS;
+			ref = (state.replaceCount << 1) | 1;
+			op = STENCIL_REPLACE;
+			writeMask = 0xff;
+		}
+		else
+		{
+			func = STENCIL_ALWAYS;
+			ref = 1;
+			op = STENCIL_INVERT;
+			writeMask = 0x01;
+		}
+		int testMask = (func == STENCIL_GEQUAL) ? 0xfe : 0xff;
+
+		for (int i = 0; i < PIXEL_NUM; i++)
+		{
+			if (mask.cover[i] && stencilTest(func, ref, testMask, stencil[i]))
+			{
+				stencilWrite(op, ref, writeMask, stencil[i]);
+			}
+		}
+	}
+
+	void clearMask(unsigned char* stencil, MaskState& state)
+	{
+		memset(stencil, 0, PIXEL_NUM);
+		state.replaceCount = 0;
+		state.removeReplaceCount = 0;
+		state.remove = false;
+	}
+
+	//変更前の描画（マスク毎にクリアして残りのマスクを描画しなおす、影響を受けないマスクは1、影響を受けるマスクは+1）の
+	//maskIndex番目以降のマスクが適用された状態の偶奇
+	void referenceParity(const std::vector<Mask>& masks, size_t maskIndex, bool* parity)
+	{
+		for (int i = 0; i < PIXEL_NUM; i++)
+		{
+			int value = 0;
+			for (size_t m = maskIndex; m < masks.size(); m++)
+			{
+				if (masks[m].visible && masks[m].cover[i])
+				{
+					value = masks[m].influence ? value + 1 : 1;
+				}
+			}
+			parity[i] = (value & 1) != 0;
+		}
+	}
+
+	//Player::drawと同じ手順でマスクを処理して、各マスクパーツの後のステンシルの偶奇を比較する
+	int compareMaskSequence(const std::vector<Mask>& masks)
+	{
+		unsigned char stencil[PIXEL_NUM];
+		MaskState state;
+		clearMask(stencil, state);
+
+		int replaceCount = 0;
+		for (size_t m = 0; m < masks.size(); m++)
+		{
+			if (masks[m].visible)
+			{
+				drawMask(stencil, masks[m], state);
+				if (!masks[m].influence)
+				{
+					replaceCount++;
+				}
+			}
+		}
+		bool maskRedraw = (replaceCount > SSMASK_REPLACE_MAX);
+
+		int mismatch = 0;
+		for (size_t maskIndex = 0; maskIndex <= masks.size(); maskIndex++)
+		{
+			if (maskIndex > 0)
+			{
+				const Mask& mask = masks[maskIndex - 1];
+				if (maskRedraw)
+				{
+					clearMask(stencil, state);
+					for (size_t m = maskIndex; m < masks.size(); m++)
+					{
+						if (masks[m].visible)
+						{
+							drawMask(stencil, masks[m], state);
+						}
+					}
+				}
+				else if (mask.visible)
+				{
+					state.remove = true;
+					drawMask(stencil, mask, state);
+					state.remove = false;
+				}
+			}
+
+			bool parity[PIXEL_NUM];
+			referenceParity(masks, maskIndex, parity);
+			for (int i = 0; i < PIXEL_NUM; i++)
+			{
+				if (((stencil[i] & 1) != 0) != parity[i])
+				{
+					mismatch++;
+					break;
+				}
+			}
+		}
+		return mismatch;
+	}
+
+	//ランダムなマスクの並びで比較する
+	//maxMaskNumを影響を受けないマスクの上限より多くした場合は描画しなおす処理も確認する
+	int testMaskSequence(int count, int maxMaskNum)
+	{
+		int mismatch = 0;
+		int redrawCount = 0;
+		for (int n = 0; n < count; n++)
+		{
+			std::vector<Mask> masks(randomInt(0, maxMaskNum));
+			int influenceRate = randomInt(0, 4);	//影響を受けるマスクの割合
+			int replaceCount = 0;
+			for (size_t m = 0; m < masks.size(); m++)
+			{
+				masks[m].influence = (randomInt(0, 3) < influenceRate);
+				masks[m].visible = (randomInt(0, 7) != 0);
+				for (int i = 0; i < PIXEL_NUM; i++)
+				{
+					masks[m].cover[i] = (randomInt(0, 1) != 0);
+				}
+				if (masks[m].visible && !masks[m].influence)
+				{
+					replaceCount++;
+				}
+			}
+			if (replaceCount > SSMASK_REPLACE_MAX)
+			{
+				redrawCount++;
+			}
+			if (compareMaskSequence(masks) != 0)
+			{
+				mismatch++;
+			}
+		}
+		printf("mask sequence (max %d masks, %d redraw): %d / %d mismatch\n", maxMaskNum, redrawCount, mismatch, count);
+		return mismatch;
+	}
+}
+
+int main()
+{
+	int mismatch = 0;
+	mismatch += testMaskSequence(30000, 12);
+	mismatch += testMaskSequence(300, SSMASK_REPLACE_MAX * 3);
+	return (mismatch == 0) ? 0 : 1;
+}
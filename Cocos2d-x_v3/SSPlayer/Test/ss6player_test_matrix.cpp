@@ -0,0 +1,153 @@
+﻿/**
+*  ss6player_test_matrix.cpp
+*
+*  マトリクス計算の高速化した経路が、元の4x4のマトリクスの乗算と同じ結果になるかを確認します。
+*  ・MultiplyTRSMatrixの2Dの計算と4x4の計算
+*  ・MultiplyTRSMatrixBatch（SIMD）とMultiplyTRSMatrix（スカラー）
+*  ランダムな値で計算して、一致しなかった数を表示します（一致しない場合は終了コード1）。
+*/
+#include "Common/Animator/ssplayer_matrix.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <random>
+
+namespace
+{
+	std::mt19937 engine(12345);
+
+	float randomFloat(float minValue, float maxValue)
+	{
+		std::uniform_real_distribution<float> dist(minValue, maxValue);
+		return dist(engine);
+	}
+
+	void randomMatrix(float* mat)
+	{
+		for (int i = 0; i < 16; i++)
+		{
+			mat[i] = randomFloat(-4.0f, 4.0f);
+		}
+	}
+
+	//値が一致するか（+0と-0は同じ値として扱う）
+	bool isEqualMatrix(const float* a, const float* b)
+	{
+		for (int i = 0; i < 16; i++)
+		{
+			if (a[i] != b[i])
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	//MultiplyTRSMatrixの4x4の計算（X回転、Y回転が0でも全てのマトリクスを乗算する）
+	void multiplyTRSMatrix4x4(float* mat, float x, float y, float rx, float ry, float rz, float sx, float sy)
+	{
+		float t[16];
+		ss::TranslationMatrix(t, x, y, 0.0f);
+		ss::MultiplyMatrix(t, mat, mat);
+		ss::Matrix4RotationX(t, rx);
+		ss::MultiplyMatrix(t, mat, mat);
+		ss::Matrix4RotationY(t, ry);
+		ss::MultiplyMatrix(t, mat, mat);
+		ss::Matrix4RotationZ(t, rz);
+		ss::MultiplyMatrix(t, mat, mat);
+		ss::ScaleMatrix(t, sx, sy, 1.0f);
+		ss::MultiplyMatrix(t, mat, mat);
+	}
+
+	//X回転、Y回転が0の場合の2Dの計算と4x4の計算を比較する
+	int testTRS2D(int count)
+	{
+		int mismatch = 0;
+		for (int i = 0; i < count; i++)
+		{
+			float parent[16];
+			randomMatrix(parent);
+			float x = randomFloat(-1000.0f, 1000.0f);
+			float y = randomFloat(-1000.0f, 1000.0f);
+			float rz = randomFloat(-6.3f, 6.3f);
+			float sx = randomFloat(-3.0f, 3.0f);
+			float sy = randomFloat(-3.0f, 3.0f);
+
+			float fast[16];
+			float full[16];
+			memcpy(fast, parent, sizeof(fast));
+			memcpy(full, parent, sizeof(full));
+			ss::MultiplyTRSMatrix(fast, x, y, 0.0f, 0.0f, rz, sx, sy);
+			multiplyTRSMatrix4x4(full, x, y, 0.0f, 0.0f, rz, sx, sy);
+			if (!isEqualMatrix(fast, full))
+			{
+				mismatch++;
+			}
+		}
+		printf("MultiplyTRSMatrix 2D / 4x4: %d / %d mismatch\n", mismatch, count);
+		return mismatch;
+	}
+
+	//4パーツ分をまとめた計算とパーツ毎の計算を比較する
+	int testTRSBatch(int count)
+	{
+		enum { LANE = ss::TRSMatrixBatch::LANE };
+
+		int mismatch = 0;
+		for (int i = 0; i < count; i++)
+		{
+			ss::TRSMatrixBatch batch;
+			float parent[LANE][16];
+			float x[LANE], y[LANE], rz[LANE], sx[LANE], sy[LANE], lsx[LANE], lsy[LANE];
+			for (int lane = 0; lane < LANE; lane++)
+			{
+				randomMatrix(parent[lane]);
+				x[lane] = randomFloat(-1000.0f, 1000.0f);
+				y[lane] = randomFloat(-1000.0f, 1000.0f);
+				rz[lane] = randomFloat(-6.3f, 6.3f);
+				sx[lane] = randomFloat(-3.0f, 3.0f);
+				sy[lane] = randomFloat(-3.0f, 3.0f);
+				lsx[lane] = sx[lane] * randomFloat(-3.0f, 3.0f);
+				lsy[lane] = sy[lane] * randomFloat(-3.0f, 3.0f);
+				ss::SetTRSMatrixBatch(batch, lane, parent[lane], x[lane], y[lane], rz[lane], sx[lane], sy[lane], lsx[lane], lsy[lane]);
+			}
+
+			//結果は[要素][レーン]の順に並ぶ
+			float mat[16 * LANE];
+			float localmat[16 * LANE];
+			ss::MultiplyTRSMatrixBatch(batch, mat, localmat);
+
+			for (int lane = 0; lane < LANE; lane++)
+			{
+				float scalar[16];
+				float scalarLocal[16];
+				memcpy(scalar, parent[lane], sizeof(scalar));
+				memcpy(scalarLocal, parent[lane], sizeof(scalarLocal));
+				ss::MultiplyTRSMatrix(scalar, x[lane], y[lane], 0.0f, 0.0f, rz[lane], sx[lane], sy[lane]);
+				ss::MultiplyTRSMatrix(scalarLocal, x[lane], y[lane], 0.0f, 0.0f, rz[lane], lsx[lane], lsy[lane]);
+
+				float simd[16];
+				float simdLocal[16];
+				for (int e = 0; e < 16; e++)
+				{
+					simd[e] = mat[e * LANE + lane];
+					simdLocal[e] = localmat[e * LANE + lane];
+				}
+				if (!isEqualMatrix(simd, scalar) || !isEqualMatrix(simdLocal, scalarLocal))
+				{
+					mismatch++;
+				}
+			}
+		}
+		printf("MultiplyTRSMatrixBatch / MultiplyTRSMatrix: %d / %d mismatch\n", mismatch, count * LANE);
+		return mismatch;
+	}
+}
+
+int main()
+{
+	int mismatch = 0;
+	mismatch += testTRS2D(100000);
+	mismatch += testTRSBatch(30000);
+	return (mismatch == 0) ? 0 : 1;
+}